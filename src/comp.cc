@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <vector>
 #include <math.h>
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <thread>
@@ -33,14 +34,18 @@ using std::shared_ptr;
 using std::make_shared;
 using std::thread;
 
+#include <boost/algorithm/string.hpp>
 #include <boost/exception/all.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/program_options.hpp>
+#include <boost/timer/timer.hpp>
 namespace po = boost::program_options;
 namespace bfs = boost::filesystem;
 using bfs::path;
+using boost::timer::cpu_timer;
 
+#include <jellyfish/binary_dumper.hpp>
 #include <jellyfish/large_hash_iterator.hpp>
 
 #include "inc/matrix/matrix_metadata_extractor.hpp"
@@ -79,6 +84,7 @@ kat::CompCounters::CompCounters(const path& _hash1_path, const path& _hash2_path
     shared_hash1_total = 0;
     shared_hash2_total = 0;
     shared_distinct = 0;
+    sample_fraction = 1.0;
 }
         
 kat::CompCounters::CompCounters(const CompCounters& o) {
@@ -98,6 +104,7 @@ kat::CompCounters::CompCounters(const CompCounters& o) {
     shared_hash1_total = o.shared_hash1_total;
     shared_hash2_total = o.shared_hash2_total;
     shared_distinct = o.shared_distinct;
+    sample_fraction = o.sample_fraction;
 }
 
 void kat::CompCounters::updateHash1Counters(uint64_t hash1_count, uint64_t hash2_count) {
@@ -135,6 +142,53 @@ void kat::CompCounters::updateSharedCounters(uint64_t hash1_count, uint64_t hash
     }
 }
 
+void kat::CompCounters::merge(const CompCounters& o) {
+    hash1_total += o.hash1_total;
+    hash2_total += o.hash2_total;
+    hash3_total += o.hash3_total;
+    hash1_distinct += o.hash1_distinct;
+    hash2_distinct += o.hash2_distinct;
+    hash3_distinct += o.hash3_distinct;
+    hash1_only_total += o.hash1_only_total;
+    hash2_only_total += o.hash2_only_total;
+    hash1_only_distinct += o.hash1_only_distinct;
+    hash2_only_distinct += o.hash2_only_distinct;
+    shared_hash1_total += o.shared_hash1_total;
+    shared_hash2_total += o.shared_hash2_total;
+    shared_distinct += o.shared_distinct;
+}
+
+void kat::CompCounters::scale(double fraction) {
+    
+    const double factor = 1.0 / fraction;
+    
+    hash1_total = llround(hash1_total * factor);
+    hash2_total = llround(hash2_total * factor);
+    hash3_total = llround(hash3_total * factor);
+    hash1_distinct = llround(hash1_distinct * factor);
+    hash2_distinct = llround(hash2_distinct * factor);
+    hash3_distinct = llround(hash3_distinct * factor);
+    hash1_only_total = llround(hash1_only_total * factor);
+    hash2_only_total = llround(hash2_only_total * factor);
+    hash1_only_distinct = llround(hash1_only_distinct * factor);
+    hash2_only_distinct = llround(hash2_only_distinct * factor);
+    shared_hash1_total = llround(shared_hash1_total * factor);
+    shared_hash2_total = llround(shared_hash2_total * factor);
+    shared_distinct = llround(shared_distinct * factor);
+    
+    sample_fraction *= fraction;
+}
+
+string kat::CompCounters::stdErr(uint64_t estimate) const {
+    
+    if (sample_fraction >= 1.0)
+        return "";
+    
+    // Binomial sampling error of a distinct count estimated from a sample
+    double se = sqrt((double)estimate * (1.0 - sample_fraction) / sample_fraction);
+    return string(" (+/- ") + lexical_cast<string>(llround(se)) + ")";
+}
+
 void kat::CompCounters::printCounts(ostream &out) {
 
     out << "K-mer statistics for: " << endl;
@@ -145,6 +199,11 @@ void kat::CompCounters::printCounts(ostream &out) {
         out << " - Hash 3: " << hash3_path << endl;
 
     out << endl;
+    
+    if (sample_fraction < 1.0) {
+        out << "Estimated from a sample of " << sample_fraction * 100.0 << "% of K-mers.  " 
+            << "Distinct counts are shown with +/- one standard error." << endl << endl;
+    }
 
     out << "Total K-mers in: " << endl;
     out << " - Hash 1: " << hash1_total << endl;
@@ -156,10 +215,10 @@ void kat::CompCounters::printCounts(ostream &out) {
     out << endl;
 
     out << "Distinct K-mers in:" << endl;
-    out << " - Hash 1: " << hash1_distinct << endl;
-    out << " - Hash 2: " << hash2_distinct << endl;
+    out << " - Hash 1: " << hash1_distinct << stdErr(hash1_distinct) << endl;
+    out << " - Hash 2: " << hash2_distinct << stdErr(hash2_distinct) << endl;
     if (hash3_total > 0)
-        out << " - Hash 3: " << hash3_distinct << endl;
+        out << " - Hash 3: " << hash3_distinct << stdErr(hash3_distinct) << endl;
 
     out << endl;
 
@@ -169,21 +228,23 @@ void kat::CompCounters::printCounts(ostream &out) {
     out << endl;
 
     out << "Distinct K-mers only found in:" << endl;
-    out << " - Hash 1: " << hash1_only_distinct << endl;
-    out << " - Hash 2: " << hash2_only_distinct << endl << endl;
+    out << " - Hash 1: " << hash1_only_distinct << stdErr(hash1_only_distinct) << endl;
+    out << " - Hash 2: " << hash2_only_distinct << stdErr(hash2_only_distinct) << endl << endl;
 
     out << "Shared K-mers:" << endl;
     out << " - Total shared found in hash 1: " << shared_hash1_total << endl;
     out << " - Total shared found in hash 2: " << shared_hash2_total << endl;
-    out << " - Distinct shared K-mers: " << shared_distinct << endl << endl;
+    out << " - Distinct shared K-mers: " << shared_distinct << stdErr(shared_distinct) << endl << endl;
 }
      
 
 // ******** ThreadedCompCounters *********
 
 
-kat::ThreadedCompCounters::ThreadedCompCounters(const path& _hash1_path, const path& _hash2_path, const path& _hash3_path) {
-    final_matrix = CompCounters(_hash1_path, _hash2_path, _hash3_path);            
+kat::ThreadedCompCounters::ThreadedCompCounters(const path& _hash1_path, const path& _hash2_path, const path& _hash3_path, uint16_t _threads) :
+        threads(_threads) {
+    final_matrix = CompCounters(_hash1_path, _hash2_path, _hash3_path);
+    threaded_counters = ThreadSlots<CompCounters>(threads, final_matrix);
 }
                 
 void kat::ThreadedCompCounters::printCounts(ostream &out) {
@@ -195,29 +256,111 @@ void kat::ThreadedCompCounters::add(shared_ptr<CompCounters> cc) {
     cc->hash2_path = final_matrix.hash2_path;
     cc->hash3_path = final_matrix.hash3_path;
     threaded_counters.push_back(*cc);
+    threads = threaded_counters.size();
 }
         
 void kat::ThreadedCompCounters::merge() {
 
-    // Merge counters
-    for (const auto& itp : threaded_counters) {
+    if (threaded_counters.empty())
+        return;
+    
+    // Reduce a copy, so the per thread counters are still available afterwards
+    ThreadSlots<CompCounters> counters(threaded_counters);
+    
+    final_matrix.merge(counters.reduce([](CompCounters& into, const CompCounters& from) {
+        into.merge(from);
+    }));
+}
+
+
+// ********* CountRegion **********
 
-        final_matrix.hash1_total += itp.hash1_total;
-        final_matrix.hash2_total += itp.hash2_total;
-        final_matrix.hash3_total += itp.hash3_total;
-        final_matrix.hash1_distinct += itp.hash1_distinct;
-        final_matrix.hash2_distinct += itp.hash2_distinct;
-        final_matrix.hash3_distinct += itp.hash3_distinct;
-        final_matrix.hash1_only_total += itp.hash1_only_total;
-        final_matrix.hash2_only_total += itp.hash2_only_total;
-        final_matrix.hash1_only_distinct += itp.hash1_only_distinct;
-        final_matrix.hash2_only_distinct += itp.hash2_only_distinct;
-        final_matrix.shared_hash1_total += itp.shared_hash1_total;
-        final_matrix.shared_hash2_total += itp.shared_hash2_total;
-        final_matrix.shared_distinct += itp.shared_distinct;
+kat::CountRegion::CountRegion() {
+    for(uint16_t i = 0; i < 3; i++) {
+        low[i] = 0;
+        high[i] = std::numeric_limits<uint64_t>::max();
+    }
+}
+
+kat::CountRegion::CountRegion(const string& region) : CountRegion() {
+    
+    vector<string> parts;
+    boost::split(parts, region, boost::is_any_of(","));
+    
+    if (parts.empty() || parts.size() > 3) {
+        BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "Count region must contain 1 to 3 comma separated ranges.  Region: ") + region));
+    }
+    
+    for(uint16_t i = 0; i < parts.size(); i++) {
+        
+        string part = boost::trim_copy(parts[i]);
+        
+        if (part == "*") continue;
+        
+        try {
+            size_t dash = part.find('-');
+            if (dash == string::npos) {
+                low[i] = high[i] = lexical_cast<uint64_t>(part);
+            }
+            else {
+                low[i] = lexical_cast<uint64_t>(part.substr(0, dash));
+                high[i] = lexical_cast<uint64_t>(part.substr(dash + 1));
+            }
+        }
+        catch(boost::bad_lexical_cast&) {
+            BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "Could not parse count range '") + part + "' in region: " + region));
+        }
+        
+        if (high[i] < low[i]) {
+            BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "High count must be >= low count in range '") + part + "' of region: " + region));
+        }
     }
 }
 
+string kat::CountRegion::toString() const {
+    
+    string s;
+    for(uint16_t i = 0; i < 3; i++) {
+        if (i > 0) s += ",";
+        if (low[i] == 0 && high[i] == std::numeric_limits<uint64_t>::max())
+            s += "*";
+        else
+            s += lexical_cast<string>(low[i]) + "-" + lexical_cast<string>(high[i]);
+    }
+    return s;
+}
+
+
+// ********* RegionExporter **********
+
+kat::RegionExporter::RegionExporter(const CountRegion& _region, const path& _outputPath, file_header& header) :
+    region(_region), outputPath(_outputPath), nbRecords(0) {
+    
+    keyBytes = header.key_len() / 8 + (header.key_len() % 8 != 0);
+    
+    out.open(outputPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    
+    if (!out.good()) {
+        BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "Could not open file for writing: ") + outputPath.string()));
+    }
+    
+    header.write(out);
+}
+
+void kat::RegionExporter::flush(string& buffer) {
+    
+    if (buffer.empty()) return;
+    
+    std::lock_guard<std::mutex> lock(mu);
+    out.write(buffer.data(), buffer.size());
+    nbRecords += buffer.size() / (keyBytes + sizeof(uint32_t));
+    buffer.clear();
+}
+
     
 // ********* Comp **********
 
@@ -247,16 +390,27 @@ kat::Comp::Comp(const vector<path>& _input1, const vector<path>& _input2, const
     init(_input1, _input2, _input3);
 }
 
+kat::Comp::Comp(const vector<vector<path>>& _inputs) {    
+    init(_inputs);
+}
+
 void kat::Comp::init(const vector<path>& _input1, const vector<path>& _input2, const vector<path>& _input3) {
-    input = !_input3.empty() ? vector<InputHandler>(3) : vector<InputHandler>(2);
-    
-    input[0].setMultipleInputs(_input1);
-    input[1].setMultipleInputs(_input2);
-    input[0].index = 1;
-    input[1].index = 2;
+    vector<vector<path>> inputs;
+    inputs.push_back(_input1);
+    inputs.push_back(_input2);
     if (!_input3.empty()) {
-        input[2].setMultipleInputs(_input3);
-        input[2].index = 3;
+        inputs.push_back(_input3);
+    }
+    
+    init(inputs);
+}
+
+void kat::Comp::init(const vector<vector<path>>& _inputs) {
+    input = vector<InputHandler>(_inputs.size());
+    
+    for(uint16_t i = 0; i < _inputs.size(); i++) {
+        input[i].setMultipleInputs(_inputs[i]);
+        input[i].index = i + 1;
     }
     
     outputPrefix = "kat-comp";
@@ -268,14 +422,46 @@ void kat::Comp::init(const vector<path>& _input1, const vector<path>& _input2, c
     analysisThreads = 1;
     merLen = DEFAULT_MER_LEN; 
     densityPlot = false;
+    nway = false;
+    oneVsMany = false;
+    sampleFraction = 1.0;
+    prefilter = true;
     verbose = false;      
 }
 
-void kat::Comp::execute() {
+void kat::Comp::validate() {
 
+    if (nway && !exportRegions.empty()) {
+        BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "K-mer export is not supported in N-way mode")));
+    }
+    
+    for(auto& r : exportRegions) {
+        if (!doThirdHash() && r.usesHash3()) {
+            BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "Export region constrains the hash 3 count but no third input was given.  Region: ") + r.toString()));
+        }
+    }
+    
+    if (oneVsMany && nway) {
+        BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "One vs many mode cannot be combined with N-way mode")));
+    }
+    
+    if (!nway && !oneVsMany && input.size() > 3) {
+        BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "Comparing more than three inputs requires N-way mode.  Number of inputs: ") + lexical_cast<string>(input.size())));
+    }
+    
+    if (sampleFraction <= 0.0 || sampleFraction > 1.0) {
+        BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "Sample fraction must be greater than 0 and no greater than 1.  Sample fraction: ") + lexical_cast<string>(sampleFraction)));
+    }
+    
     // Check input files exist and determine input mode
     for(uint16_t i = 0; i < input.size(); i++) {
         input[i].validateInput();
+        input[i].sampleFraction = sampleFraction;
     }
         
     // Create output directory
@@ -286,7 +472,9 @@ void kat::Comp::execute() {
                     "Could not create output directory: ") + parentDir.string()));
         }
     }
-    
+}
+
+void kat::Comp::initMatrices() {
     
     // Create the final K-mer counter matrices
     main_matrix = ThreadedSparseMatrix(d1Bins, d2Bins, analysisThreads);
@@ -303,7 +491,38 @@ void kat::Comp::execute() {
     comp_counters = ThreadedCompCounters(
             input[0].getSingleInput(), 
             input[1].getSingleInput(), 
-            input.size() == 3 ? input[2].getSingleInput() : path());
+            doThirdHash() ? input[2].getSingleInput() : path(),
+            analysisThreads);
+    
+    // Initialise the pairwise matrices and counters for N-way mode
+    if (nway) {
+        
+        nway_matrices.clear();
+        for(uint16_t i = 1; i < input.size(); i++) {
+            nway_matrices.push_back(ThreadedSparseMatrix(d1Bins, d2Bins, analysisThreads));
+        }
+        
+        spectra_matrix = ThreadedSparseMatrix(input.size(), std::max(d1Bins, d2Bins), analysisThreads);
+        
+        nway_counters.clear();
+        for(uint16_t i = 0; i < input.size(); i++) {
+            for(uint16_t j = i + 1; j < input.size(); j++) {
+                nway_counters.push_back(ThreadedCompCounters(input[i].getSingleInput(), input[j].getSingleInput(), path(), analysisThreads));
+            }
+        }
+    }
+}
+
+void kat::Comp::execute() {
+
+    if (oneVsMany) {
+        executeOneVsMany();
+        return;
+    }
+    
+    validate();
+    
+    initMatrices();
 
     std::ostream* out_stream = verbose ? &cerr : (std::ostream*)0;
 
@@ -341,10 +560,25 @@ void kat::Comp::execute() {
     
     // Load any hashes if necessary
     if (anyLoad) loadHashes();
+    
+    // Build prefilters over the hashes so that lookups for absent K-mers can
+    // be rejected without probing the hash arrays.  Input 1 is skipped: it is
+    // usually the largest hash, typically reads, and most K-mers looked up in it
+    // are present, so a filter would cost a lot of memory for little gain.
+    if (prefilter) {
+        for(uint16_t i = 1; i < input.size(); i++) {
+            input[i].buildFilter(analysisThreads);
+        }
+    }
      
     
+    // Open output files for any K-mers to export
+    if (!exportRegions.empty()) createExporters();
+    
     // Run the threads
     compare();
+    
+    if (!exportRegions.empty()) closeExporters();
 
     // Dump any hashes that were previously counted to disk if requested
     // NOTE: MUST BE DONE AFTER COMPARISON AS THIS CLEARS ENTRIES FROM HASH ARRAY!
@@ -359,6 +593,152 @@ void kat::Comp::execute() {
     merge();    
 }
 
+void kat::Comp::executeOneVsMany() {
+    
+    validate();
+    
+    if (input.size() < 2) {
+        BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "One vs many mode requires at least two inputs")));
+    }
+    
+    // Move everything after input 1 out into the list of targets.  Each target is
+    // swapped into input 2 for its comparison.
+    targets = vector<InputHandler>(input.begin() + 1, input.end());
+    input.resize(2);
+    basePrefix = outputPrefix;
+    
+    // Determine K-mer length in the same way as for a regular comparison
+    bool allLoad = input[0].mode == InputHandler::InputMode::LOAD;
+    for(auto& t : targets) {
+        allLoad = allLoad && t.mode == InputHandler::InputMode::LOAD;
+    }
+    
+    // Check the header and K-mer length of every hash before starting, so that a bad
+    // target is reported before any time is spent on the comparisons
+    input[0].loadHeader();
+    if (allLoad) merLen = input[0].header->key_len() / 2;
+    input[0].validateMerLen(merLen);
+    
+    for(auto& t : targets) {
+        t.loadHeader();
+        t.validateMerLen(merLen);
+    }
+    
+    // Get input 1 into memory.  This remains resident for all comparisons.
+    if (input[0].mode == InputHandler::InputMode::COUNT) {
+        input[0].count(merLen, ioThreads);
+    }
+    else {
+        input[0].loadHash(true);
+    }
+    
+    // Prepare the first target, then for each comparison prepare the next target
+    // in the background while the current one is being compared.  The background 
+    // work runs quietly on a quarter of the IO threads, so that it neither interleaves 
+    // with the comparison's output nor competes for all of its cores.  Its timing is
+    // reported once it has been joined.
+    prepareTarget(0, ioThreads, true);
+    
+    const uint16_t backgroundThreads = std::max(1, ioThreads / 4);
+    
+    for(uint16_t i = 0; i < targets.size(); i++) {
+        
+        targetError = nullptr;
+        
+        thread next;
+        cpu_timer nextTimer;
+        if (i + 1 < targets.size()) {
+            next = thread([this, i, backgroundThreads, &nextTimer]() {
+                try {
+                    nextTimer.start();
+                    prepareTarget(i + 1, backgroundThreads, false);
+                    nextTimer.stop();
+                }
+                catch(...) {
+                    targetError = std::current_exception();
+                }
+            });
+        }
+        
+        try {
+            compareTarget(i);
+        }
+        catch(...) {
+            // Wait for the next target before passing on the error, as destroying a
+            // thread that is still running terminates the program
+            if (next.joinable()) next.join();
+            throw;
+        }
+        
+        if (next.joinable()) next.join();
+        
+        // Pass on any problems encountered while preparing the next target
+        if (targetError) {
+            std::rethrow_exception(targetError);
+        }
+        
+        if (i + 1 < targets.size()) {
+            cout << "Prepared " << targets[i + 1].pathString() << "in the background." 
+                 << nextTimer.format(1, "  Time taken: %ws\n\n");
+            cout.flush();
+        }
+    }
+    
+    outputPrefix = basePrefix;
+    
+    if (input[0].dumpHash && input[0].mode == InputHandler::InputMode::COUNT) {
+        input[0].dump(path(basePrefix.string() + "-hash1.jf" + lexical_cast<string>(merLen)), ioThreads, true);
+    }
+}
+
+void kat::Comp::prepareTarget(uint16_t index, uint16_t threads, bool verbose) {
+    
+    InputHandler& target = targets[index];
+    
+    // Headers were already checked before the first comparison
+    if (target.mode == InputHandler::InputMode::COUNT) {
+        target.count(merLen, threads, verbose);
+    }
+    else {
+        target.loadHash(verbose);
+    }
+    
+    if (prefilter) target.buildFilter(threads, verbose);
+}
+
+void kat::Comp::compareTarget(uint16_t index) {
+    
+    cout << "Comparing " << input[0].pathString() << "against " << targets[index].pathString() << endl << endl;
+    
+    input[1] = targets[index];
+    outputPrefix = getOneVsManyPrefix(index + 1);
+    
+    initMatrices();
+    
+    if (!exportRegions.empty()) createExporters();
+    
+    compare();
+    
+    if (!exportRegions.empty()) closeExporters();
+    
+    merge();
+    
+    save();
+    
+    printCounters(cout);
+    
+    // Dump this target if requested.  Input 1 is dumped once all comparisons are complete.
+    // NOTE: MUST BE DONE AFTER COMPARISON AS THIS CLEARS ENTRIES FROM HASH ARRAY!
+    if (input[1].dumpHash && input[1].mode == InputHandler::InputMode::COUNT) {
+        input[1].dump(path(basePrefix.string() + "-hash" + lexical_cast<string>(index + 2) + ".jf" + lexical_cast<string>(merLen)), ioThreads, true);
+    }
+    
+    // Release memory for this target
+    input[1].unload();
+    targets[index].unload();
+}
+
 void kat::Comp::save() {
     
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
@@ -366,10 +746,26 @@ void kat::Comp::save() {
     cout << "Saving results to disk ...";
     cout.flush();
     
-    // Send main matrix to output file
-    ofstream main_mx_out_stream(string(outputPrefix.string() + "-main.mx").c_str());
-    printMainMatrix(main_mx_out_stream);
-    main_mx_out_stream.close();
+    if (nway) {
+        
+        // Send each pairwise matrix to its own output file
+        for(uint16_t i = 1; i < input.size(); i++) {
+            ofstream nway_mx_out_stream(getNWayMxOutPath(i).c_str());
+            printNWayMatrix(nway_mx_out_stream, i);
+            nway_mx_out_stream.close();
+        }
+        
+        // Spectra for all inputs
+        ofstream spectra_mx_out_stream(string(outputPrefix.string() + "-spectra.mx").c_str());
+        printSpectraMatrix(spectra_mx_out_stream);
+        spectra_mx_out_stream.close();
+    }
+    else {
+        // Send main matrix to output file
+        ofstream main_mx_out_stream(string(outputPrefix.string() + "-main.mx").c_str());
+        printMainMatrix(main_mx_out_stream);
+        main_mx_out_stream.close();
+    }
 
     // Output ends matrices if required
     if (doThirdHash()) {
@@ -405,14 +801,53 @@ void kat::Comp::merge() {
     cout.flush();
 
     // Merge results from the threads
-    main_matrix.mergeThreadedMatricies();
-    if (doThirdHash()) {
-        ends_matrix.mergeThreadedMatricies();
-        middle_matrix.mergeThreadedMatricies();
-        mixed_matrix.mergeThreadedMatricies();
+    if (nway) {
+        for(auto& mx : nway_matrices) {
+            mx.mergeThreadedMatricies();
+        }
+        spectra_matrix.mergeThreadedMatricies();
+        
+        for(auto& cc : nway_counters) {
+            cc.merge();
+        }
+    }
+    else {
+        main_matrix.mergeThreadedMatricies();
+        if (doThirdHash()) {
+            ends_matrix.mergeThreadedMatricies();
+            middle_matrix.mergeThreadedMatricies();
+            mixed_matrix.mergeThreadedMatricies();
+        }
+
+        comp_counters.merge();
     }
+    
+    // Scale results from a sampled run up to estimates for the full dataset
+    if (isSampling()) {
+        
+        const double factor = 1.0 / sampleFraction;
+        
+        if (nway) {
+            for(auto& mx : nway_matrices) {
+                mx.scaleFinalMatrix(factor);
+            }
+            spectra_matrix.scaleFinalMatrix(factor);
 
-    comp_counters.merge();
+            for(auto& cc : nway_counters) {
+                cc.getFinalMatrix().scale(sampleFraction);
+            }
+        }
+        else {
+            main_matrix.scaleFinalMatrix(factor);
+            if (doThirdHash()) {
+                ends_matrix.scaleFinalMatrix(factor);
+                middle_matrix.scaleFinalMatrix(factor);
+                mixed_matrix.scaleFinalMatrix(factor);
+            }
+
+            comp_counters.getFinalMatrix().scale(sampleFraction);
+        }
+    }
 
     cout << " done.";
     cout.flush();
@@ -470,8 +905,12 @@ void kat::Comp::printMainMatrix(ostream &out) {
             << mme::KEY_NB_COLUMNS << mx.height() << endl
             << mme::KEY_NB_ROWS << mx.width() << endl
             << mme::KEY_MAX_VAL << mx.getMaxVal() << endl
-            << mme::KEY_TRANSPOSE << "1" << endl
-            << mme::MX_META_END << endl;
+            << mme::KEY_TRANSPOSE << "1" << endl;
+    
+    if (isSampling())
+        out << mme::KEY_SAMPLE_FRACTION << sampleFraction << endl;
+    
+    out << mme::MX_META_END << endl;
 
     mx.printMatrix(out);
 }
@@ -506,11 +945,68 @@ void kat::Comp::printMixedMatrix(ostream &out) {
     mixed_matrix.getFinalMatrix().printMatrix(out);
 }
 
+// Print K-mer comparison matrix
+
+void kat::Comp::printNWayMatrix(ostream &out, uint16_t index) {
+
+    const SM64& mx = nway_matrices[index - 1].getFinalMatrix();
+
+    out << mme::KEY_TITLE << "K-mer comparison plot" << endl
+            << mme::KEY_X_LABEL << "K-mer multiplicity for: " << input[0].getSingleInput().string() << endl
+            << mme::KEY_Y_LABEL << "K-mer multiplicity for: " << input[index].getSingleInput().string() << endl
+            << mme::KEY_Z_LABEL << "Distinct K-mers per bin" << endl
+            << mme::KEY_NB_COLUMNS << mx.height() << endl
+            << mme::KEY_NB_ROWS << mx.width() << endl
+            << mme::KEY_MAX_VAL << mx.getMaxVal() << endl
+            << mme::KEY_TRANSPOSE << "1" << endl;
+    
+    if (isSampling())
+        out << mme::KEY_SAMPLE_FRACTION << sampleFraction << endl;
+    
+    out << mme::MX_META_END << endl;
+
+    mx.printMatrix(out);
+}
+
+// Print K-mer spectra for each input
+
+void kat::Comp::printSpectraMatrix(ostream &out) {
+
+    const SM64& mx = spectra_matrix.getFinalMatrix();
+
+    out << mme::KEY_TITLE << "K-mer spectra for each input" << endl
+            << mme::KEY_X_LABEL << "Input" << endl
+            << mme::KEY_Y_LABEL << "K-mer multiplicity" << endl
+            << mme::KEY_Z_LABEL << "Distinct K-mers per bin" << endl
+            << mme::KEY_NB_COLUMNS << mx.height() << endl
+            << mme::KEY_NB_ROWS << mx.width() << endl
+            << mme::KEY_MAX_VAL << mx.getMaxVal() << endl
+            << mme::KEY_TRANSPOSE << "0" << endl;
+    
+    if (isSampling())
+        out << mme::KEY_SAMPLE_FRACTION << sampleFraction << endl;
+    
+    out << mme::MX_META_END << endl;
+    
+    for(uint16_t i = 0; i < input.size(); i++) {
+        out << "# Row " << i << ": " << input[i].getSingleInput().string() << endl;
+    }
+
+    mx.printMatrix(out);
+}
+
 // Print K-mer statistics
 
 void kat::Comp::printCounters(ostream &out) {
 
-    comp_counters.printCounts(out);
+    if (nway) {
+        for(auto& cc : nway_counters) {
+            cc.printCounts(out);
+        }
+    }
+    else {
+        comp_counters.printCounts(out);
+    }
 }
 
         
@@ -524,7 +1020,9 @@ void kat::Comp::compare() {
     thread t[analysisThreads];
 
     for(int i = 0; i < analysisThreads; i++) {
-        t[i] = thread(&Comp::compareSlice, this, i);
+        t[i] = nway ? 
+            thread(&Comp::compareNWaySlice, this, i) :
+            thread(&Comp::compareSlice, this, i);
     }
 
     for(int i = 0; i < analysisThreads; i++){
@@ -535,9 +1033,46 @@ void kat::Comp::compare() {
     cout.flush();
 }
 
+void kat::Comp::createExporters() {
+    
+    // Exported K-mers are written as a jellyfish binary hash so they can be loaded
+    // back in to KAT or jellyfish.  Records are not sorted.
+    file_header header;
+    header.fill_standard();
+    header.update_from_ary(*input[0].hash);
+    header.counter_len(4);
+    header.canonical(input[0].canonical);
+    header.format(binary_dumper::format);
+    
+    exporters.clear();
+    for(uint16_t i = 0; i < exportRegions.size(); i++) {
+        exporters.push_back(make_shared<RegionExporter>(exportRegions[i], getExportPath(i), header));
+    }
+}
+
+void kat::Comp::closeExporters() {
+    
+    for(uint16_t i = 0; i < exporters.size(); i++) {
+        exporters[i]->close();
+        cout << "Exported " << exporters[i]->getNbRecords() << " distinct K-mers in region " 
+             << exporters[i]->getRegion().toString() << " to " << exporters[i]->getOutputPath().string() << endl;
+    }
+    cout << endl;
+}
+
 void kat::Comp::compareSlice(int th_id) {
 
-    shared_ptr<CompCounters> cc = make_shared<CompCounters>();
+    // Each thread updates its own counters, so no locking is needed
+    CompCounters& cc = comp_counters.getThreadedMatrixAt(th_id);
+    
+    // Thread local buffers for K-mer export
+    vector<string> exportBuffers(exporters.size());
+    bool exportUsesHash3 = false;
+    for(auto& e : exporters) exportUsesHash3 = exportUsesHash3 || e->getRegion().usesHash3();
+    
+    const uint64_t threshold1 = sampleThreshold(0);
+    const uint64_t threshold2 = sampleThreshold(1);
+    const uint64_t threshold3 = doThirdHash() ? sampleThreshold(2) : 0;
 
     // Setup iterator for this thread's chunk of hash1
     LargeHashArray::eager_iterator hash1Iterator = input[0].hash->eager_slice(th_id, analysisThreads);
@@ -545,20 +1080,22 @@ void kat::Comp::compareSlice(int th_id) {
     // Go through this thread's slice for hash1
     while (hash1Iterator.next()) {
         
+        if (!JellyfishHelper::inSample(hash1Iterator.key(), threshold1)) continue;
+        
         // Get the current K-mer count for hash1
         uint64_t hash1_count = hash1Iterator.val();
 
         // Get the count for this K-mer in hash2 (assuming it exists... 0 if not)
-        uint64_t hash2_count = JellyfishHelper::getCount(input[1].hash, hash1Iterator.key(), input[1].canonical);
+        uint64_t hash2_count = input[1].getCount(hash1Iterator.key());
 
         // Get the count for this K-mer in hash3 (assuming it exists... 0 if not)
-        uint64_t hash3_count = doThirdHash() ? JellyfishHelper::getCount(input[2].hash, hash1Iterator.key(), input[2].canonical) : 0;
+        uint64_t hash3_count = doThirdHash() ? input[2].getCount(hash1Iterator.key()) : 0;
 
         // Increment hash1's unique counters
-        cc->updateHash1Counters(hash1_count, hash2_count);
+        cc.updateHash1Counters(hash1_count, hash2_count);
 
         // Increment shared counters
-        cc->updateSharedCounters(hash1_count, hash2_count);
+        cc.updateSharedCounters(hash1_count, hash2_count);
 
         // Scale counters to make the matrix look pretty
         uint64_t scaled_hash1_count = scaleCounter(hash1_count, d1Scale);
@@ -582,6 +1119,13 @@ void kat::Comp::compareSlice(int th_id) {
             else
                 middle_matrix.incTM(th_id, scaled_hash1_count, scaled_hash3_count, 1);
         }
+        
+        // Export this K-mer if it falls into any of the requested regions
+        for(size_t r = 0; r < exporters.size(); r++) {
+            if (exporters[r]->getRegion().contains(hash1_count, hash2_count, hash3_count)) {
+                exporters[r]->add(exportBuffers[r], hash1Iterator.key(), hash1_count);
+            }
+        }
     }
 
     // Setup iterator for this thread's chunk of hash2
@@ -591,14 +1135,17 @@ void kat::Comp::compareSlice(int th_id) {
 
     // Iterate through this thread's slice of hash2
     while (hash2Iterator.next()) {
+        
+        if (!JellyfishHelper::inSample(hash2Iterator.key(), threshold2)) continue;
+        
         // Get the current K-mer count for hash2
         uint64_t hash2_count = hash2Iterator.val();
 
         // Get the count for this K-mer in hash1 (assuming it exists... 0 if not)
-        uint64_t hash1_count = JellyfishHelper::getCount(input[0].hash, hash2Iterator.key(), input[0].hash);
+        uint64_t hash1_count = input[0].getCount(hash2Iterator.key());
 
         // Increment hash2's unique counters (don't bother with shared counters... we've already done this)
-        cc->updateHash2Counters(hash1_count, hash2_count);
+        cc.updateHash2Counters(hash1_count, hash2_count);
 
         // Only bother updating thread matrix with K-mers not found in hash1 (we've already done the rest)
         if (hash1_count == 0) {
@@ -610,8 +1157,25 @@ void kat::Comp::compareSlice(int th_id) {
 
             // Increment the position in the matrix determined by the scaled counts found in hash1 and hash2
             main_matrix.incTM(th_id, 0, scaled_hash2_count, 1);
+            
+            // Export K-mers only found in hash2 (the rest were handled when going through hash1).
+            // As there is no hash1 count for these we record the hash2 count instead.
+            if (!exporters.empty()) {
+                
+                uint64_t hash3_count = exportUsesHash3 ? input[2].getCount(hash2Iterator.key()) : 0;
+                
+                for(size_t r = 0; r < exporters.size(); r++) {
+                    if (exporters[r]->getRegion().contains(0, hash2_count, hash3_count)) {
+                        exporters[r]->add(exportBuffers[r], hash2Iterator.key(), hash2_count);
+                    }
+                }
+            }
         }
     }
+    
+    for(size_t r = 0; r < exporters.size(); r++) {
+        exporters[r]->flush(exportBuffers[r]);
+    }
 
     // Only update hash3 counters if hash3 was provided
     if (doThirdHash()) {
@@ -620,18 +1184,89 @@ void kat::Comp::compareSlice(int th_id) {
 
         // Iterate through this thread's slice of hash2
         while (hash3Iterator.next()) {
+            
+            if (!JellyfishHelper::inSample(hash3Iterator.key(), threshold3)) continue;
+            
             // Get the current K-mer count for hash2
 
             uint64_t hash3_count = hash3Iterator.val();
 
             // Increment hash3's unique counters (don't bother with shared counters... we've already done this)
-            cc->updateHash3Counters(hash3_count);
+            cc.updateHash3Counters(hash3_count);
         }
     }
+}
+
+void kat::Comp::compareNWaySlice(int th_id) {
+
+    const uint16_t nbInputs = input.size();
+    
+    vector<CompCounters> ccs(nway_counters.size());
+    vector<uint64_t> counts(nbInputs, 0);
+    vector<uint64_t> scaled(nbInputs, 0);
+    
+    // Walk each input's slice in turn.  Together this covers the union of K-mers
+    // across all inputs, but each K-mer is only processed by the first input it
+    // appears in.
+    for(uint16_t i = 0; i < nbInputs; i++) {
+    
+        LargeHashArray::eager_iterator it = input[i].hash->eager_slice(th_id, analysisThreads);
+        const uint64_t threshold = sampleThreshold(i);
+
+        while (it.next()) {
+            
+            if (!JellyfishHelper::inSample(it.key(), threshold)) continue;
 
-    mu.lock();
-    comp_counters.add(cc);
-    mu.unlock();
+            // Skip this K-mer if it has already been processed via an earlier input
+            bool processed = false;
+            for(uint16_t j = 0; j < i && !processed; j++) {
+                processed = input[j].getCount(it.key()) != 0;
+            }
+            
+            if (processed) continue;
+            
+            // Resolve the count for this K-mer in all inputs
+            for(uint16_t j = 0; j < nbInputs; j++) {
+                
+                counts[j] = j < i ? 0 : 
+                            j == i ? it.val() : 
+                            input[j].getCount(it.key());
+                
+                // Scale counters to make the matrix look pretty and dump large counts in the last slot
+                const double scale = j == 0 ? d1Scale : d2Scale;
+                const uint16_t bins = j == 0 ? d1Bins : d2Bins;
+                scaled[j] = scaleCounter(counts[j], scale);
+                if (scaled[j] >= bins) scaled[j] = bins - 1;
+                
+                if (counts[j] != 0) {
+                    spectra_matrix.incTM(th_id, j, scaled[j], 1);
+                }
+            }
+            
+            // Update counters for every pair of inputs
+            for(uint16_t a = 0; a < nbInputs; a++) {
+                for(uint16_t b = a + 1; b < nbInputs; b++) {
+                    
+                    CompCounters& cc = ccs[pairIndex(a, b)];
+                    
+                    if (counts[a] != 0) cc.updateHash1Counters(counts[a], counts[b]);
+                    if (counts[b] != 0) cc.updateHash2Counters(counts[a], counts[b]);
+                    cc.updateSharedCounters(counts[a], counts[b]);
+                }
+            }
+            
+            // Update matrices for input 1 vs each other input
+            for(uint16_t j = 1; j < nbInputs; j++) {
+                if (counts[0] != 0 || counts[j] != 0) {
+                    nway_matrices[j - 1].incTM(th_id, scaled[0], scaled[j], 1);
+                }
+            }
+        }
+    }
+    
+    for(size_t p = 0; p < ccs.size(); p++) {
+        nway_counters[p].getThreadedMatrixAt(th_id).merge(ccs[p]);
+    }
 }
 
 void kat::Comp::plot() {
@@ -644,20 +1279,18 @@ void kat::Comp::plot() {
     bool res = true;
     
     // Plot results
-    if (densityPlot) {
-        PlotDensity pd(getMxOutPath(), path(getMxOutPath().string() + ".density.png"));
-        pd.setXLabel(string("# Distinct kmers for ") + input[0].pathString());
-        pd.setYLabel(string("# Distinct kmers for ") + input[1].pathString());
-        pd.setZLabel("Kmer multiplicity");
-        pd.setTitle(string("Spectra Density Plot for: ") + input[0].pathString() + " vs " + input[1].pathString());
-        res = pd.plot();
+    if (nway) {
+        for(uint16_t i = 1; i < input.size(); i++) {
+            res = plotMatrix(getNWayMxOutPath(i), input[i]) && res;
+        }
+    }
+    else if (oneVsMany) {
+        for(uint16_t i = 0; i < targets.size(); i++) {
+            res = plotMatrix(path(getOneVsManyPrefix(i + 1).string() + "-main.mx"), targets[i]) && res;
+        }
     }
     else {
-        PlotSpectraCn pscn(getMxOutPath(), path(getMxOutPath().string() + ".spectra-cn.png"));
-        pscn.setTitle(string("Spectra CN Plot for: ") + input[0].pathString() + " vs " + input[1].pathString());
-        pscn.setYLabel("# Distinct kmers");
-        pscn.setXLabel("Kmer multiplicity");
-        res = pscn.plot();
+        res = plotMatrix(getMxOutPath(), input[1]);
     }
     
     if (!res) {
@@ -670,13 +1303,30 @@ void kat::Comp::plot() {
     cout.flush();
 }
 
+bool kat::Comp::plotMatrix(const path& mxPath, const InputHandler& other) {
+    
+    if (densityPlot) {
+        PlotDensity pd(mxPath, path(mxPath.string() + ".density.png"));
+        pd.setXLabel(string("# Distinct kmers for ") + input[0].pathString());
+        pd.setYLabel(string("# Distinct kmers for ") + other.pathString());
+        pd.setZLabel("Kmer multiplicity");
+        pd.setTitle(string("Spectra Density Plot for: ") + input[0].pathString() + " vs " + other.pathString());
+        return pd.plot();
+    }
+    else {
+        PlotSpectraCn pscn(mxPath, path(mxPath.string() + ".spectra-cn.png"));
+        pscn.setTitle(string("Spectra CN Plot for: ") + input[0].pathString() + " vs " + other.pathString());
+        pscn.setYLabel("# Distinct kmers");
+        pscn.setXLabel("Kmer multiplicity");
+        return pscn.plot();
+    }
+}
+
 
 
 int kat::Comp::main(int argc, char *argv[]) {
 
-    string input1;
-    string input2;
-    string input3;
+    vector<string> inputs;
     path output_prefix;
     double d1_scale;
     double d2_scale;
@@ -694,6 +1344,11 @@ int kat::Comp::main(int argc, char *argv[]) {
     bool dump_hashes;
     bool disable_hash_grow;
     bool density_plot;
+    bool nway;
+    bool one_vs_many;
+    double sample_fraction;
+    bool disable_prefilter;
+    vector<string> export_regions;
     bool verbose;
     bool help;
 
@@ -734,6 +1389,16 @@ int kat::Comp::main(int argc, char *argv[]) {
                 "By default jellyfish will double the size of the hash if it gets filled, and then attempt to recount.  Setting this option to true, disables automatic hash growing.  If the hash gets filled an error is thrown.  This option is useful if you are working with large genomes, or have strict memory limits on your system.")   
             ("density_plot,p", po::bool_switch(&density_plot)->default_value(false),
                 "Makes a spectra_mx plot.  By default we create a spectra_cn plot.")
+            ("nway,N", po::bool_switch(&nway)->default_value(false),
+                "Compares any number of inputs in a single pass over the union of their K-mers.  Produces a spectra for each input, K-mer statistics for every pair of inputs and a comparison matrix (and plot) for input 1 vs each other input.  Options relating to input 2 apply to all inputs other than input 1.  All hashes are held in memory at the same time.")
+            ("one_vs_many", po::bool_switch(&one_vs_many)->default_value(false),
+                "Compares input 1 against each of the other inputs in turn, keeping input 1 in memory throughout.  The next input is counted or loaded in the background, using a quarter of the threads, while the current comparison runs.  Results for each pair are written using the prefix <output_prefix>-1v<N>.  Options relating to input 2 apply to all inputs other than input 1.")
+            ("sample_fraction,f", po::value<double>(&sample_fraction)->default_value(1.0),
+                "Fraction of K-mers to compare, in the range (0,1].  Values below 1 give a fast approximate comparison: K-mers are selected by hash value so the same subset is taken from each input, and the matrices and statistics are scaled up to estimates for the full dataset.")
+            ("disable_prefilter", po::bool_switch(&disable_prefilter)->default_value(false),
+                "By default a compact filter is built over the K-mers in each hash after the first so that lookups for absent K-mers can be answered without probing the hash itself.  This uses roughly 10 bits per distinct K-mer in those hashes.  Setting this option skips building the filters to save memory.")
+            ("export_region", po::value<vector<string>>(&export_regions),
+                "Writes the K-mers whose counts fall into the given region of the comparison to a jellyfish binary hash at <output_prefix>-region<N>.jf<mer_len>.  Regions take the form \"lo-hi,lo-hi[,lo-hi]\" giving inclusive count ranges for input 1, input 2 and optionally input 3.  A range can also be a single count, or \"*\" for any count.  For example, \"20-40,0\" selects K-mers seen 20 to 40 times in input 1 but absent from input 2.  The stored count is from input 1, or from input 2 for K-mers absent from input 1.  Can be given multiple times.  Not available in N-way mode.")
             ("verbose,v", po::bool_switch(&verbose)->default_value(false), 
                 "Print extra information.")
             ("help", po::bool_switch(&help)->default_value(false), "Produce help message.")
@@ -743,16 +1408,12 @@ int kat::Comp::main(int argc, char *argv[]) {
     // in config file, but will not be shown to the user.
     po::options_description hidden_options("Hidden options");
     hidden_options.add_options()
-            ("input_1,i1", po::value<string>(&input1), "Path to the first input file.  Can be either FastA, FastQ or a jellyfish hash (non bloom filtered)")
-            ("input_2,i2", po::value<string>(&input2), "Path to the second input file.  Can be either FastA, FastQ or a jellyfish hash (non bloom filtered)")
-            ("input_3,i3", po::value<string>(&input3), "Path to the third input file.  Can be either FastA, FastQ or a jellyfish hash (non bloom filtered)")
+            ("inputs", po::value<vector<string>>(&inputs), "Paths to the input files.  Each can be either FastA, FastQ or a jellyfish hash (non bloom filtered)")
             ;
 
     // Positional option for the input bam file
     po::positional_options_description p;
-    p.add("input_1", 1);
-    p.add("input_2", 1);
-    p.add("input_3", 1);
+    p.add("inputs", 100);
 
 
     // Combine non-positional options
@@ -782,17 +1443,19 @@ int kat::Comp::main(int argc, char *argv[]) {
     cout << "Running KAT in COMP mode" << endl
          << "------------------------" << endl << endl;
 
+    if (inputs.size() < 2 || (!nway && !one_vs_many && inputs.size() > 3)) {
+        BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "Expected two or three inputs (or two or more in N-way or one vs many mode).  Number of inputs provided: ") + lexical_cast<string>(inputs.size())));
+    }
+    
     // Glob input files
-    vector<path> vecinput1 = InputHandler::globFiles(input1);
-    vector<path> vecinput2 = InputHandler::globFiles(input2);
-
-    vector<path> vecinput3;
-    if ( input3 != "" ){
-        vecinput3 = InputHandler::globFiles(input3);
+    vector<vector<path>> vecinputs;
+    for(auto& i : inputs) {
+        vecinputs.push_back(InputHandler::globFiles(i));
     }
     
     // Create the sequence coverage object
-    Comp comp(vecinput1, vecinput2, vecinput3);
+    Comp comp(vecinputs);
     comp.setOutputPrefix(output_prefix);
     comp.setD1Scale(d1_scale);
     comp.setD2Scale(d2_scale);
@@ -801,12 +1464,20 @@ int kat::Comp::main(int argc, char *argv[]) {
     comp.setIOThreads(io_threads);
     comp.setAnalysisThreads(analysis_threads);
     comp.setMerLen(mer_len);
+    comp.setNWay(nway);
+    comp.setOneVsMany(one_vs_many);
+    comp.setSampleFraction(sample_fraction);
+    comp.setPrefilter(!disable_prefilter);
+    for(auto& r : export_regions) {
+        comp.addExportRegion(CountRegion(r));
+    }
     comp.setCanonical(0, canonical_1);
-    comp.setCanonical(1, canonical_2);
-    comp.setCanonical(2, canonical_3);
     comp.setHashSize(0, hash_size_1);
-    comp.setHashSize(1, hash_size_2);
-    comp.setHashSize(2, hash_size_3);
+    for(uint16_t i = 1; i < comp.getNbInputs(); i++) {
+        const bool third = i == 2 && !nway && !one_vs_many;
+        comp.setCanonical(i, third ? canonical_3 : canonical_2);
+        comp.setHashSize(i, third ? hash_size_3 : hash_size_2);
+    }
     comp.setDumpHashes(dump_hashes);
     comp.setDisableHashGrow(disable_hash_grow);
     comp.setDensityPlot(density_plot);
@@ -815,14 +1486,14 @@ int kat::Comp::main(int argc, char *argv[]) {
     // Do the work
     comp.execute();
 
-    // Save results to disk
-    comp.save();
+    // Save results to disk (one vs many mode saves each comparison as it goes)
+    if (!one_vs_many) comp.save();
     
     // Plot results
     comp.plot();
     
     // Send K-mer statistics to stdout as well
-    comp.printCounters(cout);
+    if (!one_vs_many) comp.printCounters(cout);
     
     return 0;
 }
@@ -22,6 +22,9 @@
 #include <vector>
 #include <memory>
 #include <mutex>
+#include <exception>
+#include <fstream>
+#include <limits>
 using std::vector;
 using std::string;
 using std::shared_ptr;
@@ -38,6 +41,8 @@ using bfs::path;
 #include "inc/matrix/matrix_metadata_extractor.hpp"
 #include "inc/matrix/sparse_matrix.hpp"
 #include "inc/matrix/threaded_sparse_matrix.hpp"
+#include "inc/thread_slots.hpp"
+using kat::ThreadSlots;
 
 #include "jellyfish_helper.hpp"
 #include "input_handler.hpp"
@@ -64,6 +69,8 @@ namespace kat {
         uint64_t shared_hash1_total;
         uint64_t shared_hash2_total;
         uint64_t shared_distinct;
+        
+        double sample_fraction;
 
         path hash1_path;
         path hash2_path;
@@ -82,8 +89,104 @@ namespace kat {
         void updateHash3Counters(uint64_t hash3_count);
 
         void updateSharedCounters(uint64_t hash1_count, uint64_t hash2_count);
+        
+        /**
+         * Adds the counts from another set of counters to this one
+         */
+        void merge(const CompCounters& o);
+        
+        void scale(double fraction);
 
         void printCounts(ostream &out);
+        
+    private:
+        
+        string stdErr(uint64_t estimate) const;
+    };
+    
+    /**
+     * A rectangular region of count space over (hash1_count, hash2_count, hash3_count).
+     * Bounds are inclusive.  Created from a string of the form "lo-hi,lo-hi[,lo-hi]"
+     * where each range may also be a single count "n", or "*" to match any count.
+     */
+    class CountRegion {
+    public:
+        uint64_t low[3];
+        uint64_t high[3];
+        
+        CountRegion();
+        
+        CountRegion(const string& region);
+        
+        bool contains(uint64_t hash1_count, uint64_t hash2_count, uint64_t hash3_count) const {
+            return  hash1_count >= low[0] && hash1_count <= high[0] &&
+                    hash2_count >= low[1] && hash2_count <= high[1] &&
+                    hash3_count >= low[2] && hash3_count <= high[2];
+        }
+        
+        /**
+         * Whether or not this region constrains the hash 3 count
+         */
+        bool usesHash3() const {
+            return low[2] != 0 || high[2] != std::numeric_limits<uint64_t>::max();
+        }
+        
+        string toString() const;
+    };
+    
+    /**
+     * Writes K-mers falling into a count region to a jellyfish binary format file.  Threads
+     * accumulate records in their own buffers and hand them over in large blocks, so 
+     * contention on the output stream is minimal.
+     */
+    class RegionExporter {
+    private:
+        CountRegion region;
+        path outputPath;
+        std::ofstream out;
+        std::mutex mu;
+        uint64_t nbRecords;
+        size_t keyBytes;
+        
+    public:
+        
+        static const size_t BUFFER_SIZE = 1 << 20;
+        
+        RegionExporter(const CountRegion& _region, const path& _outputPath, file_header& header);
+        
+        const CountRegion& getRegion() const {
+            return region;
+        }
+        
+        const path& getOutputPath() const {
+            return outputPath;
+        }
+        
+        uint64_t getNbRecords() const {
+            return nbRecords;
+        }
+        
+        /**
+         * Appends a record to a thread local buffer, flushing it if full
+         */
+        void add(string& buffer, const mer_dna& kmer, uint64_t count) {
+            buffer.append((const char*)kmer.data(), keyBytes);
+            uint32_t c = count > std::numeric_limits<uint32_t>::max() ? 
+                std::numeric_limits<uint32_t>::max() : 
+                (uint32_t)count;
+            buffer.append((const char*)&c, sizeof(uint32_t));
+            
+            if (buffer.size() >= BUFFER_SIZE) flush(buffer);
+        }
+        
+        /**
+         * Writes a thread local buffer to disk and clears it
+         */
+        void flush(string& buffer);
+        
+        void close() {
+            out.close();
+        }
     };
     
     class ThreadedCompCounters {
@@ -91,7 +194,7 @@ namespace kat {
         uint16_t threads;
 
         CompCounters final_matrix;
-        vector<CompCounters> threaded_counters;
+        ThreadSlots<CompCounters> threaded_counters;
         
     public:
         
@@ -100,10 +203,20 @@ namespace kat {
         ThreadedCompCounters(const path& _hash1_path, const path& _hash2_path) :
            ThreadedCompCounters(_hash1_path, _hash2_path, path()) {}
            
-        ThreadedCompCounters(const path& _hash1_path, const path& _hash2_path, const path& _hash3_path);                
+        ThreadedCompCounters(const path& _hash1_path, const path& _hash2_path, const path& _hash3_path) :
+           ThreadedCompCounters(_hash1_path, _hash2_path, _hash3_path, 0) {}
+        
+        /**
+         * Creates counters with a slot for each of the given number of threads, which
+         * threads can update through getThreadedMatrixAt without locking
+         */
+        ThreadedCompCounters(const path& _hash1_path, const path& _hash2_path, const path& _hash3_path, uint16_t _threads);
         
         void printCounts(ostream &out);
         
+        /**
+         * Adds counters for another thread.  Not safe to call while threads are running.
+         */
         void add(shared_ptr<CompCounters> cc);
         
         size_t size() {
@@ -137,6 +250,10 @@ namespace kat {
         uint16_t analysisThreads;
         uint16_t merLen;
         bool densityPlot;
+        bool nway;
+        bool oneVsMany;
+        double sampleFraction;
+        bool prefilter;
         bool verbose;
 
         // Threaded matrix data
@@ -145,12 +262,28 @@ namespace kat {
         ThreadedSparseMatrix middle_matrix;
         ThreadedSparseMatrix mixed_matrix;
 
+        // N-way matrix data.  One matrix for input 1 vs each other input, plus
+        // a spectra matrix with one row per input.
+        vector<ThreadedSparseMatrix> nway_matrices;
+        ThreadedSparseMatrix spectra_matrix;
+
         // Final data (created by merging thread results)
         ThreadedCompCounters comp_counters;
+        vector<ThreadedCompCounters> nway_counters;
         
-        std::mutex mu;
+        // K-mer export for regions of the comparison matrix
+        vector<CountRegion> exportRegions;
+        vector<shared_ptr<RegionExporter>> exporters;
+        
+        // One vs many mode.  The inputs compared against input 1, which are swapped
+        // into input 2 one at a time.
+        vector<InputHandler> targets;
+        path basePrefix;
+        std::exception_ptr targetError;     // Set if preparing a target in the background failed
         
         void init(const vector<path>& _input1, const vector<path>& _input2, const vector<path>& _input3);
+        
+        void init(const vector<vector<path>>& _inputs);
 
 
     public:
@@ -165,11 +298,51 @@ namespace kat {
         
         Comp(const vector<path>& _input1, const vector<path>& _input2, const vector<path>& _input3);
 
+        Comp(const vector<vector<path>>& _inputs);
         
         virtual ~Comp() {}
         
         bool doThirdHash() {
-            return input.size() == 3;
+            return !nway && !oneVsMany && input.size() == 3;
+        }
+        
+        bool isNWay() const {
+            return nway;
+        }
+
+        void setNWay(bool nway) {
+            this->nway = nway;
+        }
+        
+        bool isOneVsMany() const {
+            return oneVsMany;
+        }
+
+        void setOneVsMany(bool oneVsMany) {
+            this->oneVsMany = oneVsMany;
+        }
+        
+        uint16_t getNbInputs() const {
+            return input.size();
+        }
+        
+        const vector<CountRegion>& getExportRegions() const {
+            return exportRegions;
+        }
+        
+        void addExportRegion(const CountRegion& region) {
+            exportRegions.push_back(region);
+        }
+        
+        /**
+         * Number of K-mers exported for the given region.  Only valid after execute.
+         */
+        uint64_t getNbExported(uint16_t index) const {
+            return exporters[index]->getNbRecords();
+        }
+        
+        path getExportPath(uint16_t index) const {
+            return path(outputPrefix.string() + "-region" + lexical_cast<string>(index + 1) + ".jf" + lexical_cast<string>(merLen));
         }
         
         bool isCanonical(uint16_t index) const {
@@ -288,6 +461,26 @@ namespace kat {
             this->verbose = verbose;
         }
         
+        double getSampleFraction() const {
+            return sampleFraction;
+        }
+
+        void setSampleFraction(double sampleFraction) {
+            this->sampleFraction = sampleFraction;
+        }
+        
+        bool isPrefilter() const {
+            return prefilter;
+        }
+
+        void setPrefilter(bool prefilter) {
+            this->prefilter = prefilter;
+        }
+        
+        bool isSampling() const {
+            return sampleFraction < 1.0;
+        }
+        
         bool isDensityPlot() const {
             return densityPlot;
         }
@@ -305,6 +498,10 @@ namespace kat {
         
         // Threaded matrix data
 
+        CompCounters& getCompCounters() {
+            return comp_counters.getFinalMatrix();
+        }
+        
         const SM64& getMainMatrix() const {
             return main_matrix.getFinalMatrix();
         }
@@ -320,6 +517,20 @@ namespace kat {
         const SM64& getMixedMatrix() const {
             return mixed_matrix.getFinalMatrix();
         }
+        
+        // N-way matrix data.  Index is the (zero based) position of the input compared against input 1.
+        
+        const SM64& getNWayMatrix(uint16_t index) const {
+            return nway_matrices[index - 1].getFinalMatrix();
+        }
+        
+        const SM64& getSpectraMatrix() const {
+            return spectra_matrix.getFinalMatrix();
+        }
+        
+        CompCounters& getNWayCounters(uint16_t index1, uint16_t index2) {
+            return nway_counters[pairIndex(index1, index2)].getFinalMatrix();
+        }
 
         
         // Print K-mer comparison matrix
@@ -337,6 +548,14 @@ namespace kat {
         // Print K-mer comparison matrix
 
         void printMixedMatrix(ostream &out);
+        
+        // Print K-mer comparison matrix for input 1 vs the input at the given (zero based) index
+        
+        void printNWayMatrix(ostream &out, uint16_t index);
+        
+        // Print K-mer spectra for each input
+        
+        void printSpectraMatrix(ostream &out);
 
         // Print K-mer statistics
 
@@ -346,19 +565,62 @@ namespace kat {
         
         path getMxOutPath() { return path(string(outputPrefix.string() + "-main.mx")); }
         
+        path getNWayMxOutPath(uint16_t index) { 
+            return path(outputPrefix.string() + "-1v" + lexical_cast<string>(index + 1) + "-main.mx"); 
+        }
+        
+        /**
+         * Output prefix for the comparison of input 1 against the given input in one vs many mode
+         */
+        path getOneVsManyPrefix(uint16_t index) const {
+            return path(basePrefix.string() + "-1v" + lexical_cast<string>(index + 1));
+        }
+        
         void plot();
 
 
     private:
 
+        void validate();
+        
+        void initMatrices();
+        
+        void executeOneVsMany();
+        
+        void prepareTarget(uint16_t index, uint16_t threads, bool verbose);
+        
+        void compareTarget(uint16_t index);
+        
         void loadHashes();
         
         void compare();
         
         void compareSlice(int th_id);
+        
+        void compareNWaySlice(int th_id);
+        
+        void createExporters();
+        
+        void closeExporters();
+        
+        /**
+         * Threshold for sampling K-mers from the given input.  Hashes loaded from disk
+         * have already been subsampled so no further filtering is required for those.
+         */
+        uint64_t sampleThreshold(uint16_t index) const {
+            return JellyfishHelper::sampleThreshold(
+                input[index].mode == InputHandler::InputMode::LOAD ? 1.0 : sampleFraction);
+        }
 
         void merge();
         
+        bool plotMatrix(const path& mxPath, const InputHandler& other);
+        
+        // Index of the counters for the pair of inputs i and j (i < j) in nway_counters
+        size_t pairIndex(uint16_t i, uint16_t j) const {
+            return (size_t)i * input.size() - ((size_t)i * (i + 1)) / 2 + (j - i - 1);
+        }
+        
         
         
         // Scale counters to make the matrix look pretty
@@ -369,7 +631,9 @@ namespace kat {
         
         static string helpMessage() {            
         
-            return string(  "Usage: kat comp [options] <input_1> <input_2> [<input_3>]\n\n") +
+            return string(  "Usage: kat comp [options] <input_1> <input_2> [<input_3>]\n" \
+                            "       kat comp --nway [options] <input_1> <input_2> (<input_n>)*\n" \
+                            "       kat comp --one_vs_many [options] <input_1> <input_2> (<input_n>)*\n\n") +
                             "Compares jellyfish K-mer count hashes.\n\n" \
                             "The most common use case for this tool is to compare two (or three) K-mer hashes.  The typical use case for " \
                             "this tool is to compare K-mers from two K-mer hashes both representing K-mer counts for reads.  However, " \
@@ -377,7 +641,17 @@ namespace kat {
                             "If comparing K-mers from reads to K-mers from an assembly, the larger (most likely the read) K-mer hash " \
                             "should be provided first, then the assembly K-mer hash second.\n" \
                             "The third optional jellyfish hash acts as a filter, restricting the analysis to the K-mers present on that " \
-                            "set.  The manual contains more details on specific use cases.\n\n" \
+                            "set.  The manual contains more details on specific use cases.\n" \
+                            "In N-way mode any number of inputs can be given.  The union of all K-mers is visited once, producing " \
+                            "a spectra for each input, shared / unique statistics for every pair of inputs, and a comparison matrix " \
+                            "of input 1 against each other input.\n" \
+                            "For a quick preview, a sample fraction can be given.  Only K-mers whose hash value falls below the " \
+                            "corresponding threshold are compared, so the same subset is taken from every input, and hashes loaded " \
+                            "from disk only hold the sampled K-mers.  Matrices and statistics are scaled up to estimates for the " \
+                            "full dataset.\n" \
+                            "In one vs many mode, input 1 is compared against each other input in turn, and stays in memory " \
+                            "throughout.  Each remaining input is counted or loaded in the background while the previous comparison " \
+                            "runs.  Results for each pair are written using the prefix <output_prefix>-1v<N>.\n\n" \
                             "Options";
 
         }
@@ -0,0 +1,177 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <stdint.h>
+#include <iostream>
+#include <fstream>
+#include <limits>
+#include <vector>
+using std::cout;
+using std::endl;
+using std::ofstream;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/program_options.hpp>
+#include <boost/timer/timer.hpp>
+namespace po = boost::program_options;
+namespace bfs = boost::filesystem;
+using bfs::path;
+using boost::timer::auto_cpu_timer;
+
+#include "inc/coverage_file.hpp"
+using kat::CoverageReader;
+
+#include "cvg.hpp"
+
+kat::Cvg::Cvg(const path& _input) {
+    input = _input;
+    output = path(input).replace_extension(".cvg");
+    start = 0;
+    end = std::numeric_limits<uint64_t>::max();
+    nbWritten = 0;
+}
+
+void kat::Cvg::execute() {
+
+    if (!bfs::exists(input) && !bfs::symbolic_link_exists(input)) {
+        BOOST_THROW_EXCEPTION(CvgException() << CvgErrorInfo(string(
+                "Could not find binary coverage file at: " + input.string() + "; please check the path and try again.")));
+    }
+
+    CoverageReader reader(input);
+
+    ofstream out(output.c_str());
+
+    if (!out.is_open()) {
+        BOOST_THROW_EXCEPTION(CvgException() << CvgErrorInfo(string(
+                "Could not open output file for writing: ") + output.string()));
+    }
+
+    vector<uint64_t> counts;
+    nbWritten = 0;
+
+    if (!header.empty()) {
+
+        const size_t i = reader.find(header);
+
+        if (i == reader.size()) {
+            BOOST_THROW_EXCEPTION(CvgException() << CvgErrorInfo(string(
+                    "Could not find sequence ") + header + " in " + input.string()));
+        }
+
+        reader.read(i, start, end, counts);
+        printCounts(out, header, counts);
+        nbWritten++;
+    }
+    else {
+        for(size_t i = 0; i < reader.size(); i++) {
+            reader.read(i, counts);
+            printCounts(out, reader.getEntry(i).name, counts);
+            nbWritten++;
+        }
+    }
+
+    out.close();
+}
+
+void kat::Cvg::printCounts(std::ostream& out, const string& name, const vector<uint64_t>& counts) {
+
+    // Use the same layout as sect's text output
+    out << ">" << name << endl;
+
+    if (!counts.empty()) {
+        out << counts[0];
+
+        for (size_t j = 1; j < counts.size(); j++) {
+            out << " " << counts[j];
+        }
+
+        out << endl;
+    } else {
+        out << "0" << endl;
+    }
+}
+
+int kat::Cvg::main(int argc, char *argv[]) {
+
+    path            input;
+    path            output;
+    string          header;
+    uint64_t        start;
+    uint64_t        end;
+    bool            help;
+
+    // Declare the supported options.
+    po::options_description generic_options(Cvg::helpMessage(), 100);
+    generic_options.add_options()
+            ("output,o", po::value<path>(&output),
+                "Path to the text file to create.  Defaults to the input path with a \".cvg\" extension.")
+            ("header,d", po::value<string>(&header),
+                "Only convert the sequence with this fasta header.")
+            ("start,s", po::value<uint64_t>(&start)->default_value(0),
+                "First K-mer position to output, counting from 0.  Only used with \'--header\'.")
+            ("end,e", po::value<uint64_t>(&end)->default_value(std::numeric_limits<uint64_t>::max()),
+                "K-mer position to stop at (exclusive).  Only used with \'--header\'.  Defaults to the end of the sequence.")
+            ("help", po::bool_switch(&help)->default_value(false), "Produce help message.")
+            ;
+
+    // Hidden options, will be allowed both on command line and
+    // in config file, but will not be shown to the user.
+    po::options_description hidden_options("Hidden options");
+    hidden_options.add_options()
+            ("input,i", po::value<path>(&input), "Path to the binary coverage file to convert.")
+            ;
+
+    // Positional option for the input file
+    po::positional_options_description p;
+    p.add("input", 1);
+
+    // Combine non-positional options
+    po::options_description cmdline_options;
+    cmdline_options.add(generic_options).add(hidden_options);
+
+    // Parse command line
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(cmdline_options).positional(p).run(), vm);
+    po::notify(vm);
+
+    // Output help information the exit if requested
+    if (help || argc <= 1) {
+        cout << generic_options << endl;
+        return 1;
+    }
+
+    auto_cpu_timer timer(1, "KAT CVG completed.\nTotal runtime: %ws\n\n");
+
+    cout << "Running KAT in CVG mode" << endl
+         << "-----------------------" << endl << endl;
+
+    Cvg cvg(input);
+    if (!output.empty()) cvg.setOutput(output);
+    cvg.setHeader(header);
+    cvg.setStart(start);
+    cvg.setEnd(end);
+
+    cvg.execute();
+
+    cout << "Converted " << cvg.getNbWritten() << " sequences to " << cvg.getOutput().string() << endl << endl;
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <iostream>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+namespace bfs = boost::filesystem;
+using bfs::path;
+
+#include "inc/coverage_file.hpp"
+
+typedef boost::error_info<struct CvgError,string> CvgErrorInfo;
+struct CvgException: virtual boost::exception, virtual std::exception { };
+
+namespace kat {
+
+    /**
+     * Converts binary K-mer coverage files produced by sect back into the text format
+     */
+    class Cvg {
+    private:
+
+        // Input args
+        path            input;
+        path            output;
+        string          header;
+        uint64_t        start;
+        uint64_t        end;
+
+        uint64_t        nbWritten;
+
+    public:
+
+        Cvg(const path& _input);
+
+        virtual ~Cvg() {
+        }
+
+        path getOutput() const {
+            return output;
+        }
+
+        void setOutput(path output) {
+            this->output = output;
+        }
+
+        string getHeader() const {
+            return header;
+        }
+
+        void setHeader(string header) {
+            this->header = header;
+        }
+
+        uint64_t getStart() const {
+            return start;
+        }
+
+        void setStart(uint64_t start) {
+            this->start = start;
+        }
+
+        uint64_t getEnd() const {
+            return end;
+        }
+
+        void setEnd(uint64_t end) {
+            this->end = end;
+        }
+
+        uint64_t getNbWritten() const {
+            return nbWritten;
+        }
+
+        void execute();
+
+    private:
+
+        static void printCounts(std::ostream& out, const string& name, const vector<uint64_t>& counts);
+
+        static string helpMessage() {
+
+            return string(  "Usage: kat cvg [options] <cvgb_file>\n\n") +
+                            "Converts a binary K-mer coverage file produced by \"kat sect --binary_counts\" into the " \
+                            "text format that sect produces by default.\n\n" \
+                            "By default all sequences are converted.  A single sequence, or a range of K-mer positions " \
+                            "within it, can be extracted by name without reading the rest of the file.\n\n" \
+                            "Options";
+        }
+
+    public:
+
+        static int main(int argc, char *argv[]);
+    };
+}
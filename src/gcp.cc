@@ -81,28 +81,38 @@ void kat::Gcp::execute() {
     // Setup output stream for jellyfish initialisation
     std::ostream* out_stream = verbose ? &cerr : (std::ostream*)0;
 
-    // Either count or load input
-    if (input.mode == InputHandler::InputHandler::InputMode::COUNT) {
-        input.count(merLen, threads);
+    // K-mers may have been counted already, alongside other K-mer lengths
+    if (counted) {
+        gcp_mx = make_shared<ThreadedSparseMatrix>(merLen, cvgBins + 1, threads);
+        analyseSpectrum(*counted);
     }
     else {
-        input.loadHeader();
-        input.loadHash(true);                
-    }
-    
-    // Create matrix of appropriate size (adds 1 to cvg bins to account for 0)
-    gcp_mx = make_shared<ThreadedSparseMatrix>(input.header->key_len() / 2, cvgBins + 1, threads);
-
-    // Process batch with worker threads
-    // Process each sequence is processed in a different thread.
-    // In each thread lookup each K-mer in the hash
-    analyse();
-
-    // Dump any hashes that were previously counted to disk if requested
-    // NOTE: MUST BE DONE AFTER COMPARISON AS THIS CLEARS ENTRIES FROM HASH ARRAY!
-    if (input.dumpHash) {
-        path outputPath(outputPrefix.string() + "-hash.jf" + lexical_cast<string>(merLen));
-        input.dump(outputPath, threads, true);     
+        
+        // Either count or load input
+        if (input.mode == InputHandler::InputHandler::InputMode::COUNT) {
+            input.count(merLen, threads);
+        }
+        else {
+            // Only the keys and counts are needed, so stream records from the file
+            // rather than building a hash from it
+            input.loadHeader();
+            input.openDump();
+        }
+
+        // Create matrix of appropriate size (adds 1 to cvg bins to account for 0)
+        gcp_mx = make_shared<ThreadedSparseMatrix>(input.header->key_len() / 2, cvgBins + 1, threads);
+
+        // Process batch with worker threads
+        // Process each sequence is processed in a different thread.
+        // In each thread lookup each K-mer in the hash
+        analyse();
+
+        // Dump any hashes that were previously counted to disk if requested
+        // NOTE: MUST BE DONE AFTER COMPARISON AS THIS CLEARS ENTRIES FROM HASH ARRAY!
+        if (input.dumpHash) {
+            path outputPath(outputPrefix.string() + "-hash.jf" + lexical_cast<string>(merLen));
+            input.dump(outputPath, threads, true);     
+        }
     }
     
     // Merge results
@@ -141,7 +151,8 @@ void kat::Gcp::merge() {
 void kat::Gcp::printMainMatrix(ostream &out) {
     SM64 mx = gcp_mx->getFinalMatrix();
 
-    out << mme::KEY_TITLE << "K-mer coverage vs GC count plot for: " << input.pathString() << endl;
+    const bool estimated = counted && counted->isEstimated();
+    out << mme::KEY_TITLE << (estimated ? "Estimated K-mer coverage vs GC count plot for: " : "K-mer coverage vs GC count plot for: ") << input.pathString() << endl;
     out << mme::KEY_X_LABEL << "K-mer multiplicity" << endl;
     out << mme::KEY_Y_LABEL << "GC count" << endl;
     out << mme::KEY_Z_LABEL << "Distinct K-mers per bin" << endl;
@@ -177,28 +188,41 @@ void kat::Gcp::analyse() {
 
 void kat::Gcp::analyseSlice(int th_id) {
    
-    LargeHashArray::region_iterator it = input.hash->region_slice(th_id, threads);
-    while (it.next()) {
-        string kmer = it.key().to_str();
-        uint64_t kmer_count = it.val();
-
-        uint16_t g_or_c = 0;
+    if (input.hashDump) {
+        HashDump::slice_iterator it = input.hashDump->slice(th_id, threads);
+        analyseRecords(it, th_id);
+    }
+    else {
+        LargeHashArray::region_iterator it = input.hash->region_slice(th_id, threads);
+        analyseRecords(it, th_id);
+    }
+}
 
-        for (uint16_t i = 0; i < kmer.length(); i++) {
-            char c = kmer[i];
+void kat::Gcp::analyseSpectrum(const SpectrumTable& table) {
+    
+    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
 
-            if (c == 'G' || c == 'g' || c == 'C' || c == 'c')
-                g_or_c++;
+    cout << "Analysing counted kmers ...";
+    cout.flush();
+    
+    // Estimates stand for a fractional number of K-mers, so sum them before rounding
+    vector<vector<double>> est(merLen + 1, vector<double>(cvgBins + 1, 0.0));
+    table.forEach([&](uint64_t kmer_count, uint16_t g_or_c, double distinct) {
+        uint64_t cvg_pos = ceil((double) kmer_count * cvgScale);
+        est[g_or_c][cvg_pos > cvgBins ? cvgBins : cvg_pos] += distinct;
+    });
+    
+    for(uint16_t i = 0; i < est.size(); i++) {
+        for(uint16_t j = 0; j < est[i].size(); j++) {
+            const uint64_t n = llround(est[i][j]);
+            if (n > 0) {
+                gcp_mx->incTM(0, i, j, n);
+            }
         }
-
-        // Apply scaling factor
-        uint64_t cvg_pos = kmer_count == 0 ? 0 : ceil((double) kmer_count * cvgScale);
-
-        if (cvg_pos > cvgBins)
-            gcp_mx->incTM(th_id, g_or_c, cvgBins, 1);
-        else
-            gcp_mx->incTM(th_id, g_or_c, cvg_pos, 1);
     }
+    
+    cout << "done.";
+    cout.flush();
 }
 
 void kat::Gcp::plot() {
@@ -234,7 +258,7 @@ int kat::Gcp::main(int argc, char *argv[]) {
     double          cvg_scale;
     uint16_t        cvg_bins;
     bool            canonical;
-    uint16_t        mer_len;
+    string          mer_len;
     uint64_t        hash_size;
     bool            dump_hash;
     bool            verbose;
@@ -253,8 +277,10 @@ int kat::Gcp::main(int argc, char *argv[]) {
                 "Number of bins for the cvg data when creating the contamination matrix.")
             ("canonical,C", po::bool_switch(&canonical)->default_value(false),
                 "IMPORTANT: Whether the jellyfish hashes contains K-mers produced for both strands.  If this is not set to the same value as was produced during jellyfish counting then output will be unpredictable.")
-            ("mer_len,m", po::value<uint16_t>(&mer_len)->default_value(DEFAULT_MER_LEN),
-                "The kmer length to use in the kmer hashes.  Larger values will provide more discriminating power between kmers but at the expense of additional memory and lower coverage.")
+            ("mer_len,m", po::value<string>(&mer_len)->default_value(lexical_cast<string>(DEFAULT_MER_LEN)),
+                "The kmer length to use in the kmer hashes.  Larger values will provide more discriminating power between kmers but at the expense of additional memory and lower coverage.  " \
+                "For sequence file input, a comma separated list of up to 8 lengths produces a matrix for each from a single pass over the input.  " \
+                "Each length is counted into its own hash, starting at --hash_size, with the threads split evenly between them.  Every length needs at least one thread, so with fewer threads than lengths one thread is used per length.  Hashes cannot be dumped in this mode.")
             ("hash_size,H", po::value<uint64_t>(&hash_size)->default_value(DEFAULT_HASH_SIZE),
                 "If kmer counting is required for the input, then use this value as the hash size.  If this hash size is not large enough for your dataset then the default behaviour is to double the size of the hash and recount, which will increase runtime and memory usage.")
             ("dump_hash,d", po::bool_switch(&dump_hash)->default_value(false), 
@@ -297,26 +323,52 @@ int kat::Gcp::main(int argc, char *argv[]) {
     cout << "Running KAT in GCP mode" << endl
          << "------------------------" << endl << endl;
 
-    // Create the sequence coverage object
-    Gcp gcp(inputs);
-    gcp.setThreads(threads);
-    gcp.setCanonical(canonical);
-    gcp.setCvgBins(cvg_bins);
-    gcp.setCvgScale(cvg_scale);
-    gcp.setHashSize(hash_size);
-    gcp.setMerLen(mer_len);
-    gcp.setOutputPrefix(output_prefix);
-    gcp.setDumpHash(dump_hash);
-    gcp.setVerbose(verbose);
-
-    // Do the work (outputs data to files as it goes)
-    gcp.execute();
-
-    // Save results
-    gcp.save();
+    vector<uint16_t> mer_lens = JellyfishHelper::parseMerLens(mer_len);
+    
+    // With several K-mer lengths, read the input once counting K-mers of every length
+    vector<shared_ptr<SpectrumTable>> counted;
+    if (mer_lens.size() > 1) {
+        
+        if (dump_hash) {
+            BOOST_THROW_EXCEPTION(GcpException() << GcpErrorInfo(string(
+                    "Hashes cannot be dumped when using several K-mer lengths, as the hash for each length is discarded once its matrix is built.")));
+        }
+        
+        counted = JellyfishHelper::countSeqFiles(inputs, mer_lens, canonical, hash_size, threads);
+    }
+    
+    vector<shared_ptr<Gcp>> gcps;
+    for(size_t i = 0; i < mer_lens.size(); i++) {
+        
+        // Create the sequence coverage object
+        shared_ptr<Gcp> gcp = make_shared<Gcp>(inputs);
+        gcp->setThreads(threads);
+        gcp->setCanonical(canonical);
+        gcp->setCvgBins(cvg_bins);
+        gcp->setCvgScale(cvg_scale);
+        gcp->setHashSize(hash_size);
+        gcp->setMerLen(mer_lens[i]);
+        gcp->setOutputPrefix(counted.empty() ? output_prefix : 
+                path(output_prefix.string() + "-k" + lexical_cast<string>(mer_lens[i])));
+        gcp->setDumpHash(dump_hash);
+        gcp->setVerbose(verbose);
+        if (!counted.empty()) {
+            gcp->setCounted(counted[i]);
+        }
+
+        // Do the work (outputs data to files as it goes)
+        gcp->execute();
+
+        // Save results
+        gcp->save();
+        
+        gcps.push_back(gcp);
+    }
     
-    // Plot results
-    gcp.plot();
+    // Plot results, once every matrix is safely on disk
+    for(auto& gcp : gcps) {
+        gcp->plot();
+    }
     
     return 0;
 }
@@ -46,6 +46,8 @@ using kat::InputHandler;
 
 #include "inc/matrix/matrix_metadata_extractor.hpp"
 #include "inc/matrix/threaded_sparse_matrix.hpp"
+#include "inc/spectrum_table.hpp"
+using kat::SpectrumTable;
 
 using std::ostream;
 
@@ -67,6 +69,9 @@ namespace kat {
         uint16_t        merLen;
         bool            verbose;
         
+        // K-mers already counted from the input, tagged with GC count, if any
+        shared_ptr<SpectrumTable> counted;
+        
         // Stores results
         shared_ptr<ThreadedSparseMatrix> gcp_mx; // Stores cumulative base count for each sequence where GC and CVG are binned
 
@@ -141,6 +146,19 @@ namespace kat {
             this->input.dumpHash = dumpHash;
         }
 
+        shared_ptr<SpectrumTable> getCounted() const {
+            return counted;
+        }
+
+        /**
+         * Use K-mers already counted from the input sequence files, for example 
+         * alongside those of other lengths, instead of reading the input again.  The 
+         * table must tag each K-mer with its GC count.
+         */
+        void setCounted(shared_ptr<SpectrumTable> counted) {
+            this->counted = counted;
+        }
+
         bool isVerbose() const {
             return verbose;
         }
@@ -167,6 +185,30 @@ namespace kat {
         
         void analyseSlice(int th_id);
         
+        void analyseSpectrum(const SpectrumTable& table);
+        
+        /**
+         * Bins every record visited by the iterator by GC count and coverage.  The 
+         * iterator may walk either a hash array or a hash file on disk.
+         */
+        template<typename Iterator>
+        void analyseRecords(Iterator& it, int th_id) {
+            while (it.next()) {
+                uint64_t kmer_count = it.val();
+
+                // Count G and C straight from the packed key
+                uint16_t g_or_c = JellyfishHelper::gcCount(it.key());
+
+                // Apply scaling factor
+                uint64_t cvg_pos = kmer_count == 0 ? 0 : ceil((double) kmer_count * cvgScale);
+
+                if (cvg_pos > cvgBins)
+                    gcp_mx->incTM(th_id, g_or_c, cvgBins, 1);
+                else
+                    gcp_mx->incTM(th_id, g_or_c, cvg_pos, 1);
+            }
+        }
+        
         void merge();
         
         static const string helpMessage() {
@@ -176,7 +218,10 @@ namespace kat {
                             "and then counts the GC nucleotides for each distinct K-mer " \
                             "in the hash.  For each GC count and K-mer coverage level, the number of distinct K-mers are counted and " \
                             "stored in a matrix.  This matrix can be used to analyse biological content within the hash.  For example, " \
-                            "it can be used to distinguish legitimate content from contamination, or unexpected content.\n\n" \
+                            "it can be used to distinguish legitimate content from contamination, or unexpected content.\n" \
+                            "Several K-mer lengths can be given as a comma separated list, such as \"-m 21,27,31\", for sequence file input.  " \
+                            "The input is then read only once and a matrix is produced for each length, with \"-k<length>\" appended to " \
+                            "the output prefix.\n\n" \
                             "Options";
         }
         
@@ -21,6 +21,7 @@
 #include <string.h>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
 #include <vector>
 #include <memory>
 #include <thread>
@@ -58,6 +59,9 @@ kat::Histogram::Histogram(vector<path> _inputs, uint64_t _low, uint64_t _high, u
     high = _high;
     inc = _inc;
     merLen = DEFAULT_MER_LEN;
+    approximate = false;
+    sketchSize = DEFAULT_SKETCH_SIZE;
+    sketched = false;
     threads = 1;
     
     // Calculate other vars required for this run
@@ -88,34 +92,52 @@ void kat::Histogram::execute() {
         }
     }
     
-    // Either count or load input
-    if (input.mode == InputHandler::InputHandler::InputMode::COUNT) {
-        input.count(merLen, threads);
-    }
-    else {
-        input.loadHeader();
-        input.loadHash(true);                
-    }
-    
     data = vector<uint64_t>(nb_buckets, 0);
-    threadedData = vector<shared_ptr<vector<uint64_t>>>();
-    
+    sketched = false;
     
-    std::ostream* out_stream = verbose ? &cerr : (std::ostream*)0;
+    // K-mers may have been counted already, alongside other K-mer lengths
+    if (counted) {
+        binSpectrum(*counted);
+    }
+    // Sequence files can be sampled rather than counted if only an estimate is needed
+    else if (approximate && input.mode == InputHandler::InputHandler::InputMode::COUNT) {
+        sketch();
+    }
+    else {
+        
+        if (approximate) {
+            cout << "Input is a jellyfish hash, so reading all K-mers rather than estimating the histogram." << endl << endl;
+        }
+        
+        // Either count or load input
+        if (input.mode == InputHandler::InputHandler::InputMode::COUNT) {
+            input.count(merLen, threads);
+        }
+        else {
+            // Only the counts are needed, so stream records from the file rather 
+            // than building a hash from it
+            input.loadHeader();
+            input.openDump();
+        }
 
-    // Do the work
-    bin();
-    
-    // Dump any hashes that were previously counted to disk if requested
-    // NOTE: MUST BE DONE AFTER COMPARISON AS THIS CLEARS ENTRIES FROM HASH ARRAY!
-    if (input.dumpHash) {
-        path outputPath(outputPrefix.string() + "-hash.jf" + lexical_cast<string>(merLen));
-        input.dump(outputPath, threads, true);     
+        threadedData = ThreadSlots<vector<uint64_t>>(threads, vector<uint64_t>(nb_buckets, 0));
+
+        // Do the work
+        bin();
+
+        // Dump any hashes that were previously counted to disk if requested
+        // NOTE: MUST BE DONE AFTER COMPARISON AS THIS CLEARS ENTRIES FROM HASH ARRAY!
+        if (input.dumpHash) {
+            path outputPath(outputPrefix.string() + "-hash.jf" + lexical_cast<string>(merLen));
+            input.dump(outputPath, threads, true);     
+        }
+        
+        // Merge results
+        merge();
     }
-    // Merge results
-    merge();
-    
     
+    // Fit the spectrum
+    analyse();
 }
 
 void kat::Histogram::save() {
@@ -130,6 +152,11 @@ void kat::Histogram::save() {
     print(main_hist_out_stream);
     main_hist_out_stream.close();
     
+    // Send spectrum analysis to output file
+    ofstream analysis_out_stream(string(outputPrefix.string() + ".dist_analysis").c_str());
+    printAnalysis(analysis_out_stream);
+    analysis_out_stream.close();
+    
     cout << " done.";
     cout.flush();
 }
@@ -137,7 +164,7 @@ void kat::Histogram::save() {
 
 void kat::Histogram::print(std::ostream &out) {
     // Output header
-    out << mme::KEY_TITLE << "K-mer spectra for: " << input.pathString() << endl;
+    out << mme::KEY_TITLE << (sketched ? "Estimated K-mer spectra for: " : "K-mer spectra for: ") << input.pathString() << endl;
     out << mme::KEY_X_LABEL << "K" << merLen << " multiplicity" << endl;
     out << mme::KEY_Y_LABEL << "Number of distinct K" << merLen << " mers" << endl;
     out << mme::MX_META_END << endl;
@@ -149,17 +176,85 @@ void kat::Histogram::print(std::ostream &out) {
 }
 
 
+void kat::Histogram::printAnalysis(std::ostream &out) {
+    
+    out << "K-mer spectrum analysis for: " << input.pathString() << endl << endl;
+    
+    if (!spectra) {
+        out << "Spectrum could not be analysed.  This requires a histogram starting at 1 with an increment of 1, " 
+            << "with a clear minimum after the error K-mers and a peak beyond it." << endl;
+        return;
+    }
+    
+    const uint16_t k = input.header ? input.header->key_len() / 2 : merLen;
+    const SpectraEstimate est = spectra->estimate(k);
+    
+    out << "Fitted peaks:" << endl;
+    for(const auto& p : spectra->getPeaks()) {
+        out << " - Mean: " << std::fixed << std::setprecision(2) << p.mean 
+            << "; Stddev: " << p.stddev 
+            << "; Distinct K-mers: " << llround(p.elements) << endl;
+    }
+    out << endl;
+    
+    out << "Estimates:" << endl;
+    out << " - Homozygous peak coverage: " << est.homCoverage << endl;
+    if (est.hetCoverage > 0.0) {
+        out << " - Heterozygous peak coverage: " << est.hetCoverage << endl;
+    }
+    out << " - Genome size: " << est.genomeSize << " bp" << endl;
+    if (est.hetCoverage > 0.0) {
+        out << " - Heterozygosity: " << std::setprecision(4) << est.heterozygosity * 100.0 << "%" << endl;
+    }
+    else {
+        out << " - Heterozygosity: no heterozygous peak found" << endl;
+    }
+    out << " - Error K-mers: " << est.nbErrorKmers << " distinct K-mers below multiplicity " << spectra->getFirstMin() 
+        << " (" << std::setprecision(2) << est.errorFraction * 100.0 << "% of distinct K-mers)" << endl << endl;
+    
+    out.unsetf(std::ios::floatfield);
+    out << std::setprecision(6);
+}
+
+void kat::Histogram::analyse() {
+    
+    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+
+    cout << "Fitting spectrum ...";
+    cout.flush();
+    
+    spectra = nullptr;
+    
+    // The model works on distinct K-mer counts for each multiplicity, so can only
+    // use unit bins from 1.  The last bin also holds everything beyond it, so is left out.
+    if (base == 1 && inc == 1) {
+        
+        vector<uint64_t> spectrum(nb_buckets, 0);
+        for(size_t i = 0; i + 1 < nb_buckets; i++) {
+            spectrum[i + 1] = data[i];
+        }
+        
+        shared_ptr<KmerSpectra> ks = make_shared<KmerSpectra>(spectrum);
+        if (ks->fit()) {
+            spectra = ks;
+        }
+    }
+    
+    cout << (spectra ? " done." : " no peaks found.");
+    cout.flush();
+}
+
 void kat::Histogram::merge() {
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
 
     cout << "Merging counts ...";
     cout.flush();
 
-    for(size_t i = 0; i < nb_buckets; i++) {
-        for(size_t j = 0; j < threads; j++) {
-            data[i] += threadedData[j]->at(i);
+    data = threadedData.reduce([](vector<uint64_t>& into, const vector<uint64_t>& from) {
+        for(size_t i = 0; i < into.size(); i++) {
+            into[i] += from[i];
         }
-    }
+    });
     
     cout << " done.";
     cout.flush();
@@ -188,20 +283,89 @@ void kat::Histogram::bin() {
 
 void kat::Histogram::binSlice(int th_id) {
     
-    shared_ptr<vector<uint64_t>> hist = make_shared<vector<uint64_t>>(nb_buckets);
+    // Each thread owns its own slot, so no locking is needed
+    vector<uint64_t>& hist = threadedData[th_id];
+    
+    if (input.hashDump) {
+        HashDump::slice_iterator it = input.hashDump->slice(th_id, threads);
+        binRecords(it, hist);
+    }
+    else {
+        LargeHashArray::region_iterator it = input.hash->region_slice(th_id, threads);
+        binRecords(it, hist);
+    }
+}
+
+void kat::Histogram::sketch() {
+    
+    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");
+    
+    cout << "Input is a sequence file.  Sampling K-mers for " << input.pathString() << "...";
+    cout.flush();
+    
+    // Convert paths to a format jellyfish is happy with
+    vector<const char*> paths;
+    for(const path& p : input.input) {
+        paths.push_back(p.c_str());
+    }
+    
+    mer_dna::k(merLen);
+    
+    StreamManager streams(paths.begin(), paths.end(), 1);
+    SequenceParser parser(merLen, streams.nb_streams(), 3 * threads, 4096, streams);
+    
+    SpectrumSketch sk(sketchSize);
     
-    LargeHashArray::region_iterator it = input.hash->region_slice(th_id, threads);
-    while (it.next()) {
-        uint64_t val = it.val();
-        if (val < base)
-            ++(*hist)[0];
-        else if (val > ceil)
-            ++(*hist)[nb_buckets - 1];
+    thread t[threads];
+
+    for(int i = 0; i < threads; i++) {
+        t[i] = thread(&Histogram::sketchSlice, this, std::ref(sk), std::ref(parser));
+    }
+
+    for(int i = 0; i < threads; i++){
+        t[i].join();
+    }
+    
+    cout << " done." << endl;
+    
+    binSpectrum(SpectrumTable(sk));
+    
+    cout << "Sampled " << sk.getNbSampled() << " distinct K-mers from " << std::setprecision(4) << sk.getFraction() * 100.0 
+         << "% of hash space.  Estimated " << sk.estimateDistinct() << " distinct K-mers in total.";
+    cout << std::setprecision(6);
+    cout.flush();
+}
+
+void kat::Histogram::binSpectrum(const SpectrumTable& table) {
+    
+    // Estimates stand for a fractional number of K-mers, so sum them before rounding
+    vector<double> est(nb_buckets, 0.0);
+    table.forEach([&](uint64_t c, uint16_t tag, double distinct) {
+        if (c < base)
+            est[0] += distinct;
+        else if (c > ceil)
+            est[nb_buckets - 1] += distinct;
         else
-            ++(*hist)[(val - base) / inc];
+            est[(c - base) / inc] += distinct;
+    });
+    
+    for(uint64_t i = 0; i < nb_buckets; i++) {
+        data[i] += llround(est[i]);
+    }
+    
+    sketched = approximate || table.isEstimated();
+}
+
+void kat::Histogram::sketchSlice(SpectrumSketch& sketch, SequenceParser& parser) {
+    
+    SpectrumSketch::Buffer buffer(sketch);
+    
+    MerIterator mers(parser, input.canonical);
+    for( ; mers; ++mers) {
+        buffer.add(JellyfishHelper::mixKey(*mers));
     }
     
-    threadedData.push_back(hist);
+    buffer.flush();
 }
 
 void kat::Histogram::plot() {
@@ -239,9 +403,11 @@ int kat::Histogram::main(int argc, char *argv[]) {
     uint64_t        high;
     uint64_t        inc;
     bool            canonical;
-    uint16_t        mer_len;
+    string          mer_len;
     uint64_t        hash_size; 
     bool            dump_hash;
+    bool            approximate;
+    uint64_t        sketch_size;
     bool            verbose;
     bool            help;
 
@@ -260,12 +426,20 @@ int kat::Histogram::main(int argc, char *argv[]) {
                 "Increment for each bin") 
             ("canonical,C", po::bool_switch(&canonical)->default_value(false),
                 "Whether the jellyfish hashes contains K-mers produced for both strands.  If this is not set to the same value as was produced during jellyfish counting then output will be unpredictable.")
-            ("mer_len,m", po::value<uint16_t>(&mer_len)->default_value(DEFAULT_MER_LEN),
-                "The kmer length to use in the kmer hashes.  Larger values will provide more discriminating power between kmers but at the expense of additional memory and lower coverage.")
+            ("mer_len,m", po::value<string>(&mer_len)->default_value(lexical_cast<string>(DEFAULT_MER_LEN)),
+                "The kmer length to use in the kmer hashes.  Larger values will provide more discriminating power between kmers but at the expense of additional memory and lower coverage.  " \
+                "For sequence file input, a comma separated list of up to 8 lengths produces a histogram for each from a single pass over the input.  " \
+                "Each length is counted into its own hash, starting at --hash_size, with the threads split evenly between them.  Every length needs at least one thread, so with fewer threads than lengths one thread is used per length.  Hashes cannot be dumped in this mode.")
             ("hash_size,H", po::value<uint64_t>(&hash_size)->default_value(DEFAULT_HASH_SIZE),
                 "If kmer counting is required for the input, then use this value as the hash size.  If this hash size is not large enough for your dataset then the default behaviour is to double the size of the hash and recount, which will increase runtime and memory usage.")
             ("dump_hash,d", po::bool_switch(&dump_hash)->default_value(false), 
                         "Dumps any jellyfish hashes to disk that were produced during this run.") 
+            ("approximate,a", po::bool_switch(&approximate)->default_value(false), 
+                "For sequence file input, estimates the histogram from a sample of K-mers instead of counting every K-mer into a hash.  " \
+                "Sequences are read once and memory use is bounded by --sketch_size, regardless of the size of the genome.  " \
+                "No hash is produced, so --dump_hash has no effect.")
+            ("sketch_size", po::value<uint64_t>(&sketch_size)->default_value(DEFAULT_SKETCH_SIZE), 
+                "The most distinct K-mers to sample in approximate mode, for each K-mer length.  Each uses 24 bytes.  Larger samples give more accurate estimates.")
             ("verbose,v", po::bool_switch(&verbose)->default_value(false), 
                 "Print extra information.")
             ("help", po::bool_switch(&help)->default_value(false), "Produce help message.")
@@ -304,24 +478,62 @@ int kat::Histogram::main(int argc, char *argv[]) {
     cout << "Running KAT in HIST mode" << endl
          << "------------------------" << endl << endl;
 
-    // Create the sequence coverage object
-    Histogram histo(inputs, low, high, inc);
-    histo.setOutputPrefix(output_prefix);
-    histo.setThreads(threads);
-    histo.setCanonical(canonical);
-    histo.setMerLen(mer_len);
-    histo.setHashSize(hash_size);
-    histo.setDumpHash(dump_hash);
-    histo.setVerbose(verbose);
-
-    // Do the work
-    histo.execute();
+    vector<uint16_t> mer_lens = JellyfishHelper::parseMerLens(mer_len);
     
-    // Save results
-    histo.save();
+    // With several K-mer lengths, read the input once counting K-mers of every length
+    vector<shared_ptr<SpectrumTable>> counted;
+    if (mer_lens.size() > 1) {
+        
+        if (dump_hash) {
+            BOOST_THROW_EXCEPTION(HistogramException() << HistogramErrorInfo(string(
+                    "Hashes cannot be dumped when using several K-mer lengths, as the hash for each length is discarded once its spectrum is found.")));
+        }
+        
+        if (approximate) {
+            for(auto& sk : JellyfishHelper::sketchSeqFiles(inputs, mer_lens, canonical, false, sketch_size, threads)) {
+                counted.push_back(make_shared<SpectrumTable>(*sk));
+            }
+        }
+        else {
+            counted = JellyfishHelper::countSeqFiles(inputs, mer_lens, canonical, hash_size, threads);
+        }
+    }
     
-    // Plot
-    histo.plot();
+    vector<shared_ptr<Histogram>> histos;
+    for(size_t i = 0; i < mer_lens.size(); i++) {
+        
+        // Create the sequence coverage object
+        shared_ptr<Histogram> histo = make_shared<Histogram>(inputs, low, high, inc);
+        histo->setOutputPrefix(counted.empty() ? output_prefix : 
+                path(output_prefix.string() + "-k" + lexical_cast<string>(mer_lens[i])));
+        histo->setThreads(threads);
+        histo->setCanonical(canonical);
+        histo->setMerLen(mer_lens[i]);
+        histo->setHashSize(hash_size);
+        histo->setDumpHash(dump_hash);
+        histo->setApproximate(approximate);
+        histo->setSketchSize(sketch_size);
+        histo->setVerbose(verbose);
+        if (!counted.empty()) {
+            histo->setCounted(counted[i]);
+        }
+
+        // Do the work
+        histo->execute();
+
+        // Save results
+        histo->save();
+
+        // Report spectrum analysis
+        histo->printAnalysis(cout);
+        
+        histos.push_back(histo);
+    }
+    
+    // Plot, once every result is safely on disk
+    for(auto& histo : histos) {
+        histo->plot();
+    }
 
     return 0;
 }
@@ -41,6 +41,15 @@ using bfs::path;
 #include <jellyfish/mer_dna.hpp>
 
 #include "inc/matrix/matrix_metadata_extractor.hpp"
+#include "inc/thread_slots.hpp"
+#include "inc/kmer_spectra.hpp"
+#include "inc/spectrum_sketch.hpp"
+#include "inc/spectrum_table.hpp"
+using kat::ThreadSlots;
+using kat::SpectrumSketch;
+using kat::SpectrumTable;
+using kat::KmerSpectra;
+using kat::SpectraEstimate;
 
 #include "input_handler.hpp"
 using kat::InputHandler;
@@ -60,13 +69,18 @@ namespace kat {
         uint64_t        low;
         uint64_t        high;
         uint16_t        merLen;
+        bool            approximate;
+        uint64_t        sketchSize;
         bool            verbose;
 
         // Internal vars
         uint64_t base, ceil, inc, nb_buckets, nb_slices;
         vector<uint64_t> data;
-        vector<shared_ptr<vector<uint64_t>>> threadedData;
+        ThreadSlots<vector<uint64_t>> threadedData;
         uint64_t slice_id;
+        shared_ptr<KmerSpectra> spectra;    // Only set if the spectrum could be fitted
+        bool sketched;                      // Whether data was estimated from a sample of K-mers
+        shared_ptr<SpectrumTable> counted;  // K-mers already counted from the input, if any
 
     public:
 
@@ -148,6 +162,38 @@ namespace kat {
         }
 
 
+        bool isApproximate() const {
+            return approximate;
+        }
+
+        /**
+         * Estimate the histogram of sequence files from a sample of K-mers, rather
+         * than counting every K-mer into a hash
+         */
+        void setApproximate(bool approximate) {
+            this->approximate = approximate;
+        }
+
+        uint64_t getSketchSize() const {
+            return sketchSize;
+        }
+
+        void setSketchSize(uint64_t sketchSize) {
+            this->sketchSize = sketchSize;
+        }
+
+        shared_ptr<SpectrumTable> getCounted() const {
+            return counted;
+        }
+
+        /**
+         * Use K-mers already counted from the input sequence files, for example 
+         * alongside those of other lengths, instead of reading the input again
+         */
+        void setCounted(shared_ptr<SpectrumTable> counted) {
+            this->counted = counted;
+        }
+
         bool isVerbose() const {
             return verbose;
         }
@@ -161,6 +207,12 @@ namespace kat {
         
         void print(std::ostream &out);
         
+        /**
+         * Describes the peaks fitted to the spectrum and the genome properties 
+         * estimated from them
+         */
+        void printAnalysis(std::ostream &out);
+        
         void save();
         
         void plot();
@@ -181,6 +233,31 @@ namespace kat {
          
         void binSlice(int th_id);
         
+        void analyse();
+        
+        void sketch();
+        
+        void sketchSlice(SpectrumSketch& sketch, SequenceParser& parser);
+        
+        void binSpectrum(const SpectrumTable& table);
+        
+        /**
+         * Bins the count of every record visited by the iterator, which may walk 
+         * either a hash array or a hash file on disk
+         */
+        template<typename Iterator>
+        void binRecords(Iterator& it, vector<uint64_t>& hist) {
+            while (it.next()) {
+                uint64_t val = it.val();
+                if (val < base)
+                    ++hist[0];
+                else if (val > ceil)
+                    ++hist[nb_buckets - 1];
+                else
+                    ++hist[(val - base) / inc];
+            }
+        }
+        
         static string helpMessage(){
             
             return string("Usage: kat hist [options] (<input>)+\n\n") +
@@ -192,7 +269,12 @@ namespace kat {
                             "The last bucket in the output behaves as a catchall: it tallies all k-mers with a count greater or equal to " \
                             "the low end point of this bucket.\n" \
                             "This tool is very similar to the \"histo\" tool in jellyfish itself.  The primary difference being that the " \
-                            "output contains metadata that make the histogram easier for the user to plot.\n\n" \
+                            "output contains metadata that make the histogram easier for the user to plot.\n" \
+                            "When the histogram has unit buckets starting from 1, peaks are fitted to the spectrum and used to estimate " \
+                            "genome size, heterozygosity and the proportion of error K-mers.  These are written to <output_prefix>.dist_analysis.\n" \
+                            "Several K-mer lengths can be given as a comma separated list, such as \"-m 21,27,31\", for sequence file input.  " \
+                            "The input is then read only once and a histogram is produced for each length, with \"-k<length>\" appended to " \
+                            "the output prefix.\n\n" \
                             "Options";
 
         }
@@ -0,0 +1,251 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+using std::vector;
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace kat {
+
+    /**
+     * Classifies each base in a stretch of sequence in a single pass, producing
+     * three bitmaps with one bit per base: bases that are invalid in a K-mer (anything
+     * other than upper case A, C, G or T, as in RollingMer), G or C bases, and N
+     * bases, the last two in either case.  The base at offset i is bit i % 64 of
+     * word i / 64.  Tallies over any range of bases are then just popcounts.
+     *
+     * Blocks of 64 bases are classified with AVX2 or SSE2 compares when the compiler
+     * targets them, falling back to a lookup table otherwise.  Buffers only grow, so
+     * an object can be reused for many sequences without allocating.
+     */
+    class BaseMasks {
+    public:
+
+        static const uint32_t BLOCK_SIZE = 64;
+
+    private:
+
+        vector<uint64_t> invalid;
+        vector<uint64_t> gc;
+        vector<uint64_t> n;
+        uint64_t length;
+
+    public:
+
+        BaseMasks() : length(0) {}
+
+        /**
+         * Classifies the given bases, replacing any previous contents
+         */
+        void classify(const char* seq, uint64_t len) {
+
+            const uint64_t nbWords = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+            if (nbWords > invalid.size()) {
+                invalid.resize(nbWords);
+                gc.resize(nbWords);
+                n.resize(nbWords);
+            }
+
+            length = len;
+
+            for(uint64_t i = 0; i < nbWords; i++) {
+                const uint64_t start = i * BLOCK_SIZE;
+                const uint32_t blockLen = len - start < BLOCK_SIZE ? len - start : BLOCK_SIZE;
+                classifyBlock(seq + start, blockLen, invalid[i], gc[i], n[i]);
+            }
+        }
+
+        uint64_t size() const {
+            return length;
+        }
+
+        bool isInvalid(uint64_t i) const {
+            return (invalid[i / BLOCK_SIZE] >> (i % BLOCK_SIZE)) & 1;
+        }
+
+        /**
+         * Offset of the first invalid base in [from, to), or to if there are none
+         */
+        uint64_t nextInvalid(uint64_t from, uint64_t to) const {
+
+            if (from >= to) return to;
+
+            uint64_t word = from / BLOCK_SIZE;
+            uint64_t bits = invalid[word] & (~0ULL << (from % BLOCK_SIZE));
+            const uint64_t lastWord = (to - 1) / BLOCK_SIZE;
+
+            while (bits == 0) {
+                if (++word > lastWord) return to;
+                bits = invalid[word];
+            }
+
+            const uint64_t pos = word * BLOCK_SIZE + __builtin_ctzll(bits);
+            return pos < to ? pos : to;
+        }
+
+        uint64_t countInvalid(uint64_t from, uint64_t to) const {
+            return countBits(invalid, from, to);
+        }
+
+        uint64_t countGC(uint64_t from, uint64_t to) const {
+            return countBits(gc, from, to);
+        }
+
+        uint64_t countN(uint64_t from, uint64_t to) const {
+            return countBits(n, from, to);
+        }
+
+        /**
+         * Classifies up to 64 bases.  Bits beyond len are left clear in each mask.
+         */
+        static void classifyBlock(const char* seq, uint32_t len, uint64_t& invalidBits, uint64_t& gcBits, uint64_t& nBits) {
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+            // Pad short blocks with zeros, which are invalid and then masked off
+            char padded[BLOCK_SIZE];
+            if (len < BLOCK_SIZE) {
+                memset(padded, 0, BLOCK_SIZE);
+                memcpy(padded, seq, len);
+                seq = padded;
+            }
+
+            invalidBits = 0;
+            gcBits = 0;
+            nBits = 0;
+
+#if defined(__AVX2__)
+            const uint32_t width = 32;
+            typedef __m256i vec;
+            #define KAT_LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+            #define KAT_SET1(c) _mm256_set1_epi8(c)
+            #define KAT_EQ(a, b) _mm256_cmpeq_epi8(a, b)
+            #define KAT_OR(a, b) _mm256_or_si256(a, b)
+            #define KAT_AND(a, b) _mm256_and_si256(a, b)
+            #define KAT_MASK(a) (uint64_t)(uint32_t)_mm256_movemask_epi8(a)
+#else
+            const uint32_t width = 16;
+            typedef __m128i vec;
+            #define KAT_LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+            #define KAT_SET1(c) _mm_set1_epi8(c)
+            #define KAT_EQ(a, b) _mm_cmpeq_epi8(a, b)
+            #define KAT_OR(a, b) _mm_or_si128(a, b)
+            #define KAT_AND(a, b) _mm_and_si128(a, b)
+            #define KAT_MASK(a) (uint64_t)(uint32_t)(_mm_movemask_epi8(a) & 0xFFFF)
+#endif
+
+            for(uint32_t i = 0; i < BLOCK_SIZE; i += width) {
+
+                const vec v = KAT_LOAD(seq + i);
+
+                // Clearing bit 5 upper cases letters, and nothing else maps onto G, C or N
+                const vec upper = KAT_AND(v, KAT_SET1((char)0xDF));
+
+                const vec valid = KAT_OR(
+                        KAT_OR(KAT_EQ(v, KAT_SET1('A')), KAT_EQ(v, KAT_SET1('C'))),
+                        KAT_OR(KAT_EQ(v, KAT_SET1('G')), KAT_EQ(v, KAT_SET1('T'))));
+
+                const vec isGC = KAT_OR(KAT_EQ(upper, KAT_SET1('G')), KAT_EQ(upper, KAT_SET1('C')));
+                const vec isN = KAT_EQ(upper, KAT_SET1('N'));
+
+                invalidBits |= KAT_MASK(valid) << i;
+                gcBits |= KAT_MASK(isGC) << i;
+                nBits |= KAT_MASK(isN) << i;
+            }
+
+            #undef KAT_LOAD
+            #undef KAT_SET1
+            #undef KAT_EQ
+            #undef KAT_OR
+            #undef KAT_AND
+            #undef KAT_MASK
+
+            // Valid bits were collected above, so flip them to mark the invalid bases
+            const uint64_t used = len == BLOCK_SIZE ? ~0ULL : (1ULL << len) - 1;
+            invalidBits = ~invalidBits & used;
+            gcBits &= used;
+            nBits &= used;
+#else
+            classifyBlockScalar(seq, len, invalidBits, gcBits, nBits);
+#endif
+        }
+
+        /**
+         * Portable version of classifyBlock
+         */
+        static void classifyBlockScalar(const char* seq, uint32_t len, uint64_t& invalidBits, uint64_t& gcBits, uint64_t& nBits) {
+
+            invalidBits = 0;
+            gcBits = 0;
+            nBits = 0;
+
+            for(uint32_t i = 0; i < len; i++) {
+                const uint8_t c = classOf(seq[i]);
+                invalidBits |= (uint64_t)(c & 1) << i;
+                gcBits |= (uint64_t)((c >> 1) & 1) << i;
+                nBits |= (uint64_t)((c >> 2) & 1) << i;
+            }
+        }
+
+    private:
+
+        /**
+         * Bit 0 set for invalid bases, bit 1 for G or C and bit 2 for N
+         */
+        static uint8_t classOf(char c) {
+            switch(c) {
+                case 'A': case 'T': return 0;
+                case 'C': case 'G': return 2;
+                case 'c': case 'g': return 3;
+                case 'N': case 'n': return 5;
+                default: return 1;
+            }
+        }
+
+        static uint64_t countBits(const vector<uint64_t>& bits, uint64_t from, uint64_t to) {
+
+            if (from >= to) return 0;
+
+            const uint64_t firstWord = from / BLOCK_SIZE;
+            const uint64_t lastWord = (to - 1) / BLOCK_SIZE;
+            const uint64_t firstMask = ~0ULL << (from % BLOCK_SIZE);
+            const uint64_t lastMask = ~0ULL >> (BLOCK_SIZE - 1 - (to - 1) % BLOCK_SIZE);
+
+            if (firstWord == lastWord) {
+                return __builtin_popcountll(bits[firstWord] & firstMask & lastMask);
+            }
+
+            uint64_t count = __builtin_popcountll(bits[firstWord] & firstMask);
+            for(uint64_t i = firstWord + 1; i < lastWord; i++) {
+                count += __builtin_popcountll(bits[i]);
+            }
+            count += __builtin_popcountll(bits[lastWord] & lastMask);
+
+            return count;
+        }
+    };
+}
@@ -0,0 +1,134 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+using std::string;
+
+#include <boost/exception/all.hpp>
+#include <boost/lexical_cast.hpp>
+using boost::lexical_cast;
+
+namespace kat {
+
+    typedef boost::error_info<struct BlockedBloomFilterError,string> BlockedBloomFilterErrorInfo;
+    struct BlockedBloomFilterException: virtual boost::exception, virtual std::exception { };
+
+    /**
+     * A bloom filter where all the bits for a key live in a single 64 byte block, so
+     * a query touches exactly one cache line.  Keys are supplied as well mixed 64-bit
+     * hash values.  Inserts are atomic so the filter can be built by several threads
+     * at once.  False positives are possible, false negatives are not.
+     */
+    class BlockedBloomFilter {
+    public:
+
+        static const uint16_t BLOCK_BYTES = 64;
+        static const uint16_t BLOCK_WORDS = BLOCK_BYTES / sizeof(uint64_t);
+        static const uint16_t NB_PROBES = 4;
+        static const uint16_t DEFAULT_BITS_PER_KEY = 10;
+
+    private:
+
+        uint64_t* data;
+        uint64_t nbBlocks;
+
+    public:
+
+        /**
+         * Creates an empty filter sized for the expected number of keys
+         * @param nbKeys Expected number of keys
+         * @param bitsPerKey Number of bits to allocate per key
+         */
+        BlockedBloomFilter(uint64_t nbKeys, uint16_t bitsPerKey) {
+
+            nbBlocks = (nbKeys * bitsPerKey) / (BLOCK_BYTES * 8) + 1;
+
+            if (posix_memalign((void**)&data, BLOCK_BYTES, nbBlocks * BLOCK_BYTES) != 0) {
+                BOOST_THROW_EXCEPTION(BlockedBloomFilterException() << BlockedBloomFilterErrorInfo(string(
+                        "Could not allocate memory for K-mer prefilter.  Blocks requested: ") + lexical_cast<string>(nbBlocks)));
+            }
+
+            memset(data, 0, nbBlocks * BLOCK_BYTES);
+        }
+
+        BlockedBloomFilter(uint64_t nbKeys) : BlockedBloomFilter(nbKeys, DEFAULT_BITS_PER_KEY) {}
+
+        BlockedBloomFilter(const BlockedBloomFilter&) = delete;
+        BlockedBloomFilter& operator=(const BlockedBloomFilter&) = delete;
+
+        virtual ~BlockedBloomFilter() {
+            free(data);
+        }
+
+        uint64_t getNbBlocks() const {
+            return nbBlocks;
+        }
+
+        uint64_t getSizeInBytes() const {
+            return nbBlocks * BLOCK_BYTES;
+        }
+
+        /**
+         * Adds a key to the filter.  Safe to call from multiple threads.
+         * @param hash Mixed hash value of the key
+         */
+        void insert(uint64_t hash) {
+
+            uint64_t* block = data + blockIndex(hash) * BLOCK_WORDS;
+
+            for(uint16_t i = 0; i < NB_PROBES; i++) {
+                const uint16_t bit = (hash >> (i * 9)) & 0x1FF;
+                __sync_fetch_and_or(&block[bit >> 6], (uint64_t)1 << (bit & 63));
+            }
+        }
+
+        /**
+         * Whether or not the key may have been added to the filter
+         * @param hash Mixed hash value of the key
+         * @return False if the key was definitely not added to the filter
+         */
+        bool contains(uint64_t hash) const {
+
+            const uint64_t* block = data + blockIndex(hash) * BLOCK_WORDS;
+
+            for(uint16_t i = 0; i < NB_PROBES; i++) {
+                const uint16_t bit = (hash >> (i * 9)) & 0x1FF;
+                if ((block[bit >> 6] & ((uint64_t)1 << (bit & 63))) == 0)
+                    return false;
+            }
+
+            return true;
+        }
+
+    protected:
+
+        /**
+         * Selects a block from the hash.  The hash is remixed first so that blocks are
+         * still chosen uniformly when the keys were sampled on the top bits of the hash.
+         */
+        uint64_t blockIndex(uint64_t hash) const {
+            uint64_t h = (hash ^ (hash >> 31)) * 0x94d049bb133111ebULL;
+            h ^= h >> 29;
+            return (uint64_t)(((unsigned __int128)h * nbBlocks) >> 64);
+        }
+    };
+}
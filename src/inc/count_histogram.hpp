@@ -0,0 +1,152 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+using std::vector;
+
+namespace kat {
+
+    /**
+     * Frequency of each K-mer count seen across a sequence, or part of a sequence.
+     * Histograms built over separate parts of a sequence can be merged, and give
+     * the same median as sorting all the counts.  Counts below the limit are
+     * tallied in a dense array, which grows to fit the largest such count seen.
+     * The rare counts at or above the limit are kept as they are and only examined
+     * if the median falls among them.
+     */
+    class CountHistogram {
+    public:
+
+        static const uint32_t DEFAULT_LIMIT = 65536;
+
+    private:
+
+        vector<uint64_t> freqs;
+        vector<uint64_t> overflow;
+        uint64_t total;
+        uint32_t limit;
+
+    public:
+
+        CountHistogram() : CountHistogram(DEFAULT_LIMIT) {}
+
+        CountHistogram(uint32_t _limit) : total(0), limit(_limit) {}
+
+        void add(uint64_t count) {
+            if (count >= limit) {
+                overflow.push_back(count);
+            }
+            else {
+                if (count >= freqs.size()) {
+                    freqs.resize(count + 1, 0);
+                }
+                freqs[count]++;
+            }
+            total++;
+        }
+
+        /**
+         * Adds the same count several times over
+         */
+        void add(uint64_t count, uint64_t times) {
+            if (count >= limit) {
+                overflow.insert(overflow.end(), times, count);
+            }
+            else {
+                if (count >= freqs.size()) {
+                    freqs.resize(count + 1, 0);
+                }
+                freqs[count] += times;
+            }
+            total += times;
+        }
+
+        void merge(const CountHistogram& other) {
+            if (other.freqs.size() > freqs.size()) {
+                freqs.resize(other.freqs.size(), 0);
+            }
+            for(size_t i = 0; i < other.freqs.size(); i++) {
+                freqs[i] += other.freqs[i];
+            }
+            overflow.insert(overflow.end(), other.overflow.begin(), other.overflow.end());
+            total += other.total;
+        }
+
+        uint64_t size() const {
+            return total;
+        }
+
+        uint64_t overflowSize() const {
+            return overflow.size();
+        }
+
+        /**
+         * Empties the histogram but keeps its memory for reuse
+         */
+        void reset() {
+            freqs.clear();
+            overflow.clear();
+            total = 0;
+        }
+
+        /**
+         * Empties the histogram and releases its memory
+         */
+        void clear() {
+            vector<uint64_t>().swap(freqs);
+            vector<uint64_t>().swap(overflow);
+            total = 0;
+        }
+
+        /**
+         * The value at position size() / 2 if all the counts were sorted, or 0 if
+         * the histogram is empty.  May reorder the overflowed counts.
+         */
+        uint64_t median() {
+            return select(total / 2);
+        }
+
+        /**
+         * The value at the given position if all the counts were sorted, or 0 if
+         * the histogram is empty.  Positions past the end give the largest count.
+         * May reorder the overflowed counts.
+         */
+        uint64_t select(uint64_t rank) {
+
+            if (total == 0)
+                return 0;
+
+            const uint64_t target = std::min(rank, total - 1);
+
+            uint64_t seen = 0;
+            for(size_t i = 0; i < freqs.size(); i++) {
+                seen += freqs[i];
+                if (seen > target)
+                    return i;
+            }
+
+            // The value is one of the large counts, so select it directly
+            vector<uint64_t>::iterator nth = overflow.begin() + (target - seen);
+            std::nth_element(overflow.begin(), nth, overflow.end());
+            return *nth;
+        }
+    };
+}
@@ -0,0 +1,342 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using std::ifstream;
+using std::ofstream;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/lexical_cast.hpp>
+namespace bfs = boost::filesystem;
+using bfs::path;
+using boost::lexical_cast;
+
+namespace kat {
+
+    typedef boost::error_info<struct CoverageFileError,string> CoverageFileErrorInfo;
+    struct CoverageFileException: virtual boost::exception, virtual std::exception { };
+
+    /**
+     * Location of a single sequence's K-mer counts within a binary coverage file
+     */
+    struct CoverageIndexEntry {
+        string name;
+        uint64_t nbValues;
+        vector<uint64_t> blockOffsets;  // File offset of each block, plus the offset one past the last block
+    };
+
+    /**
+     * Binary alternative to the text K-mer coverage file produced by sect.  The
+     * counts for each sequence are split into blocks of a fixed number of values.
+     * Within a block each count is stored as the zig-zag encoded difference from the
+     * previous count, written as a variable length integer, so runs of similar
+     * coverage take a byte per value.  Blocks are independent, so any range of a
+     * sequence can be decoded without reading the rest.  An index of sequence
+     * names and block offsets is written at the end of the file.
+     *
+     * Layout: magic, block size (uint32), blocks..., index, index offset (uint64)
+     */
+    class CoverageFile {
+    public:
+
+        static const uint16_t MAGIC_LEN = 8;
+        static const uint32_t DEFAULT_BLOCK_SIZE = 65536;
+
+        static const char* magic() {
+            return "KATCVGB1";
+        }
+
+        static void putVarint(string& buf, uint64_t val) {
+            while (val >= 0x80) {
+                buf.push_back((char)((val & 0x7F) | 0x80));
+                val >>= 7;
+            }
+            buf.push_back((char)val);
+        }
+
+        static uint64_t getVarint(const char*& p, const char* end) {
+            uint64_t val = 0;
+            for(uint16_t shift = 0; p < end && shift < 64; shift += 7) {
+                const uint8_t b = (uint8_t)*p++;
+                val |= (uint64_t)(b & 0x7F) << shift;
+                if ((b & 0x80) == 0)
+                    return val;
+            }
+            BOOST_THROW_EXCEPTION(CoverageFileException() << CoverageFileErrorInfo(string(
+                    "Corrupt variable length integer in binary coverage file")));
+        }
+
+        static uint64_t zigzag(int64_t val) {
+            return ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+        }
+
+        static int64_t unzigzag(uint64_t val) {
+            return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+        }
+
+        /**
+         * Whether the file at the given path starts with the binary coverage file magic
+         */
+        static bool isCoverageFile(const path& p) {
+            ifstream in(p.c_str(), std::ios::binary);
+            char buf[MAGIC_LEN];
+            return in.read(buf, MAGIC_LEN) && memcmp(buf, magic(), MAGIC_LEN) == 0;
+        }
+    };
+
+    /**
+     * Writes K-mer counts for a series of sequences to a binary coverage file
+     */
+    class CoverageWriter {
+    private:
+
+        ofstream out;
+        uint32_t blockSize;
+        vector<CoverageIndexEntry> index;
+        string buf;
+
+    public:
+
+        CoverageWriter(const path& p) : CoverageWriter(p, CoverageFile::DEFAULT_BLOCK_SIZE) {}
+
+        CoverageWriter(const path& p, uint32_t _blockSize) : blockSize(_blockSize) {
+
+            out.open(p.c_str(), std::ios::binary);
+
+            if (!out.is_open()) {
+                BOOST_THROW_EXCEPTION(CoverageFileException() << CoverageFileErrorInfo(string(
+                        "Could not open binary coverage file for writing: ") + p.string()));
+            }
+
+            out.write(CoverageFile::magic(), CoverageFile::MAGIC_LEN);
+            out.write((const char*)&blockSize, sizeof(blockSize));
+        }
+
+        virtual ~CoverageWriter() {
+            if (out.is_open()) {
+                close();
+            }
+        }
+
+        /**
+         * Appends the counts for a sequence
+         */
+        void write(const string& name, const vector<uint64_t>& counts) {
+            write(name, counts.data(), counts.size());
+        }
+
+        /**
+         * Appends the nbCounts counts for a sequence
+         */
+        template<typename T>
+        void write(const string& name, const T* counts, size_t nbCounts) {
+
+            CoverageIndexEntry entry;
+            entry.name = name;
+            entry.nbValues = nbCounts;
+
+            for(size_t start = 0; start < nbCounts; start += blockSize) {
+
+                entry.blockOffsets.push_back(out.tellp());
+
+                const size_t end = std::min(start + blockSize, nbCounts);
+
+                buf.clear();
+                uint64_t previous = 0;
+                for(size_t i = start; i < end; i++) {
+                    CoverageFile::putVarint(buf, CoverageFile::zigzag((int64_t)((uint64_t)counts[i] - previous)));
+                    previous = counts[i];
+                }
+
+                out.write(buf.data(), buf.size());
+            }
+
+            entry.blockOffsets.push_back(out.tellp());
+
+            index.push_back(entry);
+        }
+
+        /**
+         * Writes the index and closes the file
+         */
+        void close() {
+
+            const uint64_t indexOffset = out.tellp();
+
+            buf.clear();
+            CoverageFile::putVarint(buf, index.size());
+
+            for(const auto& e : index) {
+                CoverageFile::putVarint(buf, e.name.size());
+                buf.append(e.name);
+                CoverageFile::putVarint(buf, e.nbValues);
+                CoverageFile::putVarint(buf, e.blockOffsets.size());
+                for(uint64_t o : e.blockOffsets) {
+                    CoverageFile::putVarint(buf, o);
+                }
+            }
+
+            out.write(buf.data(), buf.size());
+            out.write((const char*)&indexOffset, sizeof(indexOffset));
+            out.close();
+
+            index.clear();
+        }
+    };
+
+    /**
+     * Reads K-mer counts from a binary coverage file.  Only the index is held in
+     * memory, counts are decoded from the file on request.
+     */
+    class CoverageReader {
+    private:
+
+        ifstream in;
+        uint32_t blockSize;
+        vector<CoverageIndexEntry> index;
+        unordered_map<string, size_t> lookup;
+        string buf;
+
+    public:
+
+        CoverageReader(const path& p) {
+
+            in.open(p.c_str(), std::ios::binary);
+
+            char magic[CoverageFile::MAGIC_LEN];
+
+            if (!in.is_open() || !in.read(magic, CoverageFile::MAGIC_LEN) || memcmp(magic, CoverageFile::magic(), CoverageFile::MAGIC_LEN) != 0) {
+                BOOST_THROW_EXCEPTION(CoverageFileException() << CoverageFileErrorInfo(string(
+                        "Could not open binary coverage file: ") + p.string()));
+            }
+
+            in.read((char*)&blockSize, sizeof(blockSize));
+
+            // Load the index from the end of the file
+            uint64_t indexOffset = 0;
+            in.seekg(-(int64_t)sizeof(indexOffset), std::ios::end);
+            const uint64_t indexEnd = in.tellg();
+            in.read((char*)&indexOffset, sizeof(indexOffset));
+
+            if (!in || indexOffset > indexEnd) {
+                BOOST_THROW_EXCEPTION(CoverageFileException() << CoverageFileErrorInfo(string(
+                        "Binary coverage file is truncated: ") + p.string()));
+            }
+
+            buf.resize(indexEnd - indexOffset);
+            in.seekg(indexOffset);
+            in.read(&buf[0], buf.size());
+
+            const char* c = buf.data();
+            const char* end = c + buf.size();
+
+            const uint64_t nbEntries = CoverageFile::getVarint(c, end);
+            index.resize(nbEntries);
+
+            for(auto& e : index) {
+                const uint64_t nameLen = CoverageFile::getVarint(c, end);
+                if (nameLen > (uint64_t)(end - c)) {
+                    BOOST_THROW_EXCEPTION(CoverageFileException() << CoverageFileErrorInfo(string(
+                            "Corrupt index in binary coverage file: ") + p.string()));
+                }
+                e.name.assign(c, nameLen);
+                c += nameLen;
+                e.nbValues = CoverageFile::getVarint(c, end);
+                e.blockOffsets.resize(CoverageFile::getVarint(c, end));
+                for(auto& o : e.blockOffsets) {
+                    o = CoverageFile::getVarint(c, end);
+                }
+            }
+
+            for(size_t i = 0; i < index.size(); i++) {
+                lookup.insert(std::make_pair(index[i].name, i));
+            }
+        }
+
+        size_t size() const {
+            return index.size();
+        }
+
+        const CoverageIndexEntry& getEntry(size_t i) const {
+            return index[i];
+        }
+
+        /**
+         * Position of the named sequence in the file, or size() if not present
+         */
+        size_t find(const string& name) const {
+            auto it = lookup.find(name);
+            return it == lookup.end() ? index.size() : it->second;
+        }
+
+        /**
+         * Decodes counts [start, end) for the i'th sequence in the file.  The range is
+         * clipped to the length of the sequence.
+         */
+        void read(size_t i, uint64_t start, uint64_t end, vector<uint64_t>& counts) {
+
+            const CoverageIndexEntry& e = index[i];
+
+            counts.clear();
+            end = std::min(end, e.nbValues);
+
+            if (start >= end)
+                return;
+
+            counts.reserve(end - start);
+
+            for(uint64_t b = start / blockSize; b * blockSize < end; b++) {
+
+                buf.resize(e.blockOffsets[b + 1] - e.blockOffsets[b]);
+                in.seekg(e.blockOffsets[b]);
+                in.read(&buf[0], buf.size());
+
+                const char* c = buf.data();
+                const char* bufEnd = c + buf.size();
+
+                const uint64_t first = b * blockSize;
+                const uint64_t last = std::min(first + blockSize, end);
+
+                uint64_t val = 0;
+                for(uint64_t j = first; j < last; j++) {
+                    val += CoverageFile::unzigzag(CoverageFile::getVarint(c, bufEnd));
+                    if (j >= start)
+                        counts.push_back(val);
+                }
+            }
+        }
+
+        /**
+         * Decodes all counts for the i'th sequence in the file
+         */
+        void read(size_t i, vector<uint64_t>& counts) {
+            read(i, 0, index[i].nbValues, counts);
+        }
+    };
+}
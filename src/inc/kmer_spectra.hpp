@@ -0,0 +1,549 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+using std::vector;
+
+namespace kat {
+
+    /**
+     * A normal distribution of K-mers around some multiplicity.  The distribution is
+     * scaled so that its area is the number of distinct K-mers it holds.
+     */
+    class KmerPeak {
+    public:
+
+        double mean;
+        double stddev;
+        double elements;
+
+        KmerPeak() : KmerPeak(0.0, 0.0, 0.0) {}
+
+        KmerPeak(double _mean, double _stddev, double _elements) :
+            mean(_mean), stddev(_stddev), elements(_elements) {}
+
+        /**
+         * Number of distinct K-mers this peak predicts at the given multiplicity
+         */
+        double point(double x) const {
+            const double z = (x - mean) / stddev;
+            return elements / (sqrt(2.0 * M_PI) * stddev) * exp(-0.5 * z * z);
+        }
+    };
+
+    /**
+     * Estimates derived from a fitted K-mer spectrum
+     */
+    struct SpectraEstimate {
+        double homCoverage;         // Mean of the homozygous peak
+        double hetCoverage;         // Mean of the heterozygous peak, or 0 if none was found
+        uint64_t genomeSize;        // Haploid genome size in bases
+        double heterozygosity;      // Proportion of heterozygous bases
+        uint64_t nbErrorKmers;      // Distinct K-mers below the first minimum
+        double errorFraction;       // Proportion of distinct K-mers that are errors
+    };
+
+    /**
+     * Fits a K-mer spectrum with a mixture of normal distributions, one for each
+     * peak, following the KmerSpectra model from scripts/dist_analysis.py.  Peaks
+     * are looked for at fractions and multiples of the highest point after the
+     * first minimum and fitted one at a time, largest first, each against what the
+     * larger peaks leave unexplained.  This can reveal further peaks, which are
+     * added and the process repeated.  Finally all peaks are refined together.
+     *
+     * Fitting uses Levenberg-Marquardt with analytic derivatives.  As in the
+     * script, the model is penalised twice as much for exceeding the spectrum as
+     * for falling short of it, so peaks do not grow to cover their neighbours.
+     */
+    class KmerSpectra {
+    public:
+
+        static const uint32_t DEFAULT_MIN_PERC = 1;
+        static const uint64_t DEFAULT_MIN_ELEM = 100000;
+
+        static const uint16_t MAX_ITERATIONS = 200;
+
+    private:
+
+        vector<double> histogram;       // Distinct K-mers at each multiplicity, indexed by multiplicity
+        vector<KmerPeak> peaks;         // Sorted by mean
+        vector<uint32_t> cuts;          // Peak i is fitted over [cuts[i], cuts[i+1])
+        uint32_t fmin;
+        uint32_t fmax;
+        uint32_t minPerc;
+        uint64_t minElem;
+
+    public:
+
+        /**
+         * @param _histogram Distinct K-mers at each multiplicity, starting from multiplicity 0
+         * @param _minPerc Peaks after the first must hold at least this percentage of the
+         * K-mers already in peaks, or minElem K-mers, whichever is less
+         * @param _minElem See minPerc
+         */
+        KmerSpectra(const vector<uint64_t>& _histogram, uint32_t _minPerc, uint64_t _minElem) :
+            histogram(_histogram.begin(), _histogram.end()), fmin(0), fmax(0), minPerc(_minPerc), minElem(_minElem) {}
+
+        KmerSpectra(const vector<uint64_t>& _histogram) :
+            KmerSpectra(_histogram, DEFAULT_MIN_PERC, DEFAULT_MIN_ELEM) {}
+
+        const vector<KmerPeak>& getPeaks() const {
+            return peaks;
+        }
+
+        uint32_t getFirstMin() const {
+            return fmin;
+        }
+
+        uint32_t getGlobalMax() const {
+            return fmax;
+        }
+
+        /**
+         * Finds and fits the peaks in the spectrum
+         * @return False if the spectrum has no recognisable peaks
+         */
+        bool fit() {
+
+            peaks.clear();
+            cuts.clear();
+
+            createPeaks();
+
+            if (peaks.empty())
+                return false;
+
+            optimisePeaks();
+            optimiseOverall();
+
+            return true;
+        }
+
+        /**
+         * Estimates genome properties from the fitted peaks.  The peak holding the
+         * most K-mers is taken as homozygous, and a well defined peak near half its
+         * coverage, if there is one, as heterozygous.  The genome size is the number
+         * of K-mers beyond the first minimum, counting each as often as it occurs,
+         * divided by the homozygous coverage.
+         * @param merLen K-mer length, needed to convert heterozygous K-mers into bases
+         */
+        SpectraEstimate estimate(uint16_t merLen) const {
+
+            SpectraEstimate est = SpectraEstimate();
+
+            double total = 0.0;
+            for(size_t x = 0; x < histogram.size(); x++) {
+                total += histogram[x];
+                if (x < fmin)
+                    est.nbErrorKmers += histogram[x];
+            }
+            est.errorFraction = total > 0.0 ? est.nbErrorKmers / total : 0.0;
+
+            if (peaks.empty())
+                return est;
+
+            const KmerPeak* hom = &peaks[0];
+            for(const auto& p : peaks) {
+                if (p.elements > hom->elements) hom = &p;
+            }
+
+            const KmerPeak* het = nullptr;
+            for(const auto& p : peaks) {
+                const double ratio = p.mean / hom->mean;
+                const bool peaked = p.stddev < p.mean / 2.0;
+                if (ratio > 0.4 && ratio < 0.6 && peaked && (het == nullptr || p.elements > het->elements)) het = &p;
+            }
+
+            est.homCoverage = hom->mean;
+
+            double bases = 0.0;
+            for(size_t x = fmin; x < histogram.size(); x++) {
+                bases += (double)x * histogram[x];
+            }
+            est.genomeSize = llround(bases / hom->mean);
+
+            if (het != nullptr) {
+
+                est.hetCoverage = het->mean;
+
+                // Each heterozygous base gives merLen distinct K-mers per haplotype, so
+                // half of the heterozygous peak belongs to each haplotype
+                const double hetFraction = (het->elements / 2.0) / (hom->elements + het->elements / 2.0);
+                est.heterozygosity = 1.0 - pow(1.0 - hetFraction, 1.0 / merLen);
+            }
+
+            return est;
+        }
+
+    private:
+
+        /**
+         * Smoothed derivative at x, comparing the mean of the following points with
+         * the mean of the preceding ones over a window that widens with x
+         */
+        static double smoothDeriv(const vector<double>& h, uint32_t x) {
+
+            const uint32_t w = x / 10;
+            const uint32_t end = std::min<size_t>(x + 1 + w, h.size());
+
+            if (w == 0 || x + 1 >= end)
+                return 0.0;
+
+            double ahead = 0.0;
+            for(uint32_t i = x + 1; i < end; i++) ahead += h[i];
+
+            double behind = 0.0;
+            for(uint32_t i = x - w; i <= x; i++) behind += h[i];
+
+            return ahead / (end - x - 1) - behind / (w + 1);
+        }
+
+        double totalElements() const {
+            double total = 0.0;
+            for(const auto& p : peaks) total += p.elements;
+            return total;
+        }
+
+        /**
+         * Looks for a single maximum in [center - radius, center + radius)
+         * @return The multiplicity of the maximum, or 0 if there isn't a clear one
+         */
+        uint32_t findMaxima(uint32_t center, uint32_t radius, const vector<double>& h) const {
+
+            const uint32_t start = center - radius;
+            const uint32_t end = center + radius;
+
+            uint32_t best = start;
+            double sum = 0.0;
+            for(uint32_t i = start; i < end; i++) {
+                if (h[i] > h[best]) best = i;
+                sum += h[i];
+            }
+
+            if (best == start || best == end - 1)
+                return 0;
+
+            // The maximum should be the only inflection point.  Allow some points to
+            // vote against it, so noise does not rule it out.
+            uint32_t failPoints = 0;
+            for(uint32_t i = start; i < end; i++) {
+                const double d = smoothDeriv(h, i);
+                if ((i < best && d < 0.0) || (i > best && d > 0.0)) failPoints++;
+            }
+
+            if ((double)failPoints / (2 * radius + 1) > 0.1)
+                return 0;
+
+            if (sum < std::min((double)minPerc / 100.0 * totalElements(), (double)minElem))
+                return 0;
+
+            return best;
+        }
+
+        /**
+         * Adds a peak at the given multiplicity, unless there is already one close to
+         * it, and recalculates the range each peak is fitted over
+         * @param reset Recreate all peaks from their means, discarding any fitting
+         * @return True if the peak was added
+         */
+        bool addPeakAndUpdateCuts(uint32_t lm, bool reset) {
+
+            vector<double> means;
+            for(const auto& p : peaks) {
+                if (lm >= p.mean - p.mean / 5.0 && lm <= p.mean + p.mean / 5.0)
+                    return false;
+                means.push_back(p.mean);
+            }
+
+            means.push_back(lm);
+            std::sort(means.begin(), means.end());
+
+            cuts.clear();
+            cuts.push_back(fmin);
+            for(size_t i = 0; i + 1 < means.size(); i++) {
+                cuts.push_back((uint32_t)(means[i] * (1.0 + means[i] / (means[i] + means[i + 1]))));
+            }
+            cuts.push_back((uint32_t)std::min(histogram.size() - 1.0, means.back() * 1.5));
+
+            if (reset) {
+                peaks.clear();
+            }
+
+            for(size_t i = 0; i < means.size(); i++) {
+                if (reset || means[i] == lm) {
+                    double elements = 0.0;
+                    for(uint32_t x = cuts[i]; x < cuts[i + 1]; x++) elements += histogram[x];
+                    peaks.push_back(KmerPeak(means[i], means[i] / 6.0, elements));
+                }
+            }
+
+            std::sort(peaks.begin(), peaks.end(), [](const KmerPeak& a, const KmerPeak& b) { return a.mean < b.mean; });
+
+            return true;
+        }
+
+        /**
+         * Multiplicities to look for peaks at: fractions and multiples of the global maximum
+         */
+        vector<uint32_t> candidates() const {
+            vector<uint32_t> c = { fmax / 4, fmax / 3, fmax / 2, fmax, fmax * 2, fmax * 3, fmax * 4 };
+            return c;
+        }
+
+        void createPeaks() {
+
+            // Walk to the first local minimum, before which K-mers are mostly errors
+            fmin = 0;
+            for(uint32_t i = 1; i + 1 < histogram.size(); i++) {
+                if (histogram[i] < histogram[i + 1]) {
+                    fmin = i;
+                    break;
+                }
+            }
+
+            if (fmin == 0)
+                return;
+
+            fmax = std::max_element(histogram.begin() + fmin, histogram.end()) - histogram.begin();
+
+            if (fmax < 10)
+                return;
+
+            for(uint32_t f : candidates()) {
+                if (f / 5 > 0 && f + f / 5 < histogram.size()) {
+                    uint32_t lm = findMaxima(f, f / 5, histogram);
+                    if (lm)
+                        addPeakAndUpdateCuts(lm, true);
+                }
+            }
+        }
+
+        /**
+         * Fits each peak on its own, largest first, against what the larger peaks
+         * leave unexplained.  Repeats if this reveals further peaks.
+         */
+        void optimisePeaks() {
+
+            // Each round adds a peak near one of a fixed set of candidates, so this
+            // only guards against pathological input
+            for(uint16_t round = 0; round < 10; round++) {
+
+                vector<size_t> order(peaks.size());
+                for(size_t i = 0; i < order.size(); i++) order[i] = i;
+                std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return peaks[a].elements > peaks[b].elements; });
+
+                vector<double> base = histogram;
+                for(size_t i : order) {
+
+                    vector<KmerPeak> single(1, peaks[i]);
+                    fitPeaks(single, base, cuts[i], cuts[i + 1]);
+                    peaks[i] = single[0];
+
+                    for(size_t x = 0; x < base.size(); x++) {
+                        base[x] -= peaks[i].point(x);
+                    }
+                }
+
+                const double total = totalElements();
+                bool updated = false;
+                for(uint32_t f : candidates()) {
+                    if (f / 5 > 0 && f + f / 5 < histogram.size()) {
+
+                        double remaining = 0.0;
+                        for(uint32_t x = f - f / 5; x < f + f / 5; x++) remaining += base[x];
+
+                        if (remaining > 0.01 * total) {
+                            uint32_t lm = findMaxima(f, f / 5, base);
+                            if (lm && addPeakAndUpdateCuts(lm, false))
+                                updated = true;
+                        }
+                    }
+                }
+
+                if (!updated)
+                    break;
+            }
+        }
+
+        void optimiseOverall() {
+            fitPeaks(peaks, histogram, cuts.front(), cuts.back());
+        }
+
+        /**
+         * Weighted residuals of the peaks against the target over [from, to), and
+         * optionally the Jacobian of the residuals with respect to each peak's
+         * mean, standard deviation and elements
+         * @return Sum of squared weighted residuals
+         */
+        static double residuals(const vector<KmerPeak>& pks, const vector<double>& target, uint32_t from, uint32_t to,
+                vector<double>* jtj, vector<double>* jtr) {
+
+            const size_t n = pks.size() * 3;
+            vector<double> grad(n);
+            double cost = 0.0;
+
+            if (jtj) {
+                jtj->assign(n * n, 0.0);
+                jtr->assign(n, 0.0);
+            }
+
+            for(uint32_t x = from; x < to; x++) {
+
+                double model = 0.0;
+                for(size_t p = 0; p < pks.size(); p++) {
+
+                    const KmerPeak& pk = pks[p];
+                    const double y = pk.point(x);
+                    model += y;
+
+                    if (jtj) {
+                        const double d = x - pk.mean;
+                        const double s2 = pk.stddev * pk.stddev;
+                        grad[p * 3] = y * d / s2;
+                        grad[p * 3 + 1] = y * (d * d / (s2 * pk.stddev) - 1.0 / pk.stddev);
+                        grad[p * 3 + 2] = pk.elements > 0.0 ? y / pk.elements : 0.0;
+                    }
+                }
+
+                // Overshooting the spectrum costs twice as much as undershooting it
+                const double w = model > target[x] ? 2.0 : 1.0;
+                const double r = w * (model - target[x]);
+                cost += r * r;
+
+                if (jtj) {
+                    for(size_t i = 0; i < n; i++) {
+                        const double gi = w * grad[i];
+                        (*jtr)[i] += gi * r;
+                        for(size_t j = 0; j <= i; j++) {
+                            (*jtj)[i * n + j] += gi * w * grad[j];
+                        }
+                    }
+                }
+            }
+
+            if (jtj) {
+                for(size_t i = 0; i < n; i++) {
+                    for(size_t j = 0; j < i; j++) {
+                        (*jtj)[j * n + i] = (*jtj)[i * n + j];
+                    }
+                }
+            }
+
+            return cost;
+        }
+
+        /**
+         * Solves a * x = b in place by Gaussian elimination with partial pivoting
+         * @return False if the system is singular
+         */
+        static bool solve(vector<double>& a, vector<double>& b) {
+
+            const size_t n = b.size();
+
+            for(size_t c = 0; c < n; c++) {
+
+                size_t pivot = c;
+                for(size_t r = c + 1; r < n; r++) {
+                    if (fabs(a[r * n + c]) > fabs(a[pivot * n + c])) pivot = r;
+                }
+
+                if (a[pivot * n + c] == 0.0)
+                    return false;
+
+                if (pivot != c) {
+                    for(size_t j = 0; j < n; j++) std::swap(a[c * n + j], a[pivot * n + j]);
+                    std::swap(b[c], b[pivot]);
+                }
+
+                for(size_t r = c + 1; r < n; r++) {
+                    const double f = a[r * n + c] / a[c * n + c];
+                    for(size_t j = c; j < n; j++) a[r * n + j] -= f * a[c * n + j];
+                    b[r] -= f * b[c];
+                }
+            }
+
+            for(size_t c = n; c-- > 0;) {
+                for(size_t j = c + 1; j < n; j++) b[c] -= a[c * n + j] * b[j];
+                b[c] /= a[c * n + c];
+            }
+
+            return true;
+        }
+
+        /**
+         * Least squares fit of the peaks to the target over [from, to) by Levenberg-Marquardt
+         */
+        static void fitPeaks(vector<KmerPeak>& pks, const vector<double>& target, uint32_t from, uint32_t to) {
+
+            if (pks.empty() || from >= to)
+                return;
+
+            const size_t n = pks.size() * 3;
+            vector<double> jtj, jtr;
+            double cost = residuals(pks, target, from, to, &jtj, &jtr);
+            double lambda = 1e-3;
+
+            for(uint16_t iter = 0; iter < MAX_ITERATIONS; iter++) {
+
+                bool improved = false;
+
+                while (lambda < 1e12) {
+
+                    // Damp each parameter in proportion to its own curvature, as the
+                    // parameters are on very different scales
+                    vector<double> a = jtj;
+                    vector<double> step(n);
+                    for(size_t i = 0; i < n; i++) {
+                        a[i * n + i] += lambda * std::max(jtj[i * n + i], 1e-12);
+                        step[i] = -jtr[i];
+                    }
+
+                    vector<KmerPeak> trial = pks;
+                    bool valid = solve(a, step);
+                    for(size_t p = 0; valid && p < trial.size(); p++) {
+                        trial[p].mean += step[p * 3];
+                        trial[p].stddev += step[p * 3 + 1];
+                        trial[p].elements += step[p * 3 + 2];
+                        valid = trial[p].mean > 0.0 && trial[p].stddev > 0.0 && trial[p].elements >= 0.0;
+                    }
+
+                    if (valid) {
+                        const double trialCost = residuals(trial, target, from, to, nullptr, nullptr);
+                        if (trialCost < cost) {
+                            const double gain = cost - trialCost;
+                            pks = trial;
+                            cost = residuals(pks, target, from, to, &jtj, &jtr);
+                            lambda = std::max(lambda / 10.0, 1e-12);
+                            improved = gain > 1e-10 * trialCost;
+                            break;
+                        }
+                    }
+
+                    lambda *= 10.0;
+                }
+
+                if (!improved)
+                    break;
+            }
+        }
+    };
+}
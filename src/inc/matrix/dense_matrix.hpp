@@ -0,0 +1,354 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <boost/exception/all.hpp>
+#include <boost/lexical_cast.hpp>
+using boost::lexical_cast;
+
+using std::endl;
+using std::ostream;
+using std::string;
+using std::thread;
+using std::vector;
+
+/**
+ * Matrix held in a single contiguous array in row-major order, with the same
+ * interface as SparseMatrix.  The matrices KAT builds are small and mostly filled,
+ * so incrementing a cell is a single indexed add and merging two matrices is a
+ * plain array sum, rather than tree searches and node allocations.
+ *
+ * Storage is only allocated when a cell is first changed, so matrices that are
+ * never used, such as those for threads that found nothing, cost nothing.
+ */
+template <class T>
+class DenseMatrix {
+public:
+
+    typedef boost::error_info<struct DenseMatrixError,string> DenseMatrixErrorInfo;
+    struct DenseMatrixException: virtual boost::exception, virtual std::exception { };
+
+    DenseMatrix() : DenseMatrix(0) {}
+
+    DenseMatrix(uint32_t i) : DenseMatrix(i, i) {}
+
+    DenseMatrix(uint32_t i, uint32_t j) : m(i), n(j) {}
+
+    T operator()(uint32_t i, uint32_t j) const {
+        return get(i, j);
+    }
+
+    /**
+     * Adds to a cell.  Cells outside the matrix are ignored, as they can never be
+     * read or printed.
+     */
+    T inc(uint32_t i, uint32_t j, T val) {
+        if (i >= m || j >= n) {
+            return 0;
+        }
+        allocate();
+        T& cell = mat[(size_t)i * n + j];
+        cell += val;
+        return cell;
+    }
+
+    /**
+     * Reference to a cell, allocating storage if this is the first change.  The
+     * coordinates must be inside the matrix.
+     */
+    T& at(uint32_t i, uint32_t j) {
+        allocate();
+        return mat[(size_t)i * n + j];
+    }
+
+    /**
+     * Adds every cell of another matrix of the same size to this one
+     * @param other Matrix to add into this one
+     */
+    void merge(const DenseMatrix& other) {
+        if (other.mat.empty()) {
+            return;
+        }
+        if (mat.empty()) {
+            mat = other.mat;
+            return;
+        }
+
+        addCells(mat.data(), other.mat.data(), mat.size());
+    }
+
+    /**
+     * Adds every cell of several other matrices of the same size to this one.  The
+     * rows are split into blocks, and each block is summed across all the matrices by
+     * its own thread, so threads never write to the same cells.  The other matrices
+     * may hold a narrower type than this one.
+     * @param others Matrices to add into this one
+     * @param threads Number of threads to use
+     */
+    template <class U>
+    void merge(const vector<const DenseMatrix<U>*>& others, uint16_t threads) {
+
+        vector<const U*> from;
+        for (const DenseMatrix<U>* o : others) {
+            if (!o->mat.empty()) {
+                from.push_back(o->mat.data());
+            }
+        }
+
+        if (from.empty()) {
+            return;
+        }
+        allocate();
+
+        const uint32_t nbBlocks = std::max<uint32_t>(1, std::min<uint32_t>(threads, m));
+        T* into = mat.data();
+        const size_t rowLen = n;
+        const uint32_t rows = m;
+
+        auto sumBlock = [into, &from, rowLen, rows, nbBlocks](uint32_t b) {
+            const size_t first = (size_t)rows * b / nbBlocks * rowLen;
+            const size_t last = (size_t)rows * (b + 1) / nbBlocks * rowLen;
+            for (const U* f : from) {
+                addCells(into + first, f + first, last - first);
+            }
+        };
+
+        vector<thread> workers;
+        for (uint32_t b = 1; b < nbBlocks; b++) {
+            workers.push_back(thread(sumBlock, b));
+        }
+        sumBlock(0);
+
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    /**
+     * Whether any cell has been changed since the matrix was created
+     */
+    bool isAllocated() const {
+        return !mat.empty();
+    }
+
+    T get(uint32_t i, uint32_t j) const {
+        if (i >= m || j >= n) {
+            BOOST_THROW_EXCEPTION(DenseMatrixException() << DenseMatrixErrorInfo(string(
+                    "Requested coords exceed limits of matrix.  Coords: ") +
+                    lexical_cast<string>(i) + "," + lexical_cast<string>(j) + ".  Limits: " +
+                    lexical_cast<string>(m) + "," + lexical_cast<string>(n)));
+        }
+        return mat.empty() ? 0 : mat[(size_t)i * n + j];
+    }
+
+    /**
+     * Multiplies every cell in the matrix by the given factor, rounding to the nearest
+     * whole value.  Useful for turning counts from a subsample into estimates for
+     * the full dataset.
+     * @param factor Multiplier to apply to each cell
+     */
+    void scale(double factor) {
+        for (T& cell : mat) {
+            cell = (T)llround((double)cell * factor);
+        }
+    }
+
+    uint32_t width() const {
+        return m;
+    }
+
+    uint32_t height() const {
+        return n;
+    }
+
+    T getMaxVal() const {
+        return mat.empty() ? 0 : *std::max_element(mat.begin(), mat.end());
+    }
+
+    void getRow(uint32_t row_idx, vector<T>& row) const {
+        for (uint32_t i = 0; i < this->height(); i++) {
+            row.push_back(cell(i, row_idx));
+        }
+    }
+
+    void getColumn(uint32_t col_idx, vector<T>& col) const {
+        for (uint32_t i = 0; i < this->width(); i++) {
+            col.push_back(cell(col_idx, i));
+        }
+    }
+
+    T sumColumn(uint32_t col_idx) const {
+        return sumColumn(col_idx, 0, this->width() - 1);
+    }
+
+    T sumColumn(uint32_t col_idx, uint32_t start, uint32_t end) const {
+        T sum = 0;
+        for (uint32_t i = start; i <= end; i++) {
+            sum += cell(col_idx, i);
+        }
+
+        return sum;
+    }
+
+    T sumRow(uint32_t row_idx) const {
+        return sumRow(row_idx, 0, this->height() - 1);
+    }
+
+    T sumRow(uint32_t row_idx, uint32_t start, uint32_t end) const {
+        T sum = 0;
+        for (uint32_t i = start; i <= end; i++) {
+            sum += cell(i, row_idx);
+        }
+
+        return sum;
+    }
+
+    void printMatrix(ostream &out) const {
+        printMatrix(out, false);
+    }
+
+    void printMatrix(ostream &out, bool transpose) const {
+        if (transpose) {
+            // Transpose matrix
+            for (uint32_t i = 0; i < n; i++) {
+
+                out << get(0, i);
+
+                for (uint32_t j = 0; j < m; j++) {
+                    out << " " << get(j, i);
+                }
+
+                out << endl;
+            }
+        } else {
+            for (uint32_t i = 0; i < m; i++) {
+                out << get(i, 0);
+
+                for (uint32_t j = 1; j < n; j++) {
+                    out << " " << get(i, j);
+                }
+
+                out << endl;
+            }
+        }
+    }
+
+    /**
+     * Adds count values from one array into another
+     */
+    template <class U>
+    static void addCells(T* into, const U* from, size_t count) {
+        for (size_t k = 0; k < count; k++) {
+            into[k] += from[k];
+        }
+    }
+
+private:
+
+    template <class U> friend class DenseMatrix;
+
+    void allocate() {
+        if (mat.empty()) {
+            mat.assign((size_t)m * n, 0);
+        }
+    }
+
+    /**
+     * Value of a cell, or 0 for cells outside the matrix
+     */
+    T cell(uint32_t i, uint32_t j) const {
+        return mat.empty() || i >= m || j >= n ? 0 : mat[(size_t)i * n + j];
+    }
+
+    vector<T> mat;
+    uint32_t m;
+    uint32_t n;
+};
+
+/**
+ * Counts are summed with AVX2 or SSE2 adds when the compiler targets them
+ */
+template <>
+template <>
+inline void DenseMatrix<uint64_t>::addCells(uint64_t* into, const uint64_t* from, size_t count) {
+
+    size_t k = 0;
+
+#if defined(__AVX2__)
+    for (; k + 4 <= count; k += 4) {
+        const __m256i a = _mm256_loadu_si256((const __m256i*)(into + k));
+        const __m256i b = _mm256_loadu_si256((const __m256i*)(from + k));
+        _mm256_storeu_si256((__m256i*)(into + k), _mm256_add_epi64(a, b));
+    }
+#elif defined(__SSE2__)
+    for (; k + 2 <= count; k += 2) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(into + k));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(from + k));
+        _mm_storeu_si128((__m128i*)(into + k), _mm_add_epi64(a, b));
+    }
+#endif
+
+    for (; k < count; k++) {
+        into[k] += from[k];
+    }
+}
+
+/**
+ * As above, widening each 32 bit count to 64 bits before adding it
+ */
+template <>
+template <>
+inline void DenseMatrix<uint64_t>::addCells(uint64_t* into, const uint32_t* from, size_t count) {
+
+    size_t k = 0;
+
+#if defined(__AVX2__)
+    for (; k + 4 <= count; k += 4) {
+        const __m256i a = _mm256_loadu_si256((const __m256i*)(into + k));
+        const __m256i b = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)(from + k)));
+        _mm256_storeu_si256((__m256i*)(into + k), _mm256_add_epi64(a, b));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; k + 4 <= count; k += 4) {
+        const __m128i b = _mm_loadu_si128((const __m128i*)(from + k));
+        const __m128i a0 = _mm_loadu_si128((const __m128i*)(into + k));
+        const __m128i a1 = _mm_loadu_si128((const __m128i*)(into + k + 2));
+        _mm_storeu_si128((__m128i*)(into + k), _mm_add_epi64(a0, _mm_unpacklo_epi32(b, zero)));
+        _mm_storeu_si128((__m128i*)(into + k + 2), _mm_add_epi64(a1, _mm_unpackhi_epi32(b, zero)));
+    }
+#endif
+
+    for (; k < count; k++) {
+        into[k] += from[k];
+    }
+}
@@ -37,6 +37,7 @@ namespace mme {
     const string KEY_TITLE = "# Title:";
     const string KEY_MAX_VAL = "# MaxVal:";
     const string KEY_TRANSPOSE = "# Transpose:";
+    const string KEY_SAMPLE_FRACTION = "# SampleFraction:";
     const string MX_META_END = "###";
 
     void trim(string& str);
@@ -18,22 +18,56 @@
 #pragma once
 
 #include <stdint.h>
+#include <limits>
 #include <memory>
+#include <vector>
 using std::shared_ptr;
+using std::vector;
+
+#include "dense_matrix.hpp"
+#include "inc/thread_slots.hpp"
+using kat::ThreadSlots;
+
+// The matrices built during analysis are dense in practice, so are held as flat
+// arrays.  SparseMatrix is still used for loading matrices from file.
+typedef DenseMatrix<uint64_t> SM64;
+
+/**
+ * A matrix built by several threads at once.  Each thread adds to its own copy,
+ * and the copies are summed into a final matrix once all threads are done.
+ *
+ * A full matrix is allocated for every thread that uses it, so memory grows with
+ * the number of threads.  To bound this, thread copies hold 32 bit cells: 4 MB for
+ * the 1001 x 1001 matrices comp uses by default, rather than 8 MB.  A cell that
+ * would exceed 32 bits moves its count into a short list of spilled counts for
+ * that thread, which is added to the 64 bit final matrix along with the rest.
+ */
+class ThreadedSparseMatrix {
+private:
 
-#include "sparse_matrix.hpp"
+    /**
+     * Count taken out of a thread's cell before it could wrap
+     */
+    struct Spill {
+        uint32_t i;
+        uint32_t j;
+        uint64_t count;
+    };
 
-typedef SparseMatrix<uint64_t> SM64;
+    struct ThreadMatrix {
+        DenseMatrix<uint32_t> cells;
+        vector<Spill> spilled;
 
-class ThreadedSparseMatrix {
-private:
+        ThreadMatrix() {}
+        ThreadMatrix(uint32_t width, uint32_t height) : cells(width, height) {}
+    };
 
     uint16_t width;
     uint16_t height;
     uint16_t threads;
 
     SM64 final_matrix;
-    vector<SM64> threaded_matricies;
+    ThreadSlots<ThreadMatrix> threaded_matricies;
 
 public:
 
@@ -42,11 +76,7 @@ public:
     ThreadedSparseMatrix(uint16_t _width, uint16_t _height, uint16_t _threads) :
     width(_width), height(_height), threads(_threads) {
         final_matrix = SM64(width, height);
-        threaded_matricies = vector<SM64>(threads);
-
-        for (int i = 0; i < threads; i++) {
-            threaded_matricies[i] = SM64(width, height);
-        }
+        threaded_matricies = ThreadSlots<ThreadMatrix>(threads, ThreadMatrix(width, height));
     }
 
     virtual ~ThreadedSparseMatrix() {
@@ -56,25 +86,62 @@ public:
         return final_matrix;
     }
 
-    const SM64& getThreadMatrix(uint16_t index) const {
-        return threaded_matricies[index];
+    /**
+     * Cells of the given thread's matrix, not including any spilled counts
+     */
+    const DenseMatrix<uint32_t>& getThreadMatrix(uint16_t index) const {
+        return threaded_matricies[index].cells;
     }
 
+    /**
+     * Sums the thread matrices into the final matrix, using a thread for each block
+     * of rows.  The thread matrices are left unchanged.
+     */
     const SM64& mergeThreadedMatricies() {
-        // Merge matrix
-        for (int i = 0; i < width; i++) {
-            for (int j = 0; j < height; j++) {
-                for (int k = 0; k < threads; k++) {
-                    final_matrix.inc(i, j, threaded_matricies[k].get(i, j));
-                }
+        
+        vector<const DenseMatrix<uint32_t>*> parts;
+        for (size_t i = 0; i < threaded_matricies.size(); i++) {
+            parts.push_back(&threaded_matricies[i].cells);
+        }
+        
+        final_matrix.merge(parts, threads);
+
+        for (size_t i = 0; i < threaded_matricies.size(); i++) {
+            for (const Spill& s : threaded_matricies[i].spilled) {
+                final_matrix.inc(s.i, s.j, s.count);
             }
         }
 
         return final_matrix;
     }
     
-    uint64_t incTM(uint16_t index, size_t i, size_t j, uint64_t val) {
-        return threaded_matricies[index].inc(i, j, val);
+    /**
+     * Scales the merged matrix by the given factor.  Call after mergeThreadedMatricies.
+     */
+    const SM64& scaleFinalMatrix(double factor) {
+        final_matrix.scale(factor);
+        return final_matrix;
+    }
+    
+    /**
+     * Adds to a cell of the given thread's matrix.  Cells outside the matrix are ignored.
+     */
+    void incTM(uint16_t index, size_t i, size_t j, uint64_t val) {
+        
+        if (i >= width || j >= height) {
+            return;
+        }
+        
+        ThreadMatrix& tm = threaded_matricies[index];
+        uint32_t& cell = tm.cells.at(i, j);
+        
+        if (val > std::numeric_limits<uint32_t>::max() - cell) {
+            tm.spilled.push_back(Spill{(uint32_t)i, (uint32_t)j, cell + val});
+            cell = 0;
+        }
+        else {
+            cell += val;
+        }
     }
 
 };
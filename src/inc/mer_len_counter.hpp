@@ -0,0 +1,354 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+#include <jellyfish/hash_counter.hpp>
+#include <jellyfish/mer_dna.hpp>
+#include <jellyfish/whole_sequence_parser.hpp>
+
+#include "../jellyfish_helper.hpp"
+#include "spectrum_table.hpp"
+
+namespace kat {
+
+    /**
+     * Batches of whole reads waiting to be counted by one group of threads.  At most
+     * capacity batches are held, so a slow group holds up the reader rather than
+     * letting reads pile up in memory.  Once closed, waiting threads are released
+     * and any further batches are dropped.
+     *
+     * Each batch is one of the read parser's own buffers, shared by every group that
+     * counts it, and handed back to the parser once the last of them lets go of it.
+     */
+    class ReadBatchQueue {
+    public:
+
+        typedef shared_ptr<const jellyfish::sequence_list> Batch;
+
+    private:
+
+        std::mutex mu;
+        std::condition_variable cv;
+        std::deque<Batch> batches;
+        size_t capacity;
+        bool closed;
+
+    public:
+
+        ReadBatchQueue(size_t _capacity) : capacity(_capacity), closed(false) {}
+
+        size_t getCapacity() const {
+            return capacity;
+        }
+
+        void push(const Batch& batch) {
+            std::unique_lock<std::mutex> lk(mu);
+            cv.wait(lk, [this]() { return closed || batches.size() < capacity; });
+            if (!closed) {
+                batches.push_back(batch);
+                cv.notify_all();
+            }
+        }
+
+        /**
+         * Takes the next batch, waiting for one if necessary
+         * @return False once the queue is closed and empty
+         */
+        bool pop(Batch& batch) {
+            std::unique_lock<std::mutex> lk(mu);
+            cv.wait(lk, [this]() { return closed || !batches.empty(); });
+            if (batches.empty()) {
+                return false;
+            }
+            batch = batches.front();
+            batches.pop_front();
+            cv.notify_all();
+            return true;
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> lk(mu);
+            closed = true;
+            cv.notify_all();
+        }
+
+        /**
+         * Drops any batches still queued, such as those left when counting fails
+         */
+        void clear() {
+            std::lock_guard<std::mutex> lk(mu);
+            batches.clear();
+            cv.notify_all();
+        }
+    };
+
+    /**
+     * Counts K-mers of one length from batches of whole reads into a jellyfish hash,
+     * then reduces the hash to a SpectrumTable tagged with GC counts.  Several of
+     * these can count K-mers of different lengths from the same reads at once.
+     *
+     * The length of a mer_dna is static, so each K-mer length is counted with its
+     * own mer type, from a different class index of mer_base_static.  Each also has
+     * its own group of threads: jellyfish grows a full hash cooperatively, stopping
+     * every thread that adds to it, so threads shared between hashes could end up
+     * waiting on each other's hashes for ever.
+     */
+    class MerLenCounter {
+    public:
+
+        // Number of mer types available, and so the most lengths that can be counted at once
+        static const uint16_t MAX_MER_LENS = 8;
+
+    protected:
+
+        ReadBatchQueue queue;
+        uint16_t merLen;
+        bool canonical;
+        bool disableHashGrow;
+        uint16_t threads;
+        vector<thread> workers;
+        vector<SpectrumTable> tables;       // One per thread
+        std::exception_ptr error;
+        std::mutex errorMu;
+
+        MerLenCounter(uint16_t _merLen, bool _canonical, bool _disableHashGrow, uint16_t _threads) :
+            queue(4 * _threads), merLen(_merLen), canonical(_canonical), disableHashGrow(_disableHashGrow), 
+            threads(_threads), tables(_threads) {}
+
+        /**
+         * Frees the hash once its K-mers have been tabulated
+         */
+        virtual void release() = 0;
+
+        void setError(std::exception_ptr e) {
+            std::lock_guard<std::mutex> lk(errorMu);
+            if (!error) error = e;
+            queue.close();
+        }
+
+    public:
+
+        virtual ~MerLenCounter() {}
+
+        /**
+         * Creates a counter for the given K-mer length
+         * @param index Position of this length among those being counted, which
+         * selects the mer type to use.  Must be less than MAX_MER_LENS.
+         * @param disableHashGrow Fail rather than double the hash when it fills
+         */
+        static unique_ptr<MerLenCounter> create(uint16_t index, uint16_t merLen, bool canonical, uint64_t hashSize, 
+                bool disableHashGrow, uint16_t threads);
+
+        uint16_t getMerLen() const {
+            return merLen;
+        }
+
+        /**
+         * The most batches this counter holds at once: a full queue, plus one being
+         * counted by each thread
+         */
+        size_t getMaxBatches() const {
+            return queue.getCapacity() + threads;
+        }
+
+        /**
+         * Whether a counting thread has failed, in which case any further batches are
+         * dropped and the error is passed on by finish
+         */
+        bool failed() {
+            std::lock_guard<std::mutex> lk(errorMu);
+            return (bool)error;
+        }
+
+        /**
+         * Starts the counting threads, which wait for reads to be added
+         */
+        virtual void start() = 0;
+
+        /**
+         * Queues a batch of reads to be counted, waiting if too many are already queued
+         */
+        void add(const ReadBatchQueue::Batch& batch) {
+            queue.push(batch);
+        }
+
+        /**
+         * Counts the remaining reads and waits for the threads to finish.  No batches
+         * are held once this returns.  Errors from the counting threads are passed on 
+         * here.
+         * @return The number of distinct K-mers with each count and GC count
+         */
+        shared_ptr<SpectrumTable> finish() {
+
+            queue.close();
+            for(auto& w : workers) {
+                w.join();
+            }
+            workers.clear();
+            queue.clear();
+            release();
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+
+            shared_ptr<SpectrumTable> table = make_shared<SpectrumTable>();
+            for(const SpectrumTable& t : tables) {
+                table->merge(t);
+            }
+            tables.clear();
+            return table;
+        }
+    };
+
+    template<int CI>
+    class StaticMerLenCounter : public MerLenCounter {
+    private:
+
+        typedef jellyfish::mer_dna_ns::mer_base_static<uint64_t, CI> Mer;
+        typedef jellyfish::cooperative::hash_counter<Mer> Counter;
+
+        unique_ptr<Counter> counter;
+
+    public:
+
+        StaticMerLenCounter(uint16_t _merLen, bool _canonical, uint64_t hashSize, bool _disableHashGrow, uint16_t _threads) :
+            MerLenCounter(_merLen, _canonical, _disableHashGrow, _threads) {
+            Mer::k(merLen);
+            counter = unique_ptr<Counter>(new Counter(hashSize, merLen * 2, 7, threads));
+            counter->do_size_doubling(!disableHashGrow);
+        }
+
+        void start() {
+            for(uint16_t i = 0; i < threads; i++) {
+                workers.push_back(thread(&StaticMerLenCounter::countSlice, this, i));
+            }
+        }
+
+    protected:
+
+        void release() {
+            counter.reset();
+        }
+
+    private:
+
+        /**
+         * Tells the hash that a failed thread has stopped adding to it.  Every thread of
+         * the hash waits in done until all of them have called it, so a thread that
+         * fails must still call it.  A hash that cannot grow fails in all of its threads
+         * at once, including any already waiting in done, so each keeps calling done
+         * until they have all caught up.
+         */
+        void abandon() {
+            while(true) {
+                try {
+                    counter->done();
+                    return;
+                }
+                catch(...) {}
+            }
+        }
+
+        void countSlice(uint16_t th_id) {
+
+            bool adding = true;
+
+            try {
+                Mer m;
+                Mer rcm;
+                ReadBatchQueue::Batch batch;
+
+                while (queue.pop(batch)) {
+                    for(size_t r = 0; r < batch->nb_filled; r++) {
+
+                        const string& seq = batch->data[r].seq;
+                        unsigned int filled = 0;
+
+                        for(const char c : seq) {
+                            const int code = Mer::code(c);
+                            if (code < 0) {
+                                filled = 0;
+                                continue;
+                            }
+
+                            m.shift_left(code);
+                            if (canonical)
+                                rcm.shift_right(Mer::complement(code));
+
+                            if (filled < merLen)
+                                filled++;
+
+                            if (filled == merLen)
+                                counter->add(!canonical || m < rcm ? m : rcm, 1);
+                        }
+                    }
+                }
+                batch.reset();
+
+                counter->done();
+                adding = false;
+
+                // Every thread has stopped adding once done returns, so the hash can be read
+                SpectrumTable& table = tables[th_id];
+                typename Counter::array::region_iterator it = counter->ary()->region_slice(th_id, threads);
+                while (it.next()) {
+                    table.add(it.val(), JellyfishHelper::gcCount(it.key()));
+                }
+            }
+            catch(...) {
+                setError(std::current_exception());
+                if (adding) abandon();
+            }
+        }
+    };
+
+    inline unique_ptr<MerLenCounter> MerLenCounter::create(uint16_t index, uint16_t merLen, bool canonical, uint64_t hashSize, 
+            bool disableHashGrow, uint16_t threads) {
+
+        // Class index 0 is mer_dna itself
+        switch(index) {
+            case 0: return unique_ptr<MerLenCounter>(new StaticMerLenCounter<1>(merLen, canonical, hashSize, disableHashGrow, threads));
+            case 1: return unique_ptr<MerLenCounter>(new StaticMerLenCounter<2>(merLen, canonical, hashSize, disableHashGrow, threads));
+            case 2: return unique_ptr<MerLenCounter>(new StaticMerLenCounter<3>(merLen, canonical, hashSize, disableHashGrow, threads));
+            case 3: return unique_ptr<MerLenCounter>(new StaticMerLenCounter<4>(merLen, canonical, hashSize, disableHashGrow, threads));
+            case 4: return unique_ptr<MerLenCounter>(new StaticMerLenCounter<5>(merLen, canonical, hashSize, disableHashGrow, threads));
+            case 5: return unique_ptr<MerLenCounter>(new StaticMerLenCounter<6>(merLen, canonical, hashSize, disableHashGrow, threads));
+            case 6: return unique_ptr<MerLenCounter>(new StaticMerLenCounter<7>(merLen, canonical, hashSize, disableHashGrow, threads));
+            case 7: return unique_ptr<MerLenCounter>(new StaticMerLenCounter<8>(merLen, canonical, hashSize, disableHashGrow, threads));
+        }
+
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "Too many K-mer lengths.  At most ") + lexical_cast<string>((uint32_t)MAX_MER_LENS) + " can be counted at once."));
+    }
+}
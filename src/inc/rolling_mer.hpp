@@ -0,0 +1,117 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+
+#include <jellyfish/mer_dna.hpp>
+using jellyfish::mer_dna;
+
+namespace kat {
+
+    /**
+     * Maintains the forward and reverse complement 2-bit encodings of the K-mer ending
+     * at the current position of a sequence.  Each base pushed shifts one code into
+     * both words, so walking a sequence of length L costs O(L) rather than re-parsing
+     * every K-mer.  Only upper case A, C, G and T are valid; any other character
+     * invalidates the K-mers that overlap it.  The K-mer length is taken from
+     * mer_dna::k(), which must be set before constructing this object.
+     */
+    class RollingMer {
+    private:
+
+        mer_dna fwd;
+        mer_dna rev;
+        uint16_t k;
+        uint16_t nbValid;     // Number of consecutive valid bases ending at the current position
+
+    public:
+
+        RollingMer() : k(mer_dna::k()), nbValid(0) {}
+
+        /**
+         * Forget all bases pushed so far, for example at the start of a new sequence
+         */
+        void reset() {
+            nbValid = 0;
+        }
+
+        /**
+         * Adds the next base of the sequence
+         * @param c The base
+         * @return True if the K-mer ending at this base is valid
+         */
+        bool push(char c) {
+
+            const int code = encode(c);
+
+            if (code < 0) {
+                nbValid = 0;
+                return false;
+            }
+
+            fwd.shift_left(code);
+            rev.shift_right(3 - code);
+
+            if (nbValid < k) nbValid++;
+
+            return nbValid == k;
+        }
+
+        /**
+         * Whether or not the current K-mer is valid
+         */
+        bool valid() const {
+            return nbValid == k;
+        }
+
+        const mer_dna& forward() const {
+            return fwd;
+        }
+
+        const mer_dna& reverseComplement() const {
+            return rev;
+        }
+
+        /**
+         * The canonical form of the current K-mer, defined in the same way as
+         * mer_dna::get_canonical
+         */
+        const mer_dna& canonical() const {
+            return rev < fwd ? rev : fwd;
+        }
+
+        const mer_dna& get(bool canonical) const {
+            return canonical ? this->canonical() : fwd;
+        }
+
+        /**
+         * 2-bit code for a base, using the same codes as jellyfish, or -1 if the
+         * base is not an upper case A, C, G or T
+         */
+        static int encode(char c) {
+            switch(c) {
+                case 'A': return 0;
+                case 'C': return 1;
+                case 'G': return 2;
+                case 'T': return 3;
+                default: return -1;
+            }
+        }
+    };
+}
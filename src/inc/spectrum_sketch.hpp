@@ -0,0 +1,283 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+namespace kat {
+
+    const uint64_t DEFAULT_SKETCH_SIZE = 1 << 23;     // About 200MB
+
+    /**
+     * Estimates the K-mer frequency spectrum and number of distinct K-mers in bounded
+     * memory, without counting every K-mer.  K-mers are represented by a well mixed
+     * hash, and only those whose hash falls at or below a threshold are counted,
+     * exactly.  Every occurrence of a sampled K-mer is counted, so the spectrum of
+     * the sample has the same shape as the full spectrum, scaled by the fraction of
+     * hash space sampled.
+     *
+     * The table starts by counting everything.  Whenever it fills up the threshold
+     * is halved and K-mers above it are dropped, so the sample adapts to the number
+     * of distinct K-mers in the input.  K-mers that remain were below every earlier
+     * threshold, so their counts are still exact.
+     *
+     * The table is split into shards by the low bits of the hash, each with its own
+     * lock and threshold, so that many threads can add to it at once.  Each shard is
+     * an independent sample of its part of hash space and is scaled separately.
+     * Threads should collect hashes in a Buffer, which hands them over a block at a time.
+     *
+     * Each K-mer can optionally carry a small tag, such as its GC count, which is
+     * kept alongside its count.  The tag must be a function of the K-mer.
+     */
+    class SpectrumSketch {
+    private:
+
+        struct Entry {
+            uint64_t hash;
+            uint16_t tag;
+
+            Entry(uint64_t _hash, uint16_t _tag) : hash(_hash), tag(_tag) {}
+        };
+
+    public:
+
+        static const uint32_t SHARD_BITS = 6;
+        static const uint32_t NB_SHARDS = 1 << SHARD_BITS;
+        static const uint32_t BUFFER_SIZE = 1024;
+
+        /**
+         * Thread local staging area for hashes bound for each shard
+         */
+        class Buffer {
+        private:
+            SpectrumSketch& sketch;
+            vector<vector<Entry>> pending;
+
+        public:
+
+            Buffer(SpectrumSketch& _sketch) : sketch(_sketch), pending(NB_SHARDS) {
+                for(auto& p : pending) p.reserve(BUFFER_SIZE);
+            }
+
+            ~Buffer() {
+                flush();
+            }
+
+            void add(uint64_t hash, uint16_t tag = 0) {
+                const uint32_t s = hash & (NB_SHARDS - 1);
+                if (hash > sketch.shards[s]->threshold.load(std::memory_order_relaxed))
+                    return;
+
+                pending[s].push_back(Entry(hash, tag));
+                if (pending[s].size() >= BUFFER_SIZE) {
+                    sketch.shards[s]->insert(pending[s]);
+                    pending[s].clear();
+                }
+            }
+
+            void flush() {
+                for(uint32_t s = 0; s < NB_SHARDS; s++) {
+                    if (!pending[s].empty()) {
+                        sketch.shards[s]->insert(pending[s]);
+                        pending[s].clear();
+                    }
+                }
+            }
+        };
+
+    private:
+
+        /**
+         * Open addressing table of hashes and their counts.  A count of 0 marks an
+         * empty slot.  Kept at most half full.  Tags are only stored if requested.
+         */
+        class Shard {
+        public:
+            std::mutex mu;
+            std::atomic<uint64_t> threshold;
+            vector<uint64_t> keys;
+            vector<uint32_t> counts;
+            vector<uint16_t> tags;
+            uint64_t size;
+            uint64_t maxSize;
+
+            Shard(uint64_t _maxSize, bool tagged) : threshold(std::numeric_limits<uint64_t>::max()), size(0), maxSize(_maxSize) {
+                uint64_t capacity = 2;
+                while (capacity < maxSize * 2) capacity <<= 1;
+                keys.assign(capacity, 0);
+                counts.assign(capacity, 0);
+                if (tagged) tags.assign(capacity, 0);
+            }
+
+            void insert(const vector<Entry>& entries) {
+                std::lock_guard<std::mutex> lock(mu);
+                for(const Entry& e : entries) {
+                    if (e.hash <= threshold.load(std::memory_order_relaxed)) {
+                        increment(e.hash, 1, e.tag);
+                        if (size > maxSize) shrink();
+                    }
+                }
+            }
+
+            void increment(uint64_t h, uint32_t c, uint16_t tag) {
+                const uint64_t mask = keys.size() - 1;
+                uint64_t i = (h >> SHARD_BITS) & mask;
+                while (counts[i] != 0 && keys[i] != h) {
+                    i = (i + 1) & mask;
+                }
+                if (counts[i] == 0) {
+                    keys[i] = h;
+                    if (!tags.empty()) tags[i] = tag;
+                    size++;
+                }
+                counts[i] = counts[i] > std::numeric_limits<uint32_t>::max() - c ?
+                        std::numeric_limits<uint32_t>::max() : counts[i] + c;
+            }
+
+            /**
+             * Halves the threshold until the table is within its limit
+             */
+            void shrink() {
+                vector<uint64_t> oldKeys(keys.size(), 0);
+                vector<uint32_t> oldCounts(counts.size(), 0);
+                vector<uint16_t> oldTags(tags.size(), 0);
+
+                while (size > maxSize) {
+                    const uint64_t t = threshold.load(std::memory_order_relaxed) >> 1;
+                    threshold.store(t, std::memory_order_relaxed);
+
+                    oldKeys.swap(keys);
+                    oldCounts.swap(counts);
+                    oldTags.swap(tags);
+                    std::fill(counts.begin(), counts.end(), 0);
+                    size = 0;
+
+                    for(size_t i = 0; i < oldKeys.size(); i++) {
+                        if (oldCounts[i] != 0 && oldKeys[i] <= t) {
+                            increment(oldKeys[i], oldCounts[i], oldTags.empty() ? 0 : oldTags[i]);
+                        }
+                    }
+                }
+            }
+
+            /**
+             * Fraction of this shard's part of hash space that is sampled
+             */
+            double fraction() const {
+                return ((double)threshold.load() + 1.0) / 18446744073709551616.0;
+            }
+        };
+
+        vector<unique_ptr<Shard>> shards;
+
+    public:
+
+        /**
+         * @param maxEntries The most distinct K-mers to hold at once.  Each takes 24 bytes,
+         * or 28 bytes with tags.
+         * @param tagged Whether to keep a tag with each K-mer
+         */
+        SpectrumSketch(uint64_t maxEntries, bool tagged = false) {
+            const uint64_t perShard = maxEntries / NB_SHARDS > 0 ? maxEntries / NB_SHARDS : 1;
+            for(uint32_t s = 0; s < NB_SHARDS; s++) {
+                shards.push_back(unique_ptr<Shard>(new Shard(perShard, tagged)));
+            }
+        }
+
+        /**
+         * Adds a single hash.  Threads adding many hashes should use a Buffer instead.
+         */
+        void add(uint64_t hash, uint16_t tag = 0) {
+            vector<Entry> one(1, Entry(hash, tag));
+            shards[hash & (NB_SHARDS - 1)]->insert(one);
+        }
+
+        /**
+         * Number of distinct K-mers currently sampled
+         */
+        uint64_t getNbSampled() const {
+            uint64_t n = 0;
+            for(const auto& s : shards) n += s->size;
+            return n;
+        }
+
+        /**
+         * Mean fraction of hash space sampled across the shards
+         */
+        double getFraction() const {
+            double f = 0.0;
+            for(const auto& s : shards) f += s->fraction();
+            return f / NB_SHARDS;
+        }
+
+        /**
+         * Estimated number of distinct K-mers in everything added
+         */
+        uint64_t estimateDistinct() const {
+            double distinct = 0.0;
+            for(const auto& s : shards) {
+                distinct += s->size / s->fraction();
+            }
+            return llround(distinct);
+        }
+
+        /**
+         * Visits every sampled K-mer.  Not safe to call while K-mers are being added.
+         * @param visit Function taking (uint32_t count, uint16_t tag, double weight), where
+         * weight is the number of distinct K-mers in the input this one stands for
+         */
+        template<class Visit>
+        void forEach(Visit visit) const {
+            for(const auto& s : shards) {
+                const double weight = 1.0 / s->fraction();
+                for(size_t i = 0; i < s->counts.size(); i++) {
+                    if (s->counts[i] != 0) {
+                        visit(s->counts[i], s->tags.empty() ? 0 : s->tags[i], weight);
+                    }
+                }
+            }
+        }
+
+        /**
+         * Estimated number of distinct K-mers with each count, for counts from 0 to
+         * hist.size() - 1.  Counts beyond the end are added to the last element.
+         * @param hist Filled with the estimated spectrum
+         */
+        void estimateSpectrum(vector<uint64_t>& hist) const {
+
+            vector<double> est(hist.size(), 0.0);
+
+            forEach([&est](uint32_t c, uint16_t, double weight) {
+                est[c < est.size() ? c : est.size() - 1] += weight;
+            });
+
+            for(size_t i = 0; i < hist.size(); i++) {
+                hist[i] = llround(est[i]);
+            }
+        }
+    };
+}
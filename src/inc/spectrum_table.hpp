@@ -0,0 +1,113 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <unordered_map>
+using std::unordered_map;
+
+#include "spectrum_sketch.hpp"
+
+namespace kat {
+
+    /**
+     * Number of distinct K-mers seen with each count, split by a small tag such as
+     * GC count.  This is all hist and gcp need from a set of counted K-mers, so it
+     * lets K-mers be counted separately from the analysis, e.g. when several K-mer
+     * lengths are counted together.
+     *
+     * Tables built from every K-mer are exact.  A table can also be built from a
+     * SpectrumSketch, in which case it holds estimates, scaled up from the sampled
+     * fraction of K-mers.
+     */
+    class SpectrumTable {
+    private:
+
+        unordered_map<uint64_t, double> cells;    // Keyed by count, then tag in the low 16 bits
+        double fraction;
+
+    public:
+
+        SpectrumTable() : fraction(1.0) {}
+
+        /**
+         * Estimates from the K-mers sampled by a sketch
+         */
+        SpectrumTable(const SpectrumSketch& sketch) : fraction(sketch.getFraction()) {
+            sketch.forEach([this](uint32_t count, uint16_t tag, double weight) {
+                add(count, tag, weight);
+            });
+        }
+
+        /**
+         * Adds K-mers with the given count and tag
+         * @param count The count of each K-mer
+         * @param tag The tag of each K-mer
+         * @param distinct The number of distinct K-mers to add
+         */
+        void add(uint64_t count, uint16_t tag, double distinct = 1.0) {
+            cells[(count << 16) | tag] += distinct;
+        }
+
+        /**
+         * Adds every cell of another table, which should cover different K-mers
+         */
+        void merge(const SpectrumTable& other) {
+            for(const auto& c : other.cells) {
+                cells[c.first] += c.second;
+            }
+            fraction = std::min(fraction, other.fraction);
+        }
+
+        /**
+         * Fraction of K-mers the table was built from, which is 1 unless it was
+         * estimated from a sample
+         */
+        double getFraction() const {
+            return fraction;
+        }
+
+        bool isEstimated() const {
+            return fraction < 1.0;
+        }
+
+        /**
+         * Number of distinct K-mers in the table
+         */
+        uint64_t getNbDistinct() const {
+            double distinct = 0.0;
+            for(const auto& c : cells) {
+                distinct += c.second;
+            }
+            return llround(distinct);
+        }
+
+        /**
+         * Visits every combination of count and tag seen
+         * @param visit Function taking (uint64_t count, uint16_t tag, double distinct), where
+         * distinct is the number of distinct K-mers with that count and tag
+         */
+        template<class Visit>
+        void forEach(Visit visit) const {
+            for(const auto& c : cells) {
+                visit(c.first >> 16, (uint16_t)(c.first & 0xFFFF), c.second);
+            }
+        }
+    };
+}
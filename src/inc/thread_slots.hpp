@@ -0,0 +1,117 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <thread>
+#include <vector>
+using std::thread;
+using std::vector;
+
+namespace kat {
+
+    /**
+     * One result per worker thread, each in its own slot, so threads can update
+     * their results without locking.  Slots are created up front and indexed by
+     * thread id, and are padded so that neighbouring slots never share a cache line.
+     *
+     * Results are combined with a tree reduction: pairs of slots are merged in
+     * parallel, then pairs of those results, and so on, leaving the total in slot
+     * 0 after log2(size) rounds.  Slots are always paired the same way, so the
+     * result does not depend on how threads were scheduled.
+     */
+    template<class T>
+    class ThreadSlots {
+    public:
+
+        static const size_t CACHE_LINE_SIZE = 64;
+
+    private:
+
+        /**
+         * A full cache line of padding after each value keeps consecutive values
+         * apart whatever the alignment of the underlying allocation
+         */
+        struct Slot {
+            T value;
+            char padding[CACHE_LINE_SIZE];
+
+            Slot() : value() {}
+            Slot(const T& _value) : value(_value) {}
+        };
+
+        vector<Slot> slots;
+
+    public:
+
+        ThreadSlots() {}
+
+        ThreadSlots(size_t size) : slots(size) {}
+
+        ThreadSlots(size_t size, const T& initial) : slots(size, Slot(initial)) {}
+
+        size_t size() const {
+            return slots.size();
+        }
+
+        bool empty() const {
+            return slots.empty();
+        }
+
+        T& operator[](size_t index) {
+            return slots[index].value;
+        }
+
+        const T& operator[](size_t index) const {
+            return slots[index].value;
+        }
+
+        /**
+         * Adds another slot.  Not safe to call while threads are using the slots.
+         */
+        void push_back(const T& value) {
+            slots.push_back(Slot(value));
+        }
+
+        /**
+         * Merges every slot into slot 0, which is returned.  The other slots are left
+         * in an unspecified state.  Must not be called on an empty object.
+         * @param combine Function taking (T& into, const T& from), which adds from into into
+         */
+        template<class Combine>
+        T& reduce(Combine combine) {
+
+            const size_t n = slots.size();
+
+            for(size_t stride = 1; stride < n; stride *= 2) {
+
+                vector<thread> workers;
+                for(size_t i = 0; i + stride < n; i += 2 * stride) {
+                    workers.push_back(thread(combine, std::ref(slots[i].value), std::cref(slots[i + stride].value)));
+                }
+
+                for(auto& w : workers) {
+                    w.join();
+                }
+            }
+
+            return slots[0].value;
+        }
+    };
+}
@@ -96,24 +96,26 @@ void kat::InputHandler::validateMerLen(uint16_t merLen) {
     }
 }
 
-string kat::InputHandler::pathString() {
+string kat::InputHandler::pathString() const {
     
     string s;
-    for(path& p : input) {
+    for(const path& p : input) {
         s += p.string() + " ";
     }
     return s;
 }
 
-void kat::InputHandler::count(uint16_t merLen, uint16_t threads) {
+void kat::InputHandler::count(uint16_t merLen, uint16_t threads, bool verbose) {
     
-    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");      
+    shared_ptr<auto_cpu_timer> timer = verbose ? make_shared<auto_cpu_timer>(1, "  Time taken: %ws\n\n") : nullptr;
     
     hashCounter = make_shared<HashCounter>(hashSize, merLen * 2, 7, threads);
     hashCounter->do_size_doubling(!disableHashGrow);
         
-    cout << "Input is a sequence file.  Counting kmers for " << pathString() << "...";
-    cout.flush();
+    if (verbose) {
+        cout << "Input is a sequence file.  Counting kmers for " << pathString() << "...";
+        cout.flush();
+    }
 
     hash = JellyfishHelper::countSeqFile(input, *hashCounter, canonical, threads);
     
@@ -125,8 +127,10 @@ void kat::InputHandler::count(uint16_t merLen, uint16_t threads) {
     header->canonical(canonical);
     header->format(binary_dumper::format);    
     
-    cout << " done.";
-    cout.flush();    
+    if (verbose) {
+        cout << " done.";
+        cout.flush();
+    }
 }
 
 void kat::InputHandler::loadHash(bool verbose) {
@@ -139,7 +143,7 @@ void kat::InputHandler::loadHash(bool verbose) {
     }
     
     hashLoader = make_shared<HashLoader>();
-    hashLoader->loadHash(input[0], false); 
+    hashLoader->loadHash(input[0], false, sampleFraction); 
     hash = hashLoader->getHash();
     canonical = hashLoader->getCanonical();
     
@@ -149,6 +153,12 @@ void kat::InputHandler::loadHash(bool verbose) {
     }
 }
 
+void kat::InputHandler::openDump() {
+    
+    hashDump = make_shared<HashDump>(input[0]);
+    canonical = hashDump->getHeader().canonical();
+}
+
 void kat::InputHandler::dump(const path& outputPath, uint16_t threads, bool verbose) {
     
     // Remove anything that exists at the target location
@@ -175,6 +185,31 @@ void kat::InputHandler::dump(const path& outputPath, uint16_t threads, bool verb
     
 }
 
+void kat::InputHandler::buildFilter(uint16_t threads, bool verbose) {
+    
+    shared_ptr<auto_cpu_timer> timer = verbose ? make_shared<auto_cpu_timer>(1, "  Time taken: %ws\n\n") : nullptr;
+    
+    if (verbose) {
+        cout << "Building K-mer prefilter for " << pathString() << "...";
+        cout.flush();
+    }
+    
+    filter = JellyfishHelper::buildFilter(hash, threads);
+    
+    if (verbose) {
+        cout << " done (" << filter->getSizeInBytes() / (1024 * 1024) << " MB).";
+        cout.flush();
+    }
+}
+
+void kat::InputHandler::unload() {
+    filter = nullptr;
+    hash = nullptr;
+    hashLoader = nullptr;
+    hashDump = nullptr;
+    hashCounter = nullptr;
+}
+
 vector<path> kat::InputHandler::globFiles(const string& input) {
 
     vector<string> inputvec;
@@ -41,22 +41,31 @@ namespace kat {
         uint64_t hashSize = DEFAULT_HASH_SIZE;
         bool dumpHash = false;
         bool disableHashGrow = false;
+        double sampleFraction = 1.0;            // Only applicable if loaded
         HashCounterPtr hashCounter = nullptr;
         shared_ptr<HashLoader> hashLoader = nullptr;
+        shared_ptr<HashDump> hashDump = nullptr;     // Only applicable if opened for streaming
         LargeHashArrayPtr hash = nullptr;
+        shared_ptr<BlockedBloomFilter> filter = nullptr;   // Optional prefilter over the keys in hash
         shared_ptr<file_header> header;         // Only applicable if loaded
 
         void setSingleInput(path p) { input.clear(); input.push_back(p); }
         void setMultipleInputs(const vector<path>& inputs);
         path getSingleInput() { return input[0]; }
-        string pathString();
+        string pathString() const;
         void validateInput();   // Throws if input is not present.  Sets input mode.
         void loadHeader();
         void validateMerLen(uint16_t merLen);   // Throws if incorrect merlen
-        void count(uint16_t merLen, uint16_t threads);   // Uses the jellyfish library to count kmers in the input
+        void count(uint16_t merLen, uint16_t threads) { count(merLen, threads, true); }
+        void count(uint16_t merLen, uint16_t threads, bool verbose);   // Uses the jellyfish library to count kmers in the input
         void loadHash() { loadHash(false); }
         void loadHash(bool verbose);
+        void openDump();    // Maps the hash file for streaming rather than loading it into a hash
         void dump(const path& outputPath, uint16_t threads, bool verbose);
+        void buildFilter(uint16_t threads) { buildFilter(threads, true); }
+        void buildFilter(uint16_t threads, bool verbose);     // Builds the prefilter over the keys in hash
+        void unload();      // Releases the hash and any associated memory
+        uint64_t getCount(const mer_dna& kmer) { return JellyfishHelper::getCount(hash, filter.get(), kmer, canonical); }
         
         static vector<path> globFiles(const string& input);
         static vector<path> globFiles(const vector<path>& input);
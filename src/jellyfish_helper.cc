@@ -15,6 +15,10 @@
 //  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
 //  *******************************************************************
 
+#include <math.h>
+#include <algorithm>
+#include <exception>
+#include <iomanip>
 #include <thread>
 #include <vector>
 using std::thread;
@@ -44,7 +48,10 @@ using jellyfish::Offsets;
 using jellyfish::quadratic_reprobes;
 
 #include "jellyfish_helper.hpp"
+#include "inc/mer_len_counter.hpp"
 using kat::JellyfishHelper;
+using kat::MerLenCounter;
+using kat::ReadBatchQueue;
 
 path kat::JellyfishHelper::jellyfishExe = "jellyfish";
 
@@ -90,7 +97,7 @@ void kat::JellyfishHelper::printHeader(const file_header& header, ostream& out)
  * @param verbose
  * @return 
  */
-LargeHashArrayPtr kat::HashLoader::loadHash(const path& jfHashPath, bool verbose) {
+LargeHashArrayPtr kat::HashLoader::loadHash(const path& jfHashPath, bool verbose, double sampleFraction) {
     
     ifstream in(jfHashPath.c_str(), std::ios::in | std::ios::binary);
     header = file_header(in);
@@ -104,16 +111,9 @@ LargeHashArrayPtr kat::HashLoader::loadHash(const path& jfHashPath, bool verbose
         kat::JellyfishHelper::printHeader(header, cerr);
     }
     
-    if (header.format() == "bloomcounter") {        
-        in.close();
-        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
-            "KAT does not currently support bloom counted kmer hashes.  Please create a binary hash with jellyfish or KAT and use that instead.")));
-    } else if (header.format() == text_dumper::format) {
-        in.close();
-        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
-            "Processing a text format hash will be painfully slow, so we don't support it.  Please create a binary hash with jellyfish or KAT and use that instead.")));
-    } 
-    else if (header.format() == binary_dumper::format) {
+    JellyfishHelper::validateBinaryFormat(header);
+    
+    {
 
         // Makes sure jellyfish knows what size kmers we are working with.  The actual kmer size,
         // for our purposes, will be half of what the number of bits used to store it is.
@@ -136,7 +136,15 @@ LargeHashArrayPtr kat::HashLoader::loadHash(const path& jfHashPath, bool verbose
         size_t record_len = header.counter_len() + key_len;
         size_t nbRecords = fileSizeBytes / record_len;
         
-        size_t lsize = jellyfish::ceilLog2(nbRecords * 2);
+        // If we are only keeping a sample of the K-mers then size the hash for the expected 
+        // number of sampled records, plus some slack for sampling variance
+        const bool sampling = sampleFraction < 1.0;
+        const uint64_t threshold = JellyfishHelper::sampleThreshold(sampleFraction);
+        size_t nbExpected = sampling ? 
+            (size_t)(nbRecords * sampleFraction + 6.0 * sqrt(nbRecords * sampleFraction)) + 1 :
+            nbRecords;
+        
+        size_t lsize = jellyfish::ceilLog2(nbExpected * 2);
         size_t size_ = (size_t)1 << lsize;
         
         if (verbose) {
@@ -168,28 +176,135 @@ LargeHashArrayPtr kat::HashLoader::loadHash(const path& jfHashPath, bool verbose
                 header.max_reprobe());
 
         while (reader.next()) {
-            hash->add(reader.key(), reader.val());
+            if (!sampling || JellyfishHelper::inSample(reader.key(), threshold)) {
+                hash->add(reader.key(), reader.val());
+            }
         }
         
         in.close();
         
         return hash;
     }
-    else {
-        in.close();
+}
+
+kat::HashDump::HashDump(const path& jfHashPath) {
+    
+    ifstream in(jfHashPath.c_str(), std::ios::in | std::ios::binary);
+    header = file_header(in);
+    
+    if (!in.good()) {
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+            "Failed to parse header of file: ") + jfHashPath.string()));
+    }
+    
+    in.close();
+    
+    JellyfishHelper::validateBinaryFormat(header);
+    
+    // Makes sure jellyfish knows what size kmers we are working with
+    mer_dna::k(header.key_len() / 2);
+    
+    map = make_shared<mapped_file>(jfHashPath.c_str());
+    map->sequential();   // Records are read in order within each slice
+    
+    data = map->base() + header.offset();
+    const size_t fileSizeBytes = map->length() - header.offset();
+    
+    keyLen = header.key_len() / 8 + (header.key_len() % 8 != 0);
+    valLen = header.counter_len();
+    recordLen = keyLen + valLen;
+
+    // Records are copied straight into a K-mer's words and a 64-bit count, so the
+    // header must not describe fields larger than those
+    if (keyLen == 0 || keyLen > mer_dna::nb_words(mer_dna::k()) * sizeof(mer_dna::base_type)) {
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+            "Invalid key length in header of file: ") + jfHashPath.string() +
+                ".  Key length: " + lexical_cast<string>(header.key_len()) + " bits"));
+    }
+
+    if (valLen == 0 || valLen > sizeof(uint64_t)) {
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+            "Invalid counter length in header of file: ") + jfHashPath.string() +
+                ".  Counter length: " + lexical_cast<string>(valLen) + " bytes"));
+    }
+
+    if(fileSizeBytes % recordLen != 0) {
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+            "Size of database (") + lexical_cast<string>(fileSizeBytes) + 
+                ") must be a multiple of the length of a record (" + lexical_cast<string>(recordLen) + ")"));
+    }
+    
+    nbRecords = fileSizeBytes / recordLen;
+}
+
+void kat::JellyfishHelper::validateBinaryFormat(const file_header& header) {
+    
+    if (header.format() == "bloomcounter") {        
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+            "KAT does not currently support bloom counted kmer hashes.  Please create a binary hash with jellyfish or KAT and use that instead.")));
+    } else if (header.format() == text_dumper::format) {
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+            "Processing a text format hash will be painfully slow, so we don't support it.  Please create a binary hash with jellyfish or KAT and use that instead.")));
+    } 
+    else if (header.format() != binary_dumper::format) {
         BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
             "Unknown format '") + header.format() + "'"));
     }
-   
 }
 
 uint64_t kat::JellyfishHelper::getCount(LargeHashArrayPtr hash, const mer_dna& kmer, bool canonical) {
-    const mer_dna k = canonical ? kmer.get_canonical() : kmer;
+    return getCount(hash, nullptr, kmer, canonical);
+}
+
+uint64_t kat::JellyfishHelper::getCount(LargeHashArrayPtr hash, const BlockedBloomFilter* filter, const mer_dna& kmer, bool canonical) {
+    
+    // Only make a copy of the K-mer if it needs canonicalising
+    if (canonical) {
+        return getCount(hash, filter, kmer.get_canonical(), false);
+    }
+    
+    if (filter != nullptr && !filter->contains(mixKey(kmer)))
+        return 0;
+    
     uint64_t val = 0;
-    hash->get_val_for_key(k, &val);
+    hash->get_val_for_key(kmer, &val);
     return val;
 }
 
+shared_ptr<BlockedBloomFilter> kat::JellyfishHelper::buildFilter(LargeHashArrayPtr hash, uint16_t threads) {
+    
+    // First pass: count the keys so the filter can be sized to fit
+    vector<uint64_t> nbKeys(threads, 0);
+    vector<thread> t(threads);
+    for(uint16_t i = 0; i < threads; i++) {
+        t[i] = thread([hash, threads, i, &nbKeys]() {
+            LargeHashArray::region_iterator it = hash->region_slice(i, threads);
+            uint64_t n = 0;
+            while (it.next()) n++;
+            nbKeys[i] = n;
+        });
+    }
+    for(auto& th : t) th.join();
+    
+    uint64_t total = 0;
+    for(auto n : nbKeys) total += n;
+    
+    // Second pass: add keys.  Filter inserts are atomic so threads can share it.
+    shared_ptr<BlockedBloomFilter> filter = make_shared<BlockedBloomFilter>(total);
+    BlockedBloomFilter* f = filter.get();
+    for(uint16_t i = 0; i < threads; i++) {
+        t[i] = thread([hash, threads, i, f]() {
+            LargeHashArray::region_iterator it = hash->region_slice(i, threads);
+            while (it.next()) {
+                f->insert(mixKey(it.key()));
+            }
+        });
+    }
+    for(auto& th : t) th.join();
+    
+    return filter;
+}
+
 /**
  * Simple count routine
  * @param ary Hash array which contains the counted kmers
@@ -217,7 +332,7 @@ LargeHashArrayPtr kat::JellyfishHelper::countSeqFile(const vector<path>& seqFile
     
     // Convert paths to a format jellyfish is happy with
     vector<const char*> paths;
-    for(path p : seqFiles) {
+    for(const path& p : seqFiles) {
         paths.push_back(p.c_str());
     }
     
@@ -242,6 +357,231 @@ LargeHashArrayPtr kat::JellyfishHelper::countSeqFile(const vector<path>& seqFile
     return hashCounter.ary();
 }
 
+void kat::JellyfishHelper::validateSeqFiles(const vector<path>& seqFiles) {
+    
+    for(const path& p : seqFiles) {
+        if (!isSequenceFile(p)) {
+            BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "Several K-mer lengths can only be used with sequence files, which must have one of these extensions: \".fa,.fasta,.fq,.fastq,.fna\".  Input: ") + p.string()));
+        }
+        if (!bfs::exists(p) && !bfs::symbolic_link_exists(p)) {
+            BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "Could not find input file at: ") + p.string() + "; please check the path and try again."));
+        }
+    }
+}
+
+vector<shared_ptr<SpectrumTable>> kat::JellyfishHelper::countSeqFiles(const vector<path>& seqFiles, const vector<uint16_t>& merLens, 
+        bool canonical, uint64_t hashSize, uint16_t threads) {
+    
+    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");
+    
+    validateSeqFiles(seqFiles);
+    
+    // Convert paths to a format jellyfish is happy with
+    vector<const char*> paths;
+    for(const path& p : seqFiles) {
+        paths.push_back(p.c_str());
+    }
+    
+    cout << "Reading sequences once to count K-mers of length";
+    for(size_t i = 0; i < merLens.size(); i++) {
+        cout << (i == 0 ? " " : ", ") << merLens[i];
+    }
+    cout << " ...";
+    cout.flush();
+    
+    // Split the threads between the K-mer lengths as evenly as possible.  Each length
+    // needs at least one thread, so with fewer threads than lengths there will be
+    // more counting threads than requested.
+    vector<unique_ptr<MerLenCounter>> counters;
+    size_t nbBatches = 1;
+    for(size_t i = 0; i < merLens.size(); i++) {
+        const uint16_t groupThreads = std::max<uint16_t>(1, threads / merLens.size() + (i < threads % merLens.size()));
+        counters.push_back(MerLenCounter::create(i, merLens[i], canonical, hashSize, false, groupThreads));
+        nbBatches += counters.back()->getMaxBatches();
+    }
+    
+    // Each batch of reads is one of the parser's own buffers, held until every K-mer
+    // length has counted it, rather than a copy of its reads.  The parser is given 
+    // enough buffers to fill every queue, so that the reader waits on the queues rather
+    // than spinning on an empty pool.  Every counter is finished, which drops the 
+    // batches it holds, before the parser is destroyed.
+    std::exception_ptr error;
+    unique_ptr<StreamManager> streams;
+    unique_ptr<ReadParser> parser;
+    try {
+        streams = unique_ptr<StreamManager>(new StreamManager(paths.begin(), paths.end(), 1));
+        parser = unique_ptr<ReadParser>(new ReadParser(nbBatches, 100, streams->nb_streams(), *streams));
+    }
+    catch(...) {
+        error = std::current_exception();
+    }
+    
+    if (!error) {
+        for(auto& c : counters) {
+            c->start();
+        }
+        
+        // Read whole sequences once, handing each batch to every K-mer length
+        try {
+            while (true) {
+                shared_ptr<ReadParser::job> job = make_shared<ReadParser::job>(*parser);
+                if (job->is_empty()) {
+                    break;
+                }
+                
+                const ReadBatchQueue::Batch batch(job, &**job);
+                
+                bool failed = false;
+                for(auto& c : counters) {
+                    c->add(batch);
+                    failed = failed || c->failed();
+                }
+                
+                // Stop reading once a K-mer length has failed, as its error is reported below
+                if (failed) {
+                    break;
+                }
+            }
+        }
+        catch(...) {
+            error = std::current_exception();
+        }
+    }
+    
+    // Every counter must be finished, even after an error, so that its threads are joined
+    vector<shared_ptr<SpectrumTable>> tables;
+    for(auto& c : counters) {
+        try {
+            tables.push_back(c->finish());
+        }
+        catch(...) {
+            if (!error) error = std::current_exception();
+        }
+    }
+    
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    
+    cout << " done." << endl;
+    for(size_t i = 0; i < merLens.size(); i++) {
+        cout << " - K" << merLens[i] << ": " << tables[i]->getNbDistinct() << " distinct K-mers" << endl;
+    }
+    cout.flush();
+    
+    return tables;
+}
+
+vector<shared_ptr<SpectrumSketch>> kat::JellyfishHelper::sketchSeqFiles(const vector<path>& seqFiles, const vector<uint16_t>& merLens, 
+        bool canonical, bool tagGC, uint64_t sketchSize, uint16_t threads) {
+    
+    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");
+    
+    validateSeqFiles(seqFiles);
+    
+    // Convert paths to a format jellyfish is happy with
+    vector<const char*> paths;
+    for(const path& p : seqFiles) {
+        paths.push_back(p.c_str());
+    }
+    
+    cout << "Reading sequences once to sample K-mers of length";
+    for(size_t i = 0; i < merLens.size(); i++) {
+        cout << (i == 0 ? " " : ", ") << merLens[i];
+    }
+    cout << " ...";
+    cout.flush();
+    
+    vector<shared_ptr<SpectrumSketch>> sketches;
+    for(size_t i = 0; i < merLens.size(); i++) {
+        sketches.push_back(make_shared<SpectrumSketch>(sketchSize, tagGC));
+    }
+    
+    StreamManager streams(paths.begin(), paths.end(), 1);
+    
+    // Whole sequences are handed out, so no K-mer is seen twice whatever its length
+    ReadParser parser(3 * threads, 100, streams.nb_streams(), streams);
+    
+    thread t[threads];
+
+    for(int i = 0; i < threads; i++) {
+        t[i] = thread(&kat::JellyfishHelper::sketchSlice, std::ref(parser), std::cref(merLens), std::ref(sketches), canonical, tagGC);
+    }
+
+    for(int i = 0; i < threads; i++) {
+        t[i].join();
+    }
+    
+    cout << " done." << endl;
+    for(size_t i = 0; i < merLens.size(); i++) {
+        cout << " - K" << merLens[i] << ": " << sketches[i]->estimateDistinct() << " distinct K-mers";
+        if (sketches[i]->getFraction() < 1.0) {
+            cout << ", estimated from a sample of " << std::setprecision(4) << sketches[i]->getFraction() * 100.0 << "%" << std::setprecision(6);
+        }
+        cout << endl;
+    }
+    cout.flush();
+    
+    return sketches;
+}
+
+void kat::JellyfishHelper::sketchSlice(ReadParser& parser, const vector<uint16_t>& merLens, 
+        vector<shared_ptr<SpectrumSketch>>& sketches, bool canonical, bool tagGC) {
+    
+    // The length of a DynamicMer is held by each object, unlike mer_dna, so 
+    // K-mers of every length can be built side by side
+    vector<DynamicMer> mers;
+    vector<DynamicMer> rcMers;
+    vector<unique_ptr<SpectrumSketch::Buffer>> buffers;
+    for(size_t i = 0; i < merLens.size(); i++) {
+        mers.push_back(DynamicMer(merLens[i]));
+        rcMers.push_back(DynamicMer(merLens[i]));
+        buffers.push_back(unique_ptr<SpectrumSketch::Buffer>(new SpectrumSketch::Buffer(*sketches[i])));
+    }
+    
+    for(ReadParser::job job(parser); !job.is_empty(); job.next()) {
+        for(size_t r = 0; r < job->nb_filled; r++) {
+            
+            const string& seq = job->data[r].seq;
+            
+            for(size_t i = 0; i < merLens.size(); i++) {
+                
+                DynamicMer& m = mers[i];
+                DynamicMer& rcm = rcMers[i];
+                SpectrumSketch::Buffer& buffer = *buffers[i];
+                const unsigned int k = merLens[i];
+                unsigned int filled = 0;
+                
+                for(const char c : seq) {
+                    const int code = DynamicMer::code(c);
+                    if (code < 0) {
+                        filled = 0;
+                        continue;
+                    }
+                    
+                    m.shift_left(code);
+                    if (canonical) 
+                        rcm.shift_right(DynamicMer::complement(code));
+                    
+                    if (filled < k) 
+                        filled++;
+                    
+                    if (filled == k) {
+                        const DynamicMer& kmer = !canonical || m < rcm ? m : rcm;
+                        buffer.add(mixKey(kmer), tagGC ? gcCount(kmer) : 0);
+                    }
+                }
+            }
+        }
+    }
+    
+    for(auto& b : buffers) {
+        b->flush();
+    }
+}
+
 void kat::JellyfishHelper::dumpHash(LargeHashArrayPtr ary, file_header& header, uint16_t threads, path outputFile) {
     
     //JellyfishHelper::printHeader(header, cout);
@@ -277,6 +617,40 @@ bool kat::JellyfishHelper::isSequenceFile(const path& filename) {
            boost::iequals(ext, ".fas");
 }
                 
+vector<uint16_t> kat::JellyfishHelper::parseMerLens(const string& list) {
+    
+    vector<string> parts;
+    boost::split(parts, list, boost::is_any_of(","));
+    
+    vector<uint16_t> merLens;
+    for(const string& p : parts) {
+        uint16_t merLen = 0;
+        try {
+            merLen = lexical_cast<uint16_t>(boost::trim_copy(p));
+        }
+        catch(boost::bad_lexical_cast& e) {
+            merLen = 0;
+        }
+        if (merLen == 0) {
+            BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "Invalid K-mer length: \"") + p + "\".  K-mer lengths must be positive integers separated by commas."));
+        }
+        if (std::find(merLens.begin(), merLens.end(), merLen) != merLens.end()) {
+            BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "K-mer length given more than once: ") + lexical_cast<string>(merLen)));
+        }
+        merLens.push_back(merLen);
+    }
+    
+    if (merLens.size() > MerLenCounter::MAX_MER_LENS) {
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+            "Too many K-mer lengths: ") + lexical_cast<string>(merLens.size()) + 
+            ".  At most " + lexical_cast<string>((uint32_t)MerLenCounter::MAX_MER_LENS) + " can be used at once."));
+    }
+    
+    return merLens;
+}
+                
 string kat::JellyfishHelper::createJellyfishCountCmd(const vector<path>& input, const path& output, uint16_t merLen, uint64_t hashSize, uint16_t threads, bool canonical) {
 
     string i;
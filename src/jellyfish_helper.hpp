@@ -17,8 +17,10 @@
 
 #pragma once
 
+#include <string.h>
 #include <string>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <vector>
 using std::ifstream;
@@ -52,15 +54,25 @@ using boost::timer::auto_cpu_timer;
 #include <jellyfish/mer_overlap_sequence_parser.hpp>
 #include <jellyfish/storage.hpp>
 #include <jellyfish/stream_manager.hpp>
+#include <jellyfish/whole_sequence_parser.hpp>
 using jellyfish::mer_dna;
 using jellyfish::file_header;
 using jellyfish::mapped_file;
 
+#include "inc/blocked_bloom_filter.hpp"
+#include "inc/spectrum_sketch.hpp"
+#include "inc/spectrum_table.hpp"
+using kat::BlockedBloomFilter;
+using kat::SpectrumSketch;
+using kat::SpectrumTable;
+
 typedef shared_ptr<file_header> HashHeaderPtr;
 typedef shared_ptr<binary_reader> HashReaderPtr;
 typedef jellyfish::stream_manager<vector<const char*>::const_iterator> StreamManager;
 typedef jellyfish::mer_overlap_sequence_parser<StreamManager> SequenceParser;
 typedef jellyfish::mer_iterator<SequenceParser, mer_dna> MerIterator;
+typedef jellyfish::whole_sequence_parser<StreamManager> ReadParser;
+typedef jellyfish::mer_dna_ns::mer_base_dynamic<uint64_t> DynamicMer;
 typedef jellyfish::cooperative::hash_counter<mer_dna> HashCounter;
 typedef shared_ptr<HashCounter> HashCounterPtr;
 typedef HashCounter::array LargeHashArray;
@@ -104,7 +116,20 @@ namespace kat {
          * @param verbose Output additional information to cout
          * @return The hash array
          */
-        LargeHashArrayPtr loadHash(const path& jfHashPath, bool verbose);
+        LargeHashArrayPtr loadHash(const path& jfHashPath, bool verbose) {
+            return loadHash(jfHashPath, verbose, 1.0);
+        }
+        
+        /**
+         * Loads a subsample of a jellyfish hash into memory.  Only K-mers selected by
+         * JellyfishHelper::inSample for the given fraction are kept, and the hash array
+         * is sized for the expected number of sampled K-mers.
+         * @param jfHashPath Path to the jellyfish hash file
+         * @param verbose Output additional information to cout
+         * @param sampleFraction Fraction of K-mers to keep (1.0 keeps everything)
+         * @return The hash array
+         */
+        LargeHashArrayPtr loadHash(const path& jfHashPath, bool verbose, double sampleFraction);
         
         LargeHashArrayPtr getHash() { return hash; }
         
@@ -115,6 +140,86 @@ namespace kat {
         const file_header& getHeader() { return header; }
     };
     
+    /**
+     * Gives direct access to the records of a binary jellyfish hash on disk, without
+     * building a hash array.  The file is memory mapped and records are decoded as 
+     * they are visited, so memory use does not depend on the size of the hash and
+     * reading is bound by sequential read bandwidth.  The records can be split into
+     * contiguous slices so that several threads can read the file at once.
+     */
+    class HashDump {
+        
+    private:
+        
+        file_header header;
+        shared_ptr<mapped_file> map;
+        const char* data;
+        size_t keyLen;          // Bytes
+        size_t valLen;          // Bytes
+        size_t recordLen;       // Bytes
+        uint64_t nbRecords;
+        
+    public:
+        
+        /**
+         * Iterates over a contiguous range of records in the file
+         */
+        class slice_iterator {
+            
+        private:
+            
+            const char* cur;
+            const char* end;
+            size_t keyLen;
+            size_t valLen;
+            mer_dna k;
+            uint64_t v;
+            
+        public:
+            
+            slice_iterator(const char* _cur, const char* _end, size_t _keyLen, size_t _valLen) :
+                cur(_cur), end(_end), keyLen(_keyLen), valLen(_valLen), v(0) {}
+            
+            bool next() {
+                if (cur >= end)
+                    return false;
+                
+                memcpy(k.data__(), cur, keyLen);
+                k.clean_msw();
+                v = 0;
+                memcpy(&v, cur + keyLen, valLen);
+                cur += keyLen + valLen;
+                return true;
+            }
+            
+            const mer_dna& key() const { return k; }
+            
+            uint64_t val() const { return v; }
+        };
+        
+        /**
+         * Opens a binary jellyfish hash and sets the K-mer length to match it
+         * @param jfHashPath Path to the jellyfish hash file
+         */
+        HashDump(const path& jfHashPath);
+        
+        const file_header& getHeader() const { return header; }
+        
+        uint64_t getNbRecords() const { return nbRecords; }
+        
+        /**
+         * Records for one of several roughly equal, contiguous slices of the file
+         * @param index The slice to return, from 0 to nbSlices - 1
+         * @param nbSlices Number of slices the file is split into
+         * @return Iterator over the records in the slice
+         */
+        slice_iterator slice(uint16_t index, uint16_t nbSlices) const {
+            const uint64_t first = nbRecords * index / nbSlices;
+            const uint64_t last = nbRecords * (index + 1) / nbSlices;
+            return slice_iterator(data + first * recordLen, data + last * recordLen, keyLen, valLen);
+        }
+    };
+    
     
     class JellyfishHelper {
 
@@ -131,6 +236,139 @@ namespace kat {
         
         static uint64_t getCount(LargeHashArrayPtr hash, const mer_dna& kmer, bool canonical);
         
+        /**
+         * Gets the count for a K-mer, consulting the prefilter first.  K-mers rejected
+         * by the prefilter are reported as absent without probing the hash array.
+         * @param hash Hash array to query
+         * @param filter Prefilter built over the keys of hash.  May be null.
+         * @param kmer The K-mer to look up
+         * @param canonical Whether or not the hash contains canonical K-mers
+         * @return The count for this K-mer, or 0 if not present
+         */
+        static uint64_t getCount(LargeHashArrayPtr hash, const BlockedBloomFilter* filter, const mer_dna& kmer, bool canonical);
+        
+        /**
+         * Builds a prefilter containing all keys in the hash array
+         * @param hash Hash array to index
+         * @param threads Number of threads to use
+         * @return The prefilter
+         */
+        static shared_ptr<BlockedBloomFilter> buildFilter(LargeHashArrayPtr hash, uint16_t threads);
+        
+        /**
+         * Mixes the 2-bit packed words of a K-mer into a well distributed 64-bit value.
+         * K-mers of up to 32 bases are mapped one to one.
+         * @param kmer The K-mer to hash
+         * @return Hash value for the K-mer
+         */
+        template<typename Mer>
+        static uint64_t mixKey(const Mer& kmer) {
+            return mixWords(kmer.data(), kmer.nb_words());
+        }
+        
+        /**
+         * As mixKey, for K-mer words held outside a K-mer
+         * @param words The 2-bit packed words, least significant first
+         * @param nbWords Number of words
+         * @return Hash value for the words
+         */
+        static uint64_t mixWords(const uint64_t* words, unsigned int nbWords) {
+            
+            // Murmur3 finaliser applied to each word in turn
+            uint64_t h = 0x9e3779b97f4a7c15ULL;
+            for(unsigned int i = 0; i < nbWords; i++) {
+                h ^= words[i];
+                h ^= h >> 33;
+                h *= 0xff51afd7ed558ccdULL;
+                h ^= h >> 33;
+                h *= 0xc4ceb9fe1a85ec53ULL;
+                h ^= h >> 33;
+            }
+            return h;
+        }
+        
+        /**
+         * Counts the G and C bases in a K-mer directly from its 2-bit packed words.
+         * C and G are the only codes whose two bits differ, so XORing each word 
+         * with itself shifted by one base position leaves a set low bit for each G 
+         * or C.  Unused bits in the top word are masked off, as they read as A.
+         * @param kmer The K-mer
+         * @return Number of G or C bases in the K-mer
+         */
+        template<typename Mer>
+        static uint16_t gcCount(const Mer& kmer) {
+            const uint64_t* words = kmer.data();
+            const unsigned int nbWords = kmer.nb_words();
+            uint16_t gc = 0;
+            for(unsigned int i = 0; i < nbWords; i++) {
+                const uint64_t w = i == nbWords - 1 ? words[i] & kmer.msw() : words[i];
+                gc += __builtin_popcountll((w ^ (w >> 1)) & 0x5555555555555555ULL);
+            }
+            return gc;
+        }
+        
+        /**
+         * Converts a sampling fraction into a threshold for use with inSample
+         * @param fraction Fraction of K-mers to sample, in the range (0,1]
+         * @return Threshold on the mixed hash value
+         */
+        static uint64_t sampleThreshold(double fraction) {
+
+            // Converting 2^64 or more to uint64_t is undefined, so clamp to the largest
+            // threshold, which keeps everything
+            const double threshold = fraction * 18446744073709551616.0;
+            return fraction >= 1.0 || threshold >= 18446744073709551616.0 ?
+                std::numeric_limits<uint64_t>::max() :
+                (uint64_t)threshold;
+        }
+        
+        /**
+         * Whether or not the K-mer falls into the sample defined by the given threshold.
+         * The decision is made on the canonical form of the K-mer, so the same subset
+         * of K-mers is selected from every hash, whether or not they are canonical.
+         * @param kmer The K-mer to test
+         * @param threshold Threshold created by sampleThreshold
+         * @return True if the K-mer should be kept
+         */
+        static bool inSample(const mer_dna& kmer, uint64_t threshold) {
+            
+            if (threshold == std::numeric_limits<uint64_t>::max())
+                return true;
+            
+            // get_canonical allocates a new K-mer on every call, so the reverse 
+            // complement is built in a buffer that each thread keeps between calls
+            const uint64_t* fwd = kmer.data();
+            const unsigned int nbWords = kmer.nb_words();
+            thread_local vector<uint64_t> rc;
+            rc.resize(nbWords);
+            
+            for(unsigned int i = 0; i < nbWords; i++) {
+                rc[i] = jellyfish::mer_dna_ns::word_reverse_complement(fwd[nbWords - 1 - i]);
+            }
+            
+            // Move the reverse complement down over the unused bits of the top word
+            const unsigned int topBits = (mer_dna::k() % 32) * 2;
+            if (topBits != 0) {
+                const unsigned int rs = 64 - topBits;
+                for(unsigned int i = 0; i + 1 < nbWords; i++) {
+                    rc[i] = (rc[i] >> rs) | (rc[i + 1] << topBits);
+                }
+                rc[nbWords - 1] >>= rs;
+            }
+            
+            // Compare from the most significant word, as mer_dna does
+            const uint64_t* canonical = fwd;
+            for(unsigned int i = nbWords; i-- > 0; ) {
+                if (rc[i] != fwd[i]) {
+                    if (rc[i] < fwd[i])
+                        canonical = rc.data();
+                    break;
+                }
+            }
+            
+            return mixWords(canonical, nbWords) <= threshold;
+        }
+        
         /**
         * Simple count routine
         * @param ary Hash array which contains the counted kmers
@@ -159,6 +397,49 @@ namespace kat {
          */
         static LargeHashArrayPtr countSeqFile(const vector<path>& seqFiles, HashCounter& hashCounter, bool canonical, uint16_t threads);
 
+        /**
+         * Counts the K-mers of several lengths from the given sequence files (FastA or
+         * FastQ) exactly, reading the files only once.  Each length is counted into its
+         * own hash by its own group of threads, which share the given threads between
+         * them.  Each hash is reduced to a table of the number of distinct K-mers with
+         * each count and GC count, and then freed.
+         * @param seqFiles Sequence files to read
+         * @param merLens K-mer lengths to count, at most MerLenCounter::MAX_MER_LENS
+         * @param canonical Whether to count the canonical form of each K-mer
+         * @param hashSize Initial size of the hash for each K-mer length, which doubles when full
+         * @param threads Number of threads to use
+         * @return One table for each K-mer length
+         */
+        static vector<shared_ptr<SpectrumTable>> countSeqFiles(const vector<path>& seqFiles, const vector<uint16_t>& merLens, 
+                bool canonical, uint64_t hashSize, uint16_t threads);
+
+        /**
+         * Collects the K-mers of several lengths from the given sequence files (FastA 
+         * or FastQ) into one sketch per length, reading the files only once.  Each 
+         * batch of sequences is walked once for each K-mer length while it is still in 
+         * cache.  Counts are exact unless a sketch fills up, after which it samples.
+         * @param seqFiles Sequence files to read
+         * @param merLens K-mer lengths to collect
+         * @param canonical Whether to add the canonical form of each K-mer
+         * @param tagGC Whether to tag each K-mer with its GC count
+         * @param sketchSize Most distinct K-mers to hold for each K-mer length
+         * @param threads Number of threads to use
+         * @return One sketch for each K-mer length
+         */
+        static vector<shared_ptr<SpectrumSketch>> sketchSeqFiles(const vector<path>& seqFiles, const vector<uint16_t>& merLens, 
+                bool canonical, bool tagGC, uint64_t sketchSize, uint16_t threads);
+        
+        /**
+         * Sketch routine for a single thread
+         * @param parser The parser that hands out batches of whole sequences
+         * @param merLens K-mer lengths to collect
+         * @param sketches One sketch for each K-mer length
+         * @param canonical Whether to add the canonical form of each K-mer
+         * @param tagGC Whether to tag each K-mer with its GC count
+         */
+        static void sketchSlice(ReadParser& parser, const vector<uint16_t>& merLens, 
+                vector<shared_ptr<SpectrumSketch>>& sketches, bool canonical, bool tagGC);
+
         
         
         static void dumpHash(LargeHashArrayPtr ary, file_header& header,  uint16_t threads, path outputFile);
@@ -170,6 +451,13 @@ namespace kat {
         */
         static shared_ptr<file_header> loadHashHeader(const path& jfHashPath);
         
+        /**
+         * Throws unless the header describes a binary hash, which is the only format 
+         * that KAT can read
+         * @param header Header of the jellyfish hash file
+         */
+        static void validateBinaryFormat(const file_header& header);
+        
         /**
         * Output header in human-readable format
         * @param header Jellyfish hash header
@@ -187,6 +475,20 @@ namespace kat {
          */
         static bool isSequenceFile(const path& filename);
         
+        /**
+         * Parses a comma separated list of K-mer lengths, such as "21,27,31"
+         * @param list The list
+         * @return The K-mer lengths, in the order given
+         */
+        static vector<uint16_t> parseMerLens(const string& list);
+        
+        /**
+         * Throws unless every path is an existing sequence file, as several K-mer
+         * lengths can only be collected from sequences
+         * @param seqFiles Paths to check
+         */
+        static void validateSeqFiles(const vector<path>& seqFiles);
+        
         static string createJellyfishCountCmd(const path& input, const path& output, uint16_t merLen, uint64_t hashSize, uint16_t threads, bool canonical) {
             
             vector<path> paths;
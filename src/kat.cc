@@ -33,11 +33,13 @@ namespace po = boost::program_options;
 using kat::KatFS;
 
 #include "comp.hpp"
+#include "cvg.hpp"
 #include "gcp.hpp"
 #include "histogram.hpp"
 #include "plot.hpp"
 #include "sect.hpp"
 using kat::Comp;
+using kat::Cvg;
 using kat::Gcp;
 using kat::Histogram;
 using kat::Plot;
@@ -49,6 +51,7 @@ struct KatException: virtual boost::exception, virtual std::exception { };
 
 enum Mode {
     COMP,
+    CVG,
     FILTER,
     GCP,
     HIST,
@@ -63,6 +66,9 @@ Mode parseMode(string mode) {
     if (upperMode == string("COMP")) {
         return COMP;                
     }
+    else if (upperMode == string("CVG")) {
+        return CVG;
+    }
     else if (upperMode == string("FILTER")) {
         return FILTER;
     }
@@ -94,6 +100,7 @@ Mode parseMode(string mode) {
                     "             count.\n" \
                     "   * hist:   Create an histogram of k-mer occurrences from a jellyfish hash.  Similar to jellyfish histogram\n" \
                     "             sub command but adds metadata in output for easy plotting, also actually runs multi-threaded.\n" \
+                    "   * cvg:    Converts binary K-mer coverage files produced by sect into text.\n" \
                     "   * filter: Filter out kmers, or sequences containing kmers\n" \
                     "   * plot:   Plotting tool.  Contains several plotting tools to visualise K-mer and compare distributions.\n" \
                     "             Requires gnuplot.\n\n" \
@@ -178,6 +185,9 @@ int main(int argc, char *argv[])
             case COMP:
                 Comp::main(modeArgC, modeArgV);
                 break;
+            case CVG:
+                Cvg::main(modeArgC, modeArgV);
+                break;
             /*case FILTER:
                 Filter::main(modeArgC, modeArgV);
                 break;*/
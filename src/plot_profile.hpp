@@ -45,6 +45,7 @@ using bfs::path;
 
 #include "inc/gnuplot/gnuplot_i.hpp"
 #include "inc/str_utils.hpp"
+#include "inc/coverage_file.hpp"
 
 namespace kat {
     
@@ -159,10 +160,37 @@ namespace kat {
         }
         
         
+        /**
+         *  Finds an entry in a binary coverage file, either by header or, if the header 
+         *  is empty, by index (first entry is 1), and returns the associated counts
+         **/
+        static int getEntryFromCoverageFile(const path& cvgb_path, const string& header, uint32_t n, string& foundHeader, vector<uint32_t>& counts)
+        {
+            CoverageReader reader(cvgb_path);
+            
+            const size_t i = !header.empty() ? reader.find(header) : (n > 0 ? n - 1 : reader.size());
+            
+            if (i >= reader.size())
+                return -1;
+            
+            vector<uint64_t> c;
+            reader.read(i, c);
+            
+            foundHeader = reader.getEntry(i).name;
+            
+            // Sequences with no K-mers are written as a single 0 in the text format
+            counts.assign(c.begin(), c.end());
+            if (counts.empty())
+                counts.push_back(0);
+            
+            return 0;
+        }
+        
         static string helpMessage() {
             return string("Usage: kat plot profile [options] <sect_profile_file>\n\n") + 
                     "Create Sequence Coverage Plot.\n\n" \
-                    "Shows K-mer coverage level across an sequence.\n\n" \
+                    "Shows K-mer coverage level across an sequence.  The sect profile file can be either the text " \
+                    "\".cvg\" file or the binary \".cvgb\" file produced by sect.\n\n" \
                     "Options";
         }
 
@@ -265,25 +293,33 @@ namespace kat {
             }
 
             string header;
-            string coverages;
+            vector<uint32_t> cvs;
 
-            if (!fasta_header.empty()) {
-                header.assign(fasta_header);
-                getEntryFromFasta(sect_file, header, coverages);
+            if (CoverageFile::isCoverageFile(sect_file)) {
+                getEntryFromCoverageFile(sect_file, fasta_header, fasta_index, header, cvs);
             }
-            else if (fasta_index > 0) {
-                getEntryFromFasta(sect_file, fasta_index, header, coverages);
+            else {
+                string coverages;
+                
+                if (!fasta_header.empty()) {
+                    header.assign(fasta_header);
+                    getEntryFromFasta(sect_file, header, coverages);
+                }
+                else if (fasta_index > 0) {
+                    getEntryFromFasta(sect_file, fasta_index, header, coverages);
+                }
+                
+                // Split coverages
+                if (coverages.length() > 0)
+                    cvs = kat::splitUInt32(coverages, ' ');
             }
 
-            if (coverages.length() == 0) {
+            if (cvs.empty()) {
                 cerr << "Could not find requested fasta header in sect coverages fasta file" << endl;
             }
             else {
                 if (verbose)
-                    cerr << "Found requested sequence : " << header << endl << coverages << endl << endl;
-
-                // Split coverages
-                vector<uint32_t> cvs = kat::splitUInt32(coverages, ' ');
+                    cerr << "Found requested sequence : " << header << " (" << cvs.size() << " K-mers)" << endl << endl;
 
                 uint32_t maxCvgVal = y_max != DEFAULT_Y_MAX ? y_max : (*(std::max_element(cvs.begin(), cvs.end())) + 1);
 
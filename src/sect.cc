@@ -16,11 +16,15 @@
 //  *******************************************************************
 
 #include <iostream>
+#include <fstream>
 #include <string.h>
 #include <stdint.h>
 #include <vector>
 #include <math.h>
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <thread>
 using std::vector;
 using std::string;
@@ -31,6 +35,9 @@ using std::shared_ptr;
 using std::make_shared;
 using std::thread;
 using std::ofstream;
+using std::unique_lock;
+using std::lock_guard;
+using std::mutex;
 
 #include <seqan/basic.h>
 #include <seqan/sequence.h>
@@ -51,12 +58,29 @@ using boost::lexical_cast;
 
 #include "inc/matrix/matrix_metadata_extractor.hpp"
 #include "inc/matrix/threaded_sparse_matrix.hpp"
+#include "inc/rolling_mer.hpp"
+using kat::RollingMer;
 
 #include "sect.hpp"
 
 kat::Sect::Sect(const vector<path> _counts_files, const path _seq_file) {
-    input.input = _counts_files;
-    input.index = 1;
+    vector<vector<path>> counts_files;
+    counts_files.push_back(_counts_files);
+    init(counts_files, _seq_file);
+}
+
+kat::Sect::Sect(const vector<vector<path>>& _counts_files, const path _seq_file) {
+    init(_counts_files, _seq_file);
+}
+
+void kat::Sect::init(const vector<vector<path>>& _counts_files, const path& _seq_file) {
+    input = vector<InputHandler>(_counts_files.size());
+    
+    for(uint16_t i = 0; i < _counts_files.size(); i++) {
+        input[i].setMultipleInputs(_counts_files[i]);
+        input[i].index = i + 1;
+    }
+    
     seqFile = _seq_file;
     outputPrefix = "kat-sect";
     gcBins = 1001;
@@ -64,9 +88,112 @@ kat::Sect::Sect(const vector<path> _counts_files, const path _seq_file) {
     cvgLogscale = false;
     threads = 1;
     merLen = DEFAULT_MER_LEN;
+    chunkSize = DEFAULT_CHUNK_SIZE;
     noCountStats = false;
+    binaryCounts = false;
+    window = 0;
+    sample = 1;
+    prefilter = false;
     verbose = false;
-    contamination_mx = nullptr;
+    nbBatchesRead = 0;
+    nbBatchesWritten = 0;
+    readingDone = false;
+    readerError = nullptr;
+}
+
+void kat::SectBatch::reset(uint64_t _id) {
+    id = _id;
+    seqan::clear(names);
+    seqan::clear(seqs);
+    complete = false;
+}
+
+void kat::SectBatch::init(uint16_t nbWorkers, uint16_t _nbHashes, uint16_t merLen, uint64_t chunkSize, uint32_t window, bool keepCounts) {
+    const size_t n = size();
+    nbHashes = _nbHashes;
+    medians.resize(n * nbHashes);
+    means.resize(n * nbHashes);
+    gcs.resize(n);
+    lengths.resize(n);
+    nonZero.resize(n * nbHashes);
+    percentNonZero.resize(n * nbHashes);
+    invalid.resize(n);
+    percentInvalid.resize(n);
+    percentNonZeroCorrected.resize(n * nbHashes);
+    estimates.resize(n * nbHashes);
+    nbSampled.resize(n);
+    
+    // Split each sequence into chunks of K-mer windows.  Sequences too short to
+    // contain any K-mers still get a single empty chunk so their GC is calculated.
+    chunks.clear();
+    firstChunk.resize(n + 1);
+    
+    if (n > chunksRemainingSize) {
+        chunksRemaining.reset(new std::atomic<uint32_t>[n]);
+        chunksRemainingSize = n;
+    }
+    
+    countOffsets.clear();
+    uint64_t nbCountsTotal = 0;
+    
+    // Keep windows within a single chunk
+    if (window > 0) {
+        chunkSize = ((chunkSize + window - 1) / window) * window;
+    }
+    
+    for(size_t i = 0; i < n; i++) {
+        
+        const uint64_t seqLength = seqan::length(seqs[i]);
+        const uint64_t nbCounts = seqLength < merLen ? 0 : seqLength - merLen + 1;
+        
+        firstChunk[i] = chunks.size();
+        
+        uint64_t start = 0;
+        do {
+            const uint64_t end = std::min(start + chunkSize, nbCounts);
+            chunks.push_back({(uint32_t)i, start, end, end == nbCounts});
+            start = end;
+        } while (start < nbCounts);
+        
+        chunksRemaining[i] = chunks.size() - firstChunk[i];
+        
+        if (keepCounts) {
+            countOffsets.push_back(nbCountsTotal);
+            nbCountsTotal += nbCounts;
+        }
+    }
+    
+    firstChunk[n] = chunks.size();
+    
+    // Only grow the count arena, every count is written before being read so it
+    // doesn't need initialising
+    if (keepCounts) {
+        countOffsets.push_back(nbCountsTotal);
+        
+        if (nbCountsTotal * nbHashes > countArenaSize) {
+            countArenaSize = nbCountsTotal * nbHashes;
+            countArena.reset(new uint32_t[countArenaSize]);
+        }
+    }
+    chunkResults.resize(chunks.size());
+    
+    // Hand out the largest chunks first, so that long sequences are started early
+    // and the short ones fill in the gaps at the end of the batch
+    vector<uint64_t> chunkBases(chunks.size());
+    for(size_t i = 0; i < chunks.size(); i++) {
+        const SectChunk& c = chunks[i];
+        chunkBases[i] = (c.last ? seqan::length(seqs[c.seqIndex]) : c.end) - c.start;
+    }
+    
+    order.resize(chunks.size());
+    for(size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return chunkBases[a] > chunkBases[b]; });
+    nextChunk = 0;
+    
+    workersRemaining = nbWorkers;
+    complete = false;
 }
 
         
@@ -77,11 +204,22 @@ void kat::Sect::execute() {
                 "Could not find sequence file at: " + seqFile.string() + "; please check the path and try again.")));
     }
 
-    bucket_size = BATCH_SIZE / threads;
-    remaining = BATCH_SIZE % (bucket_size < 1 ? 1 : threads);
-
     // Validate input
-    input.validateInput();
+    for(auto& i : input) {
+        i.validateInput();
+    }
+    
+    if (sample > 1 && window > 0) {
+        BOOST_THROW_EXCEPTION(SectException() << SectErrorInfo(string(
+                "Sampling cannot be combined with window mode")));
+    }
+    
+    // Find the requested regions before doing any heavy lifting, so that mistakes 
+    // in the regions file are reported straight away
+    regions.clear();
+    if (!regionsFile.empty()) {
+        loadRegions();
+    }
     
     // Create output directory
     path parentDir = bfs::absolute(outputPrefix).parent_path();
@@ -92,25 +230,54 @@ void kat::Sect::execute() {
         }
     }
     
-    // Either count or load input
-    if (input.mode == InputHandler::InputHandler::InputMode::COUNT) {
-        input.count(merLen, threads);
+    // Count kmers in sequence files if necessary
+    bool allLoad = true;
+    for(auto& i : input) {
+        if (i.mode == InputHandler::InputHandler::InputMode::COUNT) {
+            i.count(merLen, threads);
+            allLoad = false;
+        }
+        else {
+            i.loadHeader();
+        }
     }
-    else {
-        input.loadHeader();
-        input.loadHash(true);                
+    
+    // If all hashes are loaded directly the K-mer length comes from the first hash
+    if (allLoad) merLen = input[0].header->key_len() / 2;
+    
+    for(auto& i : input) {
+        i.validateMerLen(merLen);
+    }
+    
+    // Load any hashes
+    for(auto& i : input) {
+        if (i.mode == InputHandler::InputMode::LOAD) {
+            i.loadHash(true);
+        }
+    }
+    
+    // Optionally build a filter over each hash to speed up lookups of absent K-mers
+    if (prefilter) {
+        for(auto& i : input) {
+            i.buildFilter(threads);
+        }
     }
 
-    contamination_mx = make_shared<ThreadedSparseMatrix>(gcBins, cvgBins, threads);
+    contamination_mx.clear();
+    for(size_t i = 0; i < input.size(); i++) {
+        contamination_mx.push_back(make_shared<ThreadedSparseMatrix>(gcBins, cvgBins, threads));
+    }
 
     // Do the core of the work here
     processSeqFile();
 
     // Dump any hashes that were previously counted to disk if requested
     // NOTE: MUST BE DONE AFTER COMPARISON AS THIS CLEARS ENTRIES FROM HASH ARRAY!
-    if (input.dumpHash) {
-        path outputPath(outputPrefix.string() + "-hash.jf" + lexical_cast<string>(merLen));
-        input.dump(outputPath, threads, true);     
+    for(uint16_t h = 0; h < input.size(); h++) {
+        if (input[h].dumpHash) {
+            path outputPath(outputPrefix.string() + "-hash" + (input.size() > 1 ? lexical_cast<string>(input[h].index) : "") + ".jf" + lexical_cast<string>(merLen));
+            input[h].dump(outputPath, threads, true);
+        }
     }
     
     // Merge results from contamination matrix
@@ -124,15 +291,150 @@ void kat::Sect::save() {
     cout << "Saving results to disk ...";
     cout.flush();
     
-    // Send contamination matrix to file
-    ofstream contamination_mx_stream(string(outputPrefix.string() + "-contamination.mx").c_str());
-    printContaminationMatrix(contamination_mx_stream, seqFile);
-    contamination_mx_stream.close();  
+    // Send contamination matrices to file
+    for(uint16_t h = 0; h < input.size(); h++) {
+        ofstream contamination_mx_stream(string(outputPrefix.string() + "-contamination" + getFileSuffix(h) + ".mx").c_str());
+        printContaminationMatrix(contamination_mx_stream, seqFile, h);
+        contamination_mx_stream.close();
+    }
     
     cout << " done.";
     cout.flush();
 }
 
+void kat::Sect::loadRegions() {
+    
+    if (!bfs::exists(regionsFile)) {
+        BOOST_THROW_EXCEPTION(SectException() << SectErrorInfo(string(
+                "Could not find regions file at: " + regionsFile.string() + "; please check the path and try again.")));
+    }
+    
+    // Use the existing FastA index if there is one, otherwise build it and try to 
+    // keep it for next time
+    const path faiFile(seqFile.string() + ".fai");
+    
+    if (!bfs::exists(faiFile) || !seqan::open(faiIndex, seqFile.c_str(), faiFile.c_str())) {
+        
+        cout << "Building FastA index for " << seqFile.string() << " ...";
+        cout.flush();
+        
+        if (!seqan::build(faiIndex, seqFile.c_str(), faiFile.c_str())) {
+            BOOST_THROW_EXCEPTION(SectException() << SectErrorInfo(string(
+                    "Could not build FastA index for: ") + seqFile.string() + ".  Regions can only be used with uncompressed FastA files."));
+        }
+        
+        if (!seqan::save(faiIndex, faiFile.c_str())) {
+            cerr << endl << "WARNING: Could not save FastA index to " << faiFile.string() << endl;
+        }
+        
+        cout << " done." << endl << endl;
+    }
+    
+    std::ifstream in(regionsFile.c_str());
+    string line;
+    
+    while (std::getline(in, line)) {
+        
+        // Files written on Windows end each line with a carriage return
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        
+        boost::trim(line);
+        
+        if (line.empty() || line[0] == '#')
+            continue;
+        
+        SectRegion r;
+        string seqName;
+        bool hasRange = false;
+        
+        if (line.find('\t') != string::npos) {
+            
+            // BED: name, 0-based start and exclusive end
+            vector<string> parts;
+            boost::split(parts, line, boost::is_any_of("\t"));
+            
+            if (parts.size() < 3) {
+                BOOST_THROW_EXCEPTION(SectException() << SectErrorInfo(string(
+                        "Expected at least three columns in BED line: ") + line));
+            }
+            
+            seqName = parts[0];
+            
+            try {
+                r.start = lexical_cast<uint64_t>(boost::trim_copy(parts[1]));
+                r.end = lexical_cast<uint64_t>(boost::trim_copy(parts[2]));
+            }
+            catch(boost::bad_lexical_cast&) {
+                BOOST_THROW_EXCEPTION(SectException() << SectErrorInfo(string(
+                        "Could not parse region: ") + line));
+            }
+            
+            hasRange = true;
+        }
+        else {
+            
+            // Either a whole sequence or <name>:<start>-<end>, with 1-based inclusive 
+            // positions as used by samtools.  Sequence names may themselves contain 
+            // colons, so a whole name match takes priority.
+            seqName = line;
+            unsigned id = 0;
+            const size_t colon = line.rfind(':');
+            
+            if (!seqan::getIdByName(id, faiIndex, seqName) && colon != string::npos) {
+                
+                seqName = line.substr(0, colon);
+                string range = boost::erase_all_copy(line.substr(colon + 1), ",");
+                vector<string> parts;
+                boost::split(parts, range, boost::is_any_of("-"));
+                
+                try {
+                    r.start = lexical_cast<uint64_t>(parts[0]) - 1;
+                    r.end = parts.size() > 1 ? lexical_cast<uint64_t>(parts[1]) : std::numeric_limits<uint64_t>::max();
+                }
+                catch(boost::bad_lexical_cast&) {
+                    BOOST_THROW_EXCEPTION(SectException() << SectErrorInfo(string(
+                            "Could not parse region: ") + line));
+                }
+                
+                hasRange = true;
+            }
+        }
+        
+        unsigned id = 0;
+        if (!seqan::getIdByName(id, faiIndex, seqName)) {
+            BOOST_THROW_EXCEPTION(SectException() << SectErrorInfo(string(
+                    "Could not find sequence ") + seqName + " in " + seqFile.string()));
+        }
+        
+        const uint64_t seqLength = seqan::sequenceLength(faiIndex, id);
+        r.seqId = id;
+        
+        if (hasRange) {
+            r.end = std::min(r.end, seqLength);
+            
+            if (r.start >= r.end) {
+                BOOST_THROW_EXCEPTION(SectException() << SectErrorInfo(string(
+                        "Region is empty or lies beyond the end of the sequence: ") + line));
+            }
+            
+            r.name = seqName + ":" + lexical_cast<string>(r.start + 1) + "-" + lexical_cast<string>(r.end);
+        }
+        else {
+            r.start = 0;
+            r.end = seqLength;
+            r.name = seqName;
+        }
+        
+        regions.push_back(r);
+    }
+    
+    if (regions.empty()) {
+        BOOST_THROW_EXCEPTION(SectException() << SectErrorInfo(string(
+                "No regions found in: ") + regionsFile.string()));
+    }
+}
+
 void kat::Sect::processSeqFile() {
     
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");     
@@ -140,163 +442,348 @@ void kat::Sect::processSeqFile() {
     cout << "Calculating kmer coverage across sequences ...";
     cout.flush();
     
-    // Setup space for storing output
-    offset = 0;
-    recordsInBatch = 0;
-
-    names = seqan::StringSet<seqan::CharString>();
-    seqs = seqan::StringSet<seqan::CharString>();
-    
-    // Open file, create RecordReader and check all is well
-    seqan::SeqFileIn reader(seqFile.c_str());
-
-    // Setup output stream for jellyfish initialisation
-    std::ostream* out_stream = verbose ? &cerr : (std::ostream*)0;
-
+    // Reset pipeline state
+    batches.clear();
+    freeBatches.clear();
+    workspaces.clear();
+    workspaces.resize(threads);
+    for(auto& w : workspaces) {
+        w.hists.resize(input.size());
+        w.windowHists.resize(input.size());
+        w.windowCoverage.resize(input.size());
+        w.counts.resize(input.size());
+    }
+    nbBatchesRead = 0;
+    nbBatchesWritten = 0;
+    readingDone = false;
+    readerError = nullptr;
     
     // Setup output streams for files
     if (verbose)
-        *out_stream << endl;
+        cerr << endl;
+
+    // Sequence K-mer counts output streams, one per input
+    vector<shared_ptr<ofstream>> count_path_streams;
+    vector<shared_ptr<CoverageWriter>> count_binary_streams;
+    vector<std::ostream*> countsOut;
+    vector<CoverageWriter*> binaryCountsOut;
+    if (!noCountStats && window == 0 && sample <= 1) {
+        for(uint16_t h = 0; h < input.size(); h++) {
+            if (binaryCounts) {
+                count_binary_streams.push_back(make_shared<CoverageWriter>(path(outputPrefix.string() + "-counts" + getFileSuffix(h) + ".cvgb")));
+                binaryCountsOut.push_back(count_binary_streams.back().get());
+            }
+            else {
+                count_path_streams.push_back(make_shared<ofstream>(string(outputPrefix.string() + "-counts" + getFileSuffix(h) + ".cvg").c_str()));
+                countsOut.push_back(count_path_streams.back().get());
+            }
+        }
+    }
 
-    // Sequence K-mer counts output stream
-    shared_ptr<ofstream> count_path_stream = nullptr;
-    if (!noCountStats) {
-        count_path_stream = make_shared<ofstream>(string(outputPrefix.string() + "-counts.cvg").c_str());
+    // Coverage in windows along each sequence
+    shared_ptr<ofstream> window_stream = nullptr;
+    if (window > 0) {
+        window_stream = make_shared<ofstream>(string(outputPrefix.string() + "-windows.bed").c_str());
+        *window_stream << "#seq_name\tstart\tend";
+        for(uint16_t h = 0; h < input.size(); h++) {
+            *window_stream << "\tmedian" << getColumnSuffix(h) << "\tmean" << getColumnSuffix(h);
+        }
+        *window_stream << "\tgc%\tinvalid_bases\t%_invalid";
+        for(uint16_t h = 0; h < input.size(); h++) {
+            *window_stream << "\tnon_zero_bases" << getColumnSuffix(h) << "\t%_non_zero" << getColumnSuffix(h);
+        }
+        *window_stream << endl;
     }
 
     // Average sequence coverage and GC% scores output stream
     ofstream cvg_gc_stream(string(outputPrefix.string() + "-stats.csv").c_str());
-    cvg_gc_stream << "seq_name\tmedian\tmean\tgc%\tseq_length\tinvalid_bases\t%_invalid\tnon_zero_bases\t%_non_zero\t%_non_zero_corrected" << endl;
+    cvg_gc_stream << "seq_name";
+    for(uint16_t h = 0; h < input.size(); h++) {
+        cvg_gc_stream << "\tmedian" << getColumnSuffix(h) << "\tmean" << getColumnSuffix(h);
+    }
+    cvg_gc_stream << "\tgc%\tseq_length\tinvalid_bases\t%_invalid";
+    for(uint16_t h = 0; h < input.size(); h++) {
+        cvg_gc_stream << "\tnon_zero_bases" << getColumnSuffix(h) << "\t%_non_zero" << getColumnSuffix(h) << "\t%_non_zero_corrected" << getColumnSuffix(h);
+    }
+    if (sample > 1) {
+        cvg_gc_stream << "\tsampled_kmers";
+        for(uint16_t h = 0; h < input.size(); h++) {
+            const string c = getColumnSuffix(h);
+            cvg_gc_stream << "\tmedian_low" << c << "\tmedian_high" << c << "\tmean_low" << c << "\tmean_high" << c 
+                          << "\t%_non_zero_low" << c << "\t%_non_zero_high" << c;
+        }
+    }
+    cvg_gc_stream << endl;
     
-    // Processes sequences in batches of records to reduce memory requirements
-    while (!seqan::atEnd(reader)) {
-        if (verbose)
-            *out_stream << "Loading Batch of sequences... ";
-
-        seqan::clear(names);
-        seqan::clear(seqs);
-
-        seqan::readRecords(names, seqs, reader, BATCH_SIZE);
-
-        recordsInBatch = seqan::length(names);
-
-        if (verbose)
-            *out_stream << "Loaded " << recordsInBatch << " records.  Processing batch... ";
-
-        // Allocate memory for output produced by this batch
-        createBatchVars(recordsInBatch);
-
-        // Process batch with worker threads
-        // Process each sequence is processed in a different thread.
-        // In each thread lookup each K-mer in the hash
-        analyseBatch();
-
-        // Output counts for this batch if (not not) requested
-        if (!noCountStats)
-            printCounts(*count_path_stream);
-
-        // Output stats
-        printStatTable(cvg_gc_stream);
-
-        // Remove any batch specific variables from memory
-        destroyBatchVars();
-
-        // Increment batch management vars
-        offset += recordsInBatch;
-
-        if (verbose)
-            *out_stream << "done" << endl;
+    // Sequences are streamed through a pipeline so that reading, analysis and 
+    // writing overlap.  One thread reads batches of records, a pool of workers
+    // analyses them, and this thread writes out each batch once it is complete, 
+    // in the same order as the input.  The number of batches in memory at any one
+    // time is bounded by MAX_BATCHES_IN_FLIGHT.
+    thread reader(&Sect::readBatches, this);
+    
+    thread t[threads];
+    for(uint16_t i = 0; i < threads; i++) {
+        t[i] = thread(&Sect::analyseBatches, this, i);
     }
-
+    
+    writeBatches(countsOut, binaryCountsOut, window_stream.get(), cvg_gc_stream);
+    
+    reader.join();
+    for(uint16_t i = 0; i < threads; i++) {
+        t[i].join();
+    }
+    
     // Close output streams
-    if (!noCountStats) {
-        count_path_stream->close();                
+    for(auto& c : count_path_streams) {
+        c->close();
+    }
+    
+    for(auto& c : count_binary_streams) {
+        c->close();
+    }
+    
+    if (window_stream) {
+        window_stream->close();
     }
-
-    seqan::close(reader);
 
     cvg_gc_stream.close();
     
+    // Pass on any problems encountered while reading the sequence file
+    if (readerError) {
+        std::rethrow_exception(readerError);
+    }
+    
     cout << " done.";
     cout.flush();
 }
 
-void kat::Sect::merge() {
-    
-    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");     
+void kat::Sect::readBatches() {
     
-    cout << "Merging matrices ...";
-    cout.flush();
+    try {
+        // Open file, create RecordReader and check all is well.  Regions are read 
+        // through the FastA index instead.
+        seqan::SeqFileIn reader;
+        std::ifstream regionReader;
+        if (regions.empty() && !seqan::open(reader, seqFile.c_str())) {
+            BOOST_THROW_EXCEPTION(SectException() << SectErrorInfo(string(
+                    "Could not open sequence file: ") + seqFile.string()));
+        }
+        
+        if (!regions.empty()) {
+            regionReader.open(seqFile.c_str(), std::ios::binary);
+        }
+        
+        size_t nextRegion = 0;
+        
+        // Processes sequences in batches of records to reduce memory requirements
+        for(uint64_t id = 0; regions.empty() ? !seqan::atEnd(reader) : nextRegion < regions.size(); id++) {
+            
+            // Wait for the writer to catch up if too many batches are in memory, then
+            // reuse a batch that has already been written if possible
+            shared_ptr<SectBatch> batch = nullptr;
+            {
+                unique_lock<mutex> lk(mu);
+                cv.wait(lk, [&]{ return id - nbBatchesWritten < MAX_BATCHES_IN_FLIGHT; });
+                
+                if (!freeBatches.empty()) {
+                    batch = freeBatches.back();
+                    freeBatches.pop_back();
+                }
+            }
+            
+            if (batch == nullptr)
+                batch = make_shared<SectBatch>();
+            
+            batch->reset(id);
+            if (regions.empty())
+                seqan::readRecords(batch->names, batch->seqs, reader, BATCH_SIZE);
+            else
+                nextRegion = readRegions(regionReader, *batch, nextRegion);
+            batch->init(threads, input.size(), merLen, chunkSize, window, !noCountStats && window == 0 && sample <= 1);
+            
+            if (verbose)
+                cerr << "Loaded batch " << id << " containing " << batch->size() << " records" << endl;
+            
+            {
+                lock_guard<mutex> lk(mu);
+                batches[id] = batch;
+                nbBatchesRead++;
+            }
+            cv.notify_all();
+        }
+        
+        if (regions.empty())
+            seqan::close(reader);
+    }
+    catch(...) {
+        lock_guard<mutex> lk(mu);
+        readerError = std::current_exception();
+    }
     
-    contamination_mx->mergeThreadedMatricies();
-    cout << " done.";
-    cout.flush();
+    {
+        lock_guard<mutex> lk(mu);
+        readingDone = true;
+    }
+    cv.notify_all();
 }
 
-void kat::Sect::analyseBatch() {
-
-    thread t[threads];
-
-    for(int i = 0; i < threads; i++) {
-        t[i] = thread(&Sect::analyseBatchSlice, this, i);
+size_t kat::Sect::readRegions(std::istream& in, SectBatch& batch, size_t nextRegion) {
+    
+    string buffer;
+    seqan::CharString seq;
+    
+    const size_t end = std::min<size_t>(nextRegion + BATCH_SIZE, regions.size());
+    
+    for(size_t i = nextRegion; i < end; i++) {
+        
+        const SectRegion& r = regions[i];
+        const seqan::FaiIndexEntry_& entry = faiIndex.indexEntryStore[r.seqId];
+        
+        // Every line but the last holds the same number of bases, so the file 
+        // offset of any base can be calculated directly
+        auto offsetOf = [&entry](uint64_t pos) { 
+            return entry.offset + (pos / entry.lineLength) * entry.overallLineLength + pos % entry.lineLength; 
+        };
+        
+        const uint64_t from = offsetOf(r.start);
+        const uint64_t to = offsetOf(r.end - 1) + 1;
+        
+        buffer.resize(to - from);
+        in.seekg(from);
+        in.read(&buffer[0], to - from);
+        
+        if (!in) {
+            BOOST_THROW_EXCEPTION(SectException() << SectErrorInfo(string(
+                    "Could not read region ") + r.name + " from " + seqFile.string() + ".  Perhaps the FastA index is out of date?"));
+        }
+        
+        // Drop the line breaks
+        seqan::clear(seq);
+        seqan::reserve(seq, r.end - r.start);
+        for(char c : buffer) {
+            if (c != '\n' && c != '\r')
+                seqan::appendValue(seq, c);
+        }
+        
+        seqan::appendValue(batch.names, r.name.c_str());
+        seqan::appendValue(batch.seqs, seq);
     }
-
-    for(int i = 0; i < threads; i++){
-        t[i].join();
-    }            
+    
+    return end;
 }
 
-void kat::Sect::analyseBatchSlice(int th_id) {
-    // Check to see if we have useful work to do for this thread, return if not
-    if (bucket_size < 1 && th_id >= recordsInBatch) {
-        return;
+void kat::Sect::analyseBatches(uint16_t th_id) {
+    
+    // Each worker visits every batch in turn, processing its share of the sequences
+    for(uint64_t id = 0; ; id++) {
+        
+        shared_ptr<SectBatch> batch = nullptr;
+        
+        {
+            unique_lock<mutex> lk(mu);
+            cv.wait(lk, [&]{ return id < nbBatchesRead || readingDone; });
+            
+            // No more batches to process
+            if (id >= nbBatchesRead)
+                return;
+            
+            batch = batches[id];
+        }
+        
+        // Take chunks from the batch until there are none left, so that no worker 
+        // sits idle while another is still busy with a long sequence
+        for (size_t i = batch->nextChunk++; i < batch->order.size(); i = batch->nextChunk++) {
+            processChunk(*batch, batch->order[i], th_id);
+        }
+        
+        // The last worker to finish with a batch hands it to the writer
+        if (--batch->workersRemaining == 0) {
+            {
+                lock_guard<mutex> lk(mu);
+                batch->complete = true;
+            }
+            cv.notify_all();
+        }
     }
-
-    //processInBlocks(th_id);
-    processInterlaced(th_id);
 }
 
-void kat::Sect::destroyBatchVars() {
-    for (uint16_t i = 0; i < counts->size(); i++) {
-        counts->at(i)->clear();
-    }
-    counts->clear();            
-    medians->clear();
-    means->clear();
-    gcs->clear();
-    lengths->clear();
-    invalid->clear();
-    percentInvalid->clear();
-    nonZero->clear();
-    percentNonZero->clear();
-    percentNonZeroCorrected->clear();
+void kat::Sect::writeBatches(const vector<std::ostream*>& countsOut, const vector<CoverageWriter*>& binaryCountsOut, std::ostream* windowsOut, std::ostream& statsOut) {
     
+    while(true) {
+        
+        shared_ptr<SectBatch> batch = nullptr;
+        
+        {
+            unique_lock<mutex> lk(mu);
+            cv.wait(lk, [&]{ 
+                auto it = batches.find(nbBatchesWritten);
+                return (it != batches.end() && it->second->complete) || 
+                        (readingDone && nbBatchesWritten >= nbBatchesRead); 
+            });
+            
+            auto it = batches.find(nbBatchesWritten);
+            
+            // All batches written
+            if (it == batches.end())
+                return;
+            
+            batch = it->second;
+        }
+        
+        // Output counts for this batch if (not not) requested
+        for(uint16_t h = 0; h < countsOut.size(); h++)
+            printCounts(*countsOut[h], *batch, h);
+        
+        for(uint16_t h = 0; h < binaryCountsOut.size(); h++)
+            printCounts(*binaryCountsOut[h], *batch, h);
+        
+        if (windowsOut != nullptr)
+            printWindows(*windowsOut, *batch);
+
+        // Output stats
+        printStatTable(statsOut, *batch);
+        
+        if (verbose)
+            cerr << "Written batch " << batch->id << endl;
+        
+        // Recycle the batch and let the reader know there is space for another
+        {
+            lock_guard<mutex> lk(mu);
+            batches.erase(batch->id);
+            freeBatches.push_back(batch);
+            nbBatchesWritten++;
+        }
+        cv.notify_all();
+    }
 }
 
-void kat::Sect::createBatchVars(uint16_t batchSize) {
-    counts = make_shared<vector<shared_ptr<vector<uint64_t>>>>(batchSize);
-    medians = make_shared<vector<uint32_t>>(batchSize);
-    means = make_shared<vector<double>>(batchSize);
-    gcs = make_shared<vector<double>>(batchSize);
-    lengths = make_shared<vector<uint32_t>>(batchSize);
-    invalid = make_shared<vector<uint32_t>>(batchSize);
-    percentInvalid = make_shared<vector<double>>(batchSize);
-    nonZero = make_shared<vector<uint32_t>>(batchSize);
-    percentNonZero = make_shared<vector<double>>(batchSize);
-    percentNonZeroCorrected = make_shared<vector<double>>(batchSize);    
+void kat::Sect::merge() {
+    
+    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");     
+    
+    cout << "Merging matrices ...";
+    cout.flush();
+    
+    for(auto& mx : contamination_mx) {
+        mx->mergeThreadedMatricies();
+    }
+    cout << " done.";
+    cout.flush();
 }
 
-void kat::Sect::printCounts(std::ostream &out) {
-    for (uint32_t i = 0; i < recordsInBatch; i++) {
-        out << ">" << seqan::toCString(names[i]) << endl;
+void kat::Sect::printCounts(std::ostream &out, const SectBatch& batch, const uint16_t h) {
+    for (uint32_t i = 0; i < batch.size(); i++) {
+        out << ">" << seqan::toCString(batch.names[i]) << endl;
 
-        shared_ptr<vector<uint64_t>> seqCounts = counts->at(i);
+        const uint32_t* seqCounts = batch.getCounts(i, h);
+        const uint64_t nbCounts = batch.getNbCounts(i);
 
-        if (seqCounts != NULL && !seqCounts->empty()) {
-            out << seqCounts->at(0);
+        if (nbCounts > 0) {
+            out << seqCounts[0];
 
-            for (size_t j = 1; j < seqCounts->size(); j++) {
-                out << " " << seqCounts->at(j);
+            for (size_t j = 1; j < nbCounts; j++) {
+                out << " " << seqCounts[j];
             }
 
             out << endl;
@@ -306,30 +793,101 @@ void kat::Sect::printCounts(std::ostream &out) {
     }
 }
 
-void kat::Sect::printStatTable(std::ostream &out) {
+void kat::Sect::printCounts(CoverageWriter &out, const SectBatch& batch, const uint16_t h) {
+    for (uint32_t i = 0; i < batch.size(); i++) {
+        out.write(seqan::toCString(batch.names[i]), batch.getCounts(i, h), batch.getNbCounts(i));
+    }
+}
+
+void kat::Sect::printWindows(std::ostream &out, const SectBatch& batch) {
+    
+    out << std::fixed << std::setprecision(5);
+    
+    const uint16_t nbHashes = batch.nbHashes;
+    
+    for (uint32_t i = 0; i < batch.size(); i++) {
+        for (uint32_t j = batch.firstChunk[i]; j < batch.firstChunk[i + 1]; j++) {
+            const SectChunkResult& result = batch.chunkResults[j];
+            
+            for (size_t k = 0; k < result.windows.size(); k++) {
+                
+                const SectWindow& w = result.windows[k];
+                const SectCoverage* cvg = &result.windowCoverage[k * nbHashes];
+                const uint64_t acgt = w.end - w.start - w.nbN;
+                
+                out << batch.names[i] << "\t"
+                    << w.start << "\t"
+                    << w.end;
+                
+                for (uint16_t h = 0; h < nbHashes; h++) {
+                    out << "\t" << cvg[h].median << "\t"
+                        << (w.nbKmers == 0 ? 0.0 : (double)cvg[h].sum / (double)w.nbKmers);
+                }
+                
+                out << "\t" << (acgt == 0 ? 0.0 : (double)w.nbGC / (double)acgt) << "\t"
+                    << w.nbInvalid << "\t"
+                    << (w.nbKmers == 0 ? 0.0 : ((double)w.nbInvalid / (double)w.nbKmers) * 100.0);
+                
+                for (uint16_t h = 0; h < nbHashes; h++) {
+                    out << "\t" << cvg[h].nbNonZero << "\t"
+                        << (w.nbKmers == 0 ? 0.0 : ((double)cvg[h].nbNonZero / (double)w.nbKmers) * 100.0);
+                }
+                
+                out << endl;
+            }
+        }
+    }
+}
+
+void kat::Sect::printStatTable(std::ostream &out, const SectBatch& batch) {
     
     out << std::fixed << std::setprecision(5);
     
-    for (uint32_t i = 0; i < recordsInBatch; i++) {
-        out << names[i] << "\t"
-            << (*medians)[i] << "\t" 
-            << (*means)[i] << "\t" 
-            << (*gcs)[i] << "\t" 
-            << (*lengths)[i] << "\t" 
-            << (*invalid)[i] << "\t"
-            << (*percentInvalid)[i] << "\t"
-            << (*nonZero)[i] << "\t"
-            << (*percentNonZero)[i] << "\t"
-            << (*percentNonZeroCorrected)[i] << endl;
+    const uint16_t nbHashes = batch.nbHashes;
+    
+    for (uint32_t i = 0; i < batch.size(); i++) {
+        out << batch.names[i];
+        
+        for (size_t k = i * nbHashes; k < (i + 1) * nbHashes; k++) {
+            out << "\t" << batch.medians[k] 
+                << "\t" << batch.means[k];
+        }
+        
+        out << "\t" << batch.gcs[i]
+            << "\t" << batch.lengths[i]
+            << "\t" << batch.invalid[i]
+            << "\t" << batch.percentInvalid[i];
+        
+        for (size_t k = i * nbHashes; k < (i + 1) * nbHashes; k++) {
+            out << "\t" << batch.nonZero[k]
+                << "\t" << batch.percentNonZero[k]
+                << "\t" << batch.percentNonZeroCorrected[k];
+        }
+        
+        if (sample > 1) {
+            out << "\t" << batch.nbSampled[i];
+            
+            for (size_t k = i * nbHashes; k < (i + 1) * nbHashes; k++) {
+                const SectEstimate& e = batch.estimates[k];
+                out << "\t" << e.medianLow
+                    << "\t" << e.medianHigh
+                    << "\t" << e.meanLow
+                    << "\t" << e.meanHigh
+                    << "\t" << e.percentNonZeroLow
+                    << "\t" << e.percentNonZeroHigh;
+            }
+        }
+        
+        out << endl;
     }
 }
 
 // Print K-mer comparison matrix
 
-void kat::Sect::printContaminationMatrix(std::ostream &out, const path seqFile) {
-    SM64 mx = contamination_mx->getFinalMatrix();
+void kat::Sect::printContaminationMatrix(std::ostream &out, const path seqFile, const uint16_t h) {
+    SM64 mx = contamination_mx[h]->getFinalMatrix();
 
-    out << mme::KEY_TITLE << "Contamination Plot for " << seqFile.string() << " and " << hashFile << endl;
+    out << mme::KEY_TITLE << "Contamination Plot for " << seqFile.string() << " and " << boost::trim_copy(input[h].pathString()) << endl;
     out << mme::KEY_X_LABEL << "GC%" << endl;
     out << mme::KEY_Y_LABEL << "Average K-mer Coverage" << endl;
     out << mme::KEY_Z_LABEL << "Base Count per bin" << endl;
@@ -342,156 +900,338 @@ void kat::Sect::printContaminationMatrix(std::ostream &out, const path seqFile)
     mx.printMatrix(out);
 }
 
-// This method won't be optimal in most cases... Fasta files are normally sorted by length (largest first)
-// So first thread will be asked to do more work than the rest
-
-void kat::Sect::processInBlocks(uint16_t th_id) {
-    size_t start = bucket_size < 1 ? th_id : th_id * bucket_size;
-    size_t end = bucket_size < 1 ? th_id : start + bucket_size - 1;
-    for (size_t i = start; i <= end; i++) {
-        processSeq(i, th_id);
-    }
-
-    // Process a remainder if required
-    if (th_id < remaining) {
-        size_t rem_idx = (threads * bucket_size) + th_id;
-        processSeq(rem_idx, th_id);
-    }
-}
-
-// This method is probably makes more efficient use of multiple cores on a length sorted fasta file
+void kat::Sect::processChunk(SectBatch& batch, const size_t index, const uint16_t th_id) {
 
-void kat::Sect::processInterlaced(uint16_t th_id) {
-    size_t start = th_id;
-    size_t end = recordsInBatch;
-    for (size_t i = start; i < end; i += threads) {
-        processSeq(i, th_id);
+    const SectChunk& chunk = batch.chunks[index];
+    SectChunkResult& result = batch.chunkResults[index];
+    const uint16_t nbHashes = input.size();
+    
+    // Work directly on the characters of the SeqAn string, rolling each K-mer
+    // along the sequence rather than creating it from a substring
+    const seqan::CharString& seq = batch.seqs[chunk.seqIndex];
+    
+    // Histograms are built in this worker's own workspace, so no memory is allocated
+    // here once the workspace has warmed up
+    SectWorkspace& workspace = workspaces[th_id];
+    vector<CountHistogram>& hists = workspace.hists;
+    vector<CountHistogram>& windowHists = workspace.windowHists;
+    vector<SectCoverage>& cvg = workspace.windowCoverage;
+    
+    // Per K-mer counts are not kept in window mode
+    vector<uint32_t*>& seqCounts = workspace.counts;
+    const bool keepCounts = batch.hasCounts();
+    
+    for (uint16_t h = 0; h < nbHashes; h++) {
+        hists[h].reset();
+        windowHists[h].reset();
+        seqCounts[h] = keepCounts ? batch.getCounts(chunk.seqIndex, h) : nullptr;
     }
-}
-
-bool validKmer(const string& merstr) {
-    for(uint32_t i = 0; i < merstr.size(); i++) {        
-        switch(merstr[i]) {
-            case 'A':
-            case 'T':
-            case 'G':
-            case 'C':
-                break;
-            default:
-                return false;
+    
+    // Bases covered by this chunk.  These are the bases that start each K-mer in 
+    // the chunk, with the last chunk also taking the trailing bases, so no base is
+    // counted twice.
+    const uint64_t baseEnd = chunk.last ? seqan::length(seq) : chunk.end;
+    
+    result.nbSampled = 0;
+    result.nbSampledValid = 0;
+    result.nbInvalid = 0;
+    result.nbGC = 0;
+    result.nbN = 0;
+    result.coverage.assign(nbHashes, SectCoverage());
+    result.windows.clear();
+    result.windowCoverage.clear();
+    
+    // Classify every base the chunk touches in one pass.  This includes the K-1 
+    // bases that the chunk's last K-mers share with the next chunk.
+    const uint64_t maskEnd = std::min<uint64_t>(seqan::length(seq), std::max<uint64_t>(baseEnd, chunk.end + merLen - 1));
+    BaseMasks& masks = workspace.masks;
+    masks.classify(seqan::toCString(seq) + chunk.start, maskEnd - chunk.start);
+    
+    // Offsets into the masks are relative to the start of the chunk
+    const uint64_t o = chunk.start;
+    
+    RollingMer mer;
+    
+    // Position of the next base to push onto the rolling K-mer, if it holds the 
+    // bases leading up to it
+    uint64_t nextBase = std::numeric_limits<uint64_t>::max();
+    
+    // Every K-mer is a sample unless sampling is requested
+    const uint64_t stride = std::max<uint32_t>(sample, 1);
+    
+    // Walk the chunk one window at a time.  Chunks always start on a window 
+    // boundary.  Without windows the whole chunk is treated as a single window.
+    const uint64_t step = window > 0 ? window : std::max<uint64_t>(baseEnd - chunk.start, 1);
+    
+    for (uint64_t ws = chunk.start; ws < baseEnd; ws += step) {
+        
+        SectWindow w = {};
+        w.start = ws;
+        w.end = std::min(ws + step, baseEnd);
+        cvg.assign(nbHashes, SectCoverage());
+        
+        const uint64_t kmerEnd = std::min(w.end, chunk.end);
+        
+        uint64_t i = ws;
+        
+        while (i < kmerEnd) {
+            
+            // Find the next K-mer without an invalid base.  Jellyfish compacted hash 
+            // does not support Ns, so the K-mers skipped over all get a count of 0, 
+            // without rolling their bases.
+            uint64_t s = i;
+            while (s < kmerEnd) {
+                const uint64_t bad = o + masks.nextInvalid(s - o, s - o + merLen);
+                if (bad == s + merLen) break;
+                s = bad + 1;
+            }
+            s = std::min(s, kmerEnd);
+            
+            if (s > i) {
+                w.nbInvalid += s - i;
+                
+                // Only the sampled positions count towards the estimates
+                const uint64_t nbZeros = (s + stride - 1) / stride - (i + stride - 1) / stride;
+                result.nbSampled += nbZeros;
+                
+                for (uint16_t h = 0; h < nbHashes; h++) {
+                    if (keepCounts)
+                        std::fill(seqCounts[h] + i, seqCounts[h] + s, 0);
+                    
+                    hists[h].add(0, nbZeros);
+                    
+                    if (window > 0)
+                        windowHists[h].add(0, nbZeros);
+                }
+                
+                i = s;
+                continue;
+            }
+            
+            // Every K-mer up to the next invalid base is valid
+            const uint64_t e = std::min(o + masks.nextInvalid(i - o + merLen, masks.size()) - merLen + 1, kmerEnd);
+            
+            if (nextBase != i + merLen - 1) {
+                mer.reset();
+                for (uint64_t j = i; j < i + merLen - 1; j++) {
+                    mer.push(seq[j]);
+                }
+            }
+            
+            // When sampling, K-mers are only looked up at multiples of the stride, 
+            // so that the choice doesn't depend on how the sequence was chunked
+            uint64_t nextSample = ((i + stride - 1) / stride) * stride;
+            
+            for (; i < e; i++) {
+                
+                mer.push(seq[i + merLen - 1]);
+                
+                if (i != nextSample)
+                    continue;
+                
+                nextSample += stride;
+                result.nbSampled++;
+                result.nbSampledValid++;
+                
+                // Each K-mer is resolved against every input while it is at hand
+                for (uint16_t h = 0; h < nbHashes; h++) {
+
+                    const uint64_t count = JellyfishHelper::getCount(input[h].hash, input[h].filter.get(), mer.get(input[h].canonical), false);
+                    cvg[h].sum += count;
+                    cvg[h].sumSq += (double)count * (double)count;
+                    if (count != 0) cvg[h].nbNonZero++;
+
+                    if (keepCounts)
+                        seqCounts[h][i] = std::min<uint64_t>(count, std::numeric_limits<uint32_t>::max());
+
+                    hists[h].add(count);
+
+                    if (window > 0)
+                        windowHists[h].add(count);
+                }
+            }
+            
+            nextBase = i + merLen - 1;
+        }
+        
+        w.nbGC = masks.countGC(w.start - o, w.end - o);
+        w.nbN = masks.countN(w.start - o, w.end - o);
+        
+        result.nbInvalid += w.nbInvalid;
+        result.nbGC += w.nbGC;
+        result.nbN += w.nbN;
+        
+        for (uint16_t h = 0; h < nbHashes; h++) {
+            result.coverage[h].sum += cvg[h].sum;
+            result.coverage[h].sumSq += cvg[h].sumSq;
+            result.coverage[h].nbNonZero += cvg[h].nbNonZero;
+        }
+        
+        if (window > 0) {
+            w.nbKmers = kmerEnd > ws ? kmerEnd - ws : 0;
+            for (uint16_t h = 0; h < nbHashes; h++) {
+                cvg[h].median = windowHists[h].median();
+                windowHists[h].reset();
+                result.windowCoverage.push_back(cvg[h]);
+            }
+            result.windows.push_back(w);
         }
     }
     
-    return true;
-}
-
-void kat::Sect::processSeq(const size_t index, const uint16_t th_id) {
-
-    // There's no substring functionality in SeqAn in this version (2.0.0).  So we'll just
-    // use regular c++ string's for this bit.  This conversion of strings:
-    // {CharString -> c++ string -> substring -> jellyfish mer_dna} is 
-    // inefficient. Reducing the number of conversions necessary will 
-    // make a big performance improvement here
-    stringstream ssSeq;
-    ssSeq << seqs[index];
-    string seq = ssSeq.str();
-
-    uint64_t seqLength = seq.length();
-    uint64_t nbCounts = seqLength - merLen + 1;
-    double average_cvg = 0.0;
-    uint64_t nbNonZero = 0;
-    uint64_t nbInvalid = 0;
+    const uint32_t firstChunk = batch.firstChunk[chunk.seqIndex];
+    const uint32_t endChunk = batch.firstChunk[chunk.seqIndex + 1];
     
-    if (nbCounts <= 0) {
-
-        // Can't analyse this sequence because it's too short
-        //cerr << names[index] << ": " << seq << " is too short to compute coverage.  Sequence length is "
-        //       << seqLength << " and K-mer length is " << merLen << ". Setting sequence coverage to 0." << endl;
+    if (endChunk - firstChunk == 1) {
+        
+        // Most sequences fit in a single chunk, so can be finished straight away
+        finaliseSeq(batch, chunk.seqIndex, th_id, hists);
+    }
+    else {
         
-        (*counts)[index] = make_shared<vector<uint64_t>>();
-        (*medians)[index] = 0;
-        (*means)[index] = 0.0;
+        // Keep this chunk's histograms until the rest of the sequence is done
+        result.hists.resize(nbHashes);
+        for (uint16_t h = 0; h < nbHashes; h++) {
+            result.hists[h].reset();
+            result.hists[h].merge(hists[h]);
+        }
         
-    } else {
-
-        shared_ptr<vector<uint64_t>> seqCounts = make_shared<vector<uint64_t>>(nbCounts, 0);
-
-        uint64_t sum = 0;
-
-        for (uint64_t i = 0; i < nbCounts; i++) {
-
-            string merstr = seq.substr(i, merLen);
-
-            // Jellyfish compacted hash does not support Ns so if we find one set this mer count to 0
-            if (!validKmer(merstr)) {
-                (*seqCounts)[i] = 0;
-                nbInvalid++;
-            } else {                
-                mer_dna mer(merstr);
-                uint64_t count = JellyfishHelper::getCount(input.hash, mer, input.canonical);
-                sum += count;
-                (*seqCounts)[i] = count;
-                if (count != 0) nbNonZero++;
+        // The worker that completes the last outstanding chunk of a sequence combines the results
+        if (--batch.chunksRemaining[chunk.seqIndex] == 0) {
+            
+            for (uint16_t h = 0; h < nbHashes; h++) {
+                hists[h].reset();
+                for(uint32_t i = firstChunk; i < endChunk; i++) {
+                    hists[h].merge(batch.chunkResults[i].hists[h]);
+
+                    // Long sequences are rare, so don't hold on to their histograms
+                    batch.chunkResults[i].hists[h].clear();
+                }
             }
+            
+            finaliseSeq(batch, chunk.seqIndex, th_id, hists);
         }
+    }
+}
 
-        (*counts)[index] = seqCounts;
+void kat::Sect::finaliseSeq(SectBatch& batch, const size_t index, const uint16_t th_id, vector<CountHistogram>& hists) {
+    
+    const uint64_t seqLength = seqan::length(batch.seqs[index]);
+    const uint64_t nbCounts = batch.chunks[batch.firstChunk[index + 1] - 1].end;
+    const uint16_t nbHashes = batch.nbHashes;
+    
+    // Combine results from each chunk
+    SectChunkResult& total = batch.chunkResults[batch.firstChunk[index]];
+    
+    for(uint32_t i = batch.firstChunk[index] + 1; i < batch.firstChunk[index + 1]; i++) {
+        const SectChunkResult& part = batch.chunkResults[i];
+        total.nbSampled += part.nbSampled;
+        total.nbSampledValid += part.nbSampledValid;
+        total.nbInvalid += part.nbInvalid;
+        total.nbGC += part.nbGC;
+        total.nbN += part.nbN;
         
-        // Create a copy of the counts, and sort it first, then take median value
-        vector<uint64_t> sortedSeqCounts = *seqCounts;                    
-        std::sort(sortedSeqCounts.begin(), sortedSeqCounts.end());
-        (*medians)[index] = (double)(sortedSeqCounts[sortedSeqCounts.size() / 2]);                    
-
-        // Calculate the mean
-        (*means)[index] = (double)sum / (double)nbCounts;                    
+        for (uint16_t h = 0; h < nbHashes; h++) {
+            total.coverage[h].sum += part.coverage[h].sum;
+            total.coverage[h].sumSq += part.coverage[h].sumSq;
+            total.coverage[h].nbNonZero += part.coverage[h].nbNonZero;
+        }
     }
-
+    
+    const uint64_t nbInvalid = total.nbInvalid;
+    
+    // Without sampling every K-mer is a sample, so the estimates below are exact
+    const uint64_t nbSampled = total.nbSampled;
+    const uint64_t nbSampledValid = total.nbSampledValid;
+    batch.nbSampled[index] = nbSampled;
+    
     // Add length
-    (*lengths)[index] = seqLength;
-    (*nonZero)[index] = nbNonZero;
-    (*percentNonZero)[index] = nbNonZero == 0 || nbCounts <= 0 ? 
-        0.0 : 
-        ((double)nbNonZero / (double)nbCounts) * 100.0;
-    (*invalid)[index] = nbInvalid;
-    (*percentInvalid)[index] = nbInvalid == 0 || nbCounts <= 0 ?
+    batch.lengths[index] = seqLength;
+    batch.invalid[index] = nbInvalid;
+    batch.percentInvalid[index] = nbInvalid == 0 || nbCounts <= 0 ?
         0.0 :
         ((double)nbInvalid / (double)nbCounts) * 100.0;
     
-    uint64_t notInvalid = nbCounts - nbInvalid;
-    (*percentNonZeroCorrected)[index] = nbNonZero == 0 || notInvalid <= 0 ?
-        0.0 :
-        ((double)nbNonZero / (double)notInvalid) * 100.0;
+    // Calc GC%
+    double gc_perc = ((double) total.nbGC) / ((double) (seqLength - total.nbN));
+    batch.gcs[index] = gc_perc;
     
+    uint16_t x = gc_perc * gcBins; // Convert double to 1.dp
     
-    // Calc GC%
-    uint64_t gs = 0;
-    uint64_t cs = 0;
-    uint64_t ns = 0;
+    for (uint16_t h = 0; h < nbHashes; h++) {
+        
+        const size_t k = index * nbHashes + h;
+        const uint64_t nbSampledNonZero = total.coverage[h].nbNonZero;
+        
+        if (nbCounts <= 0) {
 
-    for (uint64_t i = 0; i < seqLength; i++) {
-        char c = seq[i];
+            // Can't analyse this sequence because it's too short
+            //cerr << names[index] << ": " << seq << " is too short to compute coverage.  Sequence length is "
+            //       << seqLength << " and K-mer length is " << merLen << ". Setting sequence coverage to 0." << endl;
 
-        if (c == 'G' || c == 'g')
-            gs++;
-        else if (c == 'C' || c == 'c')
-            cs++;
-        else if (c == 'N' || c == 'n')
-            ns++;
-    }
+            batch.medians[k] = 0;
+            batch.means[k] = 0.0;
 
-    double gc_perc = ((double) (gs + cs)) / ((double) (seqLength - ns));
-    (*gcs)[index] = gc_perc;
+        } else {
+
+            // The histogram gives the same median as sorting the counts
+            batch.medians[k] = hists[h].median();
+
+            // Calculate the mean
+            batch.means[k] = (double)total.coverage[h].sum / (double)nbSampled;                    
+        }
+        
+        const uint64_t nbNonZero = nbSampled == nbCounts ? 
+            nbSampledNonZero : 
+            llround((double)nbSampledNonZero * (double)nbCounts / (double)nbSampled);
+
+        batch.nonZero[k] = nbNonZero;
+        batch.percentNonZero[k] = nbSampledNonZero == 0 || nbCounts <= 0 ? 
+            0.0 : 
+            ((double)nbSampledNonZero / (double)nbSampled) * 100.0;
+
+        batch.percentNonZeroCorrected[k] = nbSampledNonZero == 0 || nbSampledValid <= 0 ?
+            0.0 :
+            ((double)nbSampledNonZero / (double)nbSampledValid) * 100.0;
+        
+        if (sample > 1) {
+            
+            // 95% confidence bounds from the normal approximation, narrowed by 
+            // the finite population correction as the sample covers more of the 
+            // sequence.  The median's bounds come from the ranks either side of
+            // the middle of the sample.
+            const double z = 1.96;
+            const double n = nbSampled;
+            const double fpc = nbCounts > 1 ? std::max(0.0, (double)(nbCounts - nbSampled) / (double)(nbCounts - 1)) : 0.0;
+            
+            const double mean = batch.means[k];
+            const double var = n > 1 ? std::max(0.0, (total.coverage[h].sumSq - n * mean * mean) / (n - 1)) : 0.0;
+            const double meanHalf = n > 0 ? z * sqrt(var / n * fpc) : 0.0;
+            
+            const double p = n > 0 ? nbSampledNonZero / n : 0.0;
+            const double pHalf = n > 0 ? z * sqrt(p * (1.0 - p) / n * fpc) : 0.0;
+            
+            const double rankHalf = z * sqrt(n * fpc) / 2.0;
+            
+            SectEstimate& e = batch.estimates[k];
+            e.medianLow = hists[h].select(floor(std::max(0.0, n / 2.0 - rankHalf)));
+            e.medianHigh = hists[h].select(ceil(n / 2.0 + rankHalf));
+            e.meanLow = std::max(0.0, mean - meanHalf);
+            e.meanHigh = mean + meanHalf;
+            e.percentNonZeroLow = std::max(0.0, p - pHalf) * 100.0;
+            e.percentNonZeroHigh = std::min(1.0, p + pHalf) * 100.0;
+        }
 
-    double log_cvg = cvgLogscale ? log10(average_cvg) : average_cvg;
+        double average_cvg = batch.means[k];
+        double log_cvg = cvgLogscale ? log10(average_cvg) : average_cvg;
 
-    // Assume log_cvg 5 is max value
-    double compressed_cvg = cvgLogscale ? log_cvg * (cvgBins / 5.0) : average_cvg * 0.1;
+        // Assume log_cvg 5 is max value
+        double compressed_cvg = cvgLogscale ? log_cvg * (cvgBins / 5.0) : average_cvg * 0.1;
 
-    uint16_t x = gc_perc * gcBins; // Convert double to 1.dp
-    uint16_t y = compressed_cvg >= cvgBins ? cvgBins - 1 : compressed_cvg; // Simply cap the y value
+        uint16_t y = !(compressed_cvg > 0.0) ? 0 : compressed_cvg >= cvgBins ? cvgBins - 1 : compressed_cvg; // Simply cap the y value
 
-    // Add bases to matrix
-    contamination_mx->incTM(th_id, x, y, seqLength);
+        // Add bases to matrix
+        contamination_mx[h]->incTM(th_id, x, y, seqLength);
+    }
 }
 
 int kat::Sect::main(int argc, char *argv[]) {
@@ -507,7 +1247,13 @@ int kat::Sect::main(int argc, char *argv[]) {
     uint16_t        mer_len;
     uint64_t        hash_size;
     bool            no_count_stats;
+    bool            binary_counts;
+    uint32_t        window;
+    uint32_t        sample;
+    path            regions_file;
     bool            dump_hash;
+    bool            multi_input;
+    bool            prefilter;
     bool            verbose;
     bool            help;
 
@@ -532,8 +1278,20 @@ int kat::Sect::main(int argc, char *argv[]) {
                 "If kmer counting is required for the input, then use this value as the hash size.  If this hash size is not large enough for your dataset then the default behaviour is to double the size of the hash and recount, which will increase runtime and memory usage.")
             ("no_count_stats,n", po::bool_switch(&no_count_stats)->default_value(false),
                 "Tells SECT not to output count stats.  Sometimes when using SECT on read files the output can get very large.  When flagged this just outputs summary stats for each sequence.")
+            ("binary_counts,b", po::bool_switch(&binary_counts)->default_value(false),
+                "Writes count stats to a compact, indexed binary file (<output_prefix>-counts.cvgb) instead of text.  This is much smaller and faster to write than the text file, and individual sequences can be extracted without reading the whole file.  Use \"kat cvg\" to convert it back to text.  \"kat plot profile\" reads it directly.")
+            ("window,w", po::value<uint32_t>(&window)->default_value(0),
+                "If set, summarises coverage in windows of this many bases along each sequence, instead of outputting the count of every K-mer.  Median and mean K-mer coverage, GC% and the number of invalid and non-zero K-mers in each window are written to <output_prefix>-windows.bed.  Each K-mer is assigned to the window containing its first base.  No count stats file is produced in this mode.")
+            ("sample,s", po::value<uint32_t>(&sample)->default_value(1),
+                "Estimates coverage from a sample of the K-mers in each sequence, only looking up every Nth K-mer in the hash.  Medians, means, non-zero counts and the contamination matrices are then estimates, and the stats table gains the number of K-mers sampled and 95% confidence bounds on the median, mean and % non-zero of each sequence.  Invalid K-mers, GC% and lengths are still exact.  No count stats are produced in this mode, and it cannot be combined with windows.  A value of 1 looks up every K-mer.")
+            ("regions,r", po::value<path>(&regions_file),
+                "Only analyses the sequences, or parts of sequences, listed in this file, fetching them directly from the sequence file using its FastA index (<sequence_file>.fai), which is built if not already present.  Each line either names a sequence, optionally followed by a range in the samtools style, e.g. contig1:1,001-2,000, or is a BED line with 0-based start and exclusive end.  Ranges are reported under the name <sequence>:<start>-<end>, with 1-based positions, and K-mer positions and windows are relative to the start of the range.  The sequence file must be uncompressed FastA.")
             ("dump_hash,d", po::bool_switch(&dump_hash)->default_value(false), 
                         "Dumps any jellyfish hashes to disk that were produced during this run.") 
+            ("multi_input", po::bool_switch(&multi_input)->default_value(false),
+                "Treats each counts input as a separate source of coverage, rather than counting them together.  Every K-mer in the sequence file is looked up in all inputs during a single pass over the sequences.  The stats table (and window table) gets median, mean and non-zero columns for each input, suffixed with the input's position, e.g. median_1, median_2.  Count stats, contamination matrices and dumped hashes are written to a separate file for each input, e.g. <output_prefix>-counts-hash1.cvg.  Each input can be a jellyfish hash or a quoted list of sequence files, and all hashes are held in memory at the same time.")
+            ("prefilter", po::bool_switch(&prefilter)->default_value(false),
+                "Builds a compact filter over the K-mers in the hash before processing, so that lookups for absent K-mers can be answered without probing the hash itself.  This helps when many K-mers in the sequences are missing from the hash, e.g. when the counts come from a different sample.  Uses roughly 10 bits per distinct K-mer in the hash.")
             ("verbose,v", po::bool_switch(&verbose)->default_value(false), 
                 "Print extra information.")
             ("help", po::bool_switch(&help)->default_value(false), "Produce help message.")
@@ -575,8 +1333,19 @@ int kat::Sect::main(int argc, char *argv[]) {
     cout << "Running KAT in SECT mode" << endl
          << "------------------------" << endl << endl;
 
+    // Either count all inputs together or treat each one separately
+    vector<vector<path>> inputs;
+    if (multi_input) {
+        for(auto& c : counts_files) {
+            inputs.push_back(InputHandler::globFiles(c.string()));
+        }
+    }
+    else {
+        inputs.push_back(counts_files);
+    }
+    
     // Create the sequence coverage object
-    Sect sect(counts_files, seq_file);
+    Sect sect(inputs, seq_file);
     sect.setOutputPrefix(output_prefix);
     sect.setGcBins(gc_bins);
     sect.setCvgBins(cvg_bins);
@@ -586,11 +1355,19 @@ int kat::Sect::main(int argc, char *argv[]) {
     sect.setMerLen(mer_len);
     sect.setHashSize(hash_size);
     sect.setNoCountStats(no_count_stats);
+    sect.setBinaryCounts(binary_counts);
+    sect.setWindow(window);
+    sect.setSample(sample);
+    sect.setRegionsFile(regions_file);
     sect.setDumpHash(dump_hash);
+    sect.setPrefilter(prefilter);
     sect.setVerbose(verbose);
 
     // Do the work (outputs data to files as it goes)
     sect.execute();
+    
+    // Save the contamination matrices
+    sect.save();
 
     return 0;
 }
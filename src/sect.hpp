@@ -22,7 +22,12 @@
 #include <stdint.h>
 #include <vector>
 #include <math.h>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <thread>
 using std::vector;
 using std::string;
@@ -51,6 +56,9 @@ using boost::lexical_cast;
 
 #include "inc/matrix/matrix_metadata_extractor.hpp"
 #include "inc/matrix/threaded_sparse_matrix.hpp"
+#include "inc/base_masks.hpp"
+#include "inc/count_histogram.hpp"
+#include "inc/coverage_file.hpp"
 
 #include "jellyfish_helper.hpp"
 #include "input_handler.hpp"
@@ -61,14 +69,192 @@ struct SectException: virtual boost::exception, virtual std::exception { };
 
 namespace kat {
     
+    /**
+     * A range of K-mer windows [start, end) within a single sequence.  Long sequences
+     * are split into several chunks so they can be shared between workers.  Adjacent
+     * chunks overlap by K-1 bases, so every K-mer window belongs to exactly one chunk.
+     */
+    struct SectChunk {
+        uint32_t seqIndex;
+        uint64_t start;
+        uint64_t end;
+        bool last;              // Whether this is the final chunk of the sequence
+    };
+    
+    /**
+     * A sequence, or range of bases [start, end) within one, fetched by seeking 
+     * through the FastA index rather than streaming the whole sequence file
+     */
+    struct SectRegion {
+        string name;            // Name given to the region in the output
+        uint32_t seqId;         // Index of the sequence in the FastA index
+        uint64_t start;
+        uint64_t end;
+    };
+    
+    /**
+     * K-mer coverage from a single hash over some part of a sequence
+     */
+    struct SectCoverage {
+        uint64_t sum;
+        double sumSq;           // Sum of squared counts, for the spread of sampled counts
+        uint64_t median;
+        uint64_t nbNonZero;
+    };
+    
+    /**
+     * Confidence bounds on the coverage of a sequence estimated from a sample of its K-mers
+     */
+    struct SectEstimate {
+        uint32_t medianLow;
+        uint32_t medianHigh;
+        double meanLow;
+        double meanHigh;
+        double percentNonZeroLow;
+        double percentNonZeroHigh;
+    };
+    
+    /**
+     * Summary for a window of bases [start, end) along a sequence.  The K-mers in 
+     * a window are those whose first base lies within it.  Coverage from each hash
+     * is kept alongside, in SectChunkResult::windowCoverage.
+     */
+    struct SectWindow {
+        uint64_t start;
+        uint64_t end;
+        uint64_t nbKmers;
+        uint64_t nbInvalid;
+        uint64_t nbGC;
+        uint64_t nbN;
+    };
+    
+    /**
+     * Partial results for a single chunk, which are combined once all chunks of a
+     * sequence have been processed.
+     */
+    struct SectChunkResult {
+        uint64_t nbSampled;                     // K-mers looked up, or that would have been if valid
+        uint64_t nbSampledValid;
+        uint64_t nbInvalid;
+        uint64_t nbGC;
+        uint64_t nbN;
+        vector<SectCoverage> coverage;          // One per hash
+        vector<CountHistogram> hists;           // One per hash.  Only used when the sequence has more than one chunk
+        vector<SectWindow> windows;             // Only used in window mode
+        vector<SectCoverage> windowCoverage;    // One per hash for each window, window by window
+    };
+    
+    /**
+     * Scratch space owned by a single worker and reused for every chunk it processes
+     */
+    struct SectWorkspace {
+        vector<CountHistogram> hists;           // One per hash
+        vector<CountHistogram> windowHists;     // One per hash
+        vector<SectCoverage> windowCoverage;    // One per hash
+        vector<uint32_t*> counts;               // One per hash
+        BaseMasks masks;                        // Classification of the bases in the current chunk
+    };
+    
+    /**
+     * A batch of sequences read from the sequence file, along with the results of
+     * analysing them.  Batches are passed from the reader to the workers and then
+     * on to the writer, after which they are recycled for a later batch.  Buffers 
+     * only ever grow, so once the first few batches have been seen, processing a
+     * batch does not allocate per record.
+     */
+    class SectBatch {
+    public:
+        
+        uint64_t id;
+        
+        seqan::StringSet<seqan::CharString> names;
+        seqan::StringSet<seqan::CharString> seqs;
+        
+        uint16_t nbHashes;
+        
+        // Coverage results have one entry per hash for each sequence, at index 
+        // (sequence * nbHashes) + hash
+        vector<uint32_t> medians;   // Overall coverage calculated for each sequence from the K-mer windows.
+        vector<double> means;       // Overall coverage calculated for each sequence from the K-mer windows.
+        vector<double> gcs;         // GC% for each sequence
+        vector<uint32_t> lengths;   // Length in nucleotides for each sequence
+        vector<uint32_t> nonZero;
+        vector<double> percentNonZero;
+        vector<uint32_t> invalid;
+        vector<double> percentInvalid;
+        vector<double> percentNonZeroCorrected;
+        vector<SectEstimate> estimates;     // Only used when sampling
+        vector<uint64_t> nbSampled;         // Number of K-mers sampled from each sequence.  Only used when sampling.
+        
+        // K-mer counts for each K-mer window in each sequence, stored end to end, 
+        // with each sequence holding the counts from every hash in turn.  Counts 
+        // too large for 32 bits are capped.  Not used in window mode.
+        std::unique_ptr<uint32_t[]> countArena;
+        uint64_t countArenaSize;
+        vector<uint64_t> countOffsets;  // Offset of each sequence's counts in the arena, plus one past the last
+        
+        vector<SectChunk> chunks;
+        vector<SectChunkResult> chunkResults;
+        vector<uint32_t> firstChunk;    // Index of the first chunk for each sequence, plus one past the last chunk
+        std::unique_ptr<std::atomic<uint32_t>[]> chunksRemaining;  // Chunks yet to be processed for each sequence
+        size_t chunksRemainingSize;
+        vector<uint32_t> order;         // Chunk indices, largest first, in the order they are handed out
+        std::atomic<size_t> nextChunk;  // Position in order of the next chunk to hand out
+        
+        std::atomic<uint16_t> workersRemaining;  // Workers yet to finish with this batch
+        bool complete;
+        
+        SectBatch() : id(0), nbHashes(1), countArenaSize(0), chunksRemainingSize(0), nextChunk(0), workersRemaining(0), complete(false) {}
+        
+        size_t size() const {
+            return seqan::length(names);
+        }
+        
+        bool hasCounts() const {
+            return countOffsets.size() > size();
+        }
+        
+        uint32_t* getCounts(size_t i, uint16_t h) {
+            return countArena.get() + countOffsets[i] * nbHashes + h * getNbCounts(i);
+        }
+        
+        const uint32_t* getCounts(size_t i, uint16_t h) const {
+            return countArena.get() + countOffsets[i] * nbHashes + h * getNbCounts(i);
+        }
+        
+        uint64_t getNbCounts(size_t i) const {
+            return countOffsets[i + 1] - countOffsets[i];
+        }
+        
+        /**
+         * Clears out the previous batch's sequences so this object can be reused
+         */
+        void reset(uint64_t _id);
+        
+        /**
+         * Splits the sequences into chunks of at most chunkSize K-mers, orders them
+         * largest first and allocates space for the results once the sequences have
+         * been read.  If window is non-zero, chunks are aligned to windows of that
+         * many bases.  Space for per K-mer counts is only made if keepCounts is set.
+         */
+        void init(uint16_t nbWorkers, uint16_t nbHashes, uint16_t merLen, uint64_t chunkSize, uint32_t window, bool keepCounts);
+    };
+    
     
     class Sect {
     private:
 
         static const uint16_t BATCH_SIZE = 1024;
+        
+        // Maximum number of batches held in memory at once, across reader, workers and writer
+        static const uint16_t MAX_BATCHES_IN_FLIGHT = 4;
+        
+        // Default maximum number of K-mers in each unit of work given to a worker
+        static const uint64_t DEFAULT_CHUNK_SIZE = 1000000;
 
-        // Input args
-        InputHandler    input;
+        // Input args.  Normally a single input, but coverage can be calculated from
+        // several independent inputs in the same pass over the sequences.
+        vector<InputHandler> input;
         path            seqFile;
         path            outputPrefix;
         uint16_t        gcBins;
@@ -76,38 +262,41 @@ namespace kat {
         bool            cvgLogscale;
         uint16_t        threads;
         uint16_t        merLen;
+        uint64_t        chunkSize;
         bool            noCountStats;
+        bool            binaryCounts;
+        uint32_t        window;
+        uint32_t        sample;
+        path            regionsFile;
+        bool            prefilter;
         bool            verbose;
             
-        // Chunking vars
-        size_t bucket_size, remaining; 
-
         // Variables that live for the lifetime of this object
         LargeHashArrayPtr hash;
-        shared_ptr<ThreadedSparseMatrix> contamination_mx; // Stores cumulative base count for each sequence where GC and CVG are binned
-        uint32_t offset;
-        uint16_t recordsInBatch;
-        path hashFile;
-
-        // Variables that are refreshed for each batch
-        seqan::StringSet<seqan::CharString> names;
-        seqan::StringSet<seqan::CharString> seqs;
-        shared_ptr<vector<shared_ptr<vector<uint64_t>>>> counts; // K-mer counts for each K-mer window in sequence (in same order as seqs and names; built by this class)
-        shared_ptr<vector<uint32_t>> medians; // Overall coverage calculated for each sequence from the K-mer windows.
-        shared_ptr<vector<double>> means; // Overall coverage calculated for each sequence from the K-mer windows.
-        shared_ptr<vector<double>> gcs; // GC% for each sequence
-        shared_ptr<vector<uint32_t>> lengths; // Length in nucleotides for each sequence
-        shared_ptr<vector<uint32_t>> nonZero;
-        shared_ptr<vector<double>> percentNonZero;
-        shared_ptr<vector<uint32_t>> invalid;
-        shared_ptr<vector<double>> percentInvalid;
-        shared_ptr<vector<double>> percentNonZeroCorrected;
+        vector<shared_ptr<ThreadedSparseMatrix>> contamination_mx; // Stores cumulative base count for each sequence where GC and CVG are binned.  One per input.
+
+        // Regions to analyse, if only part of the sequence file is of interest
+        vector<SectRegion> regions;
+        seqan::FaiIndex faiIndex;
+
+        // Pipeline state.  Batches are keyed by id, and are moved to the free list once written.
+        std::map<uint64_t, shared_ptr<SectBatch>> batches;
+        vector<shared_ptr<SectBatch>> freeBatches;
+        vector<SectWorkspace> workspaces;
+        uint64_t nbBatchesRead;
+        uint64_t nbBatchesWritten;
+        bool readingDone;
+        std::exception_ptr readerError;
+        std::mutex mu;
+        std::condition_variable cv;
         
 
     public:
 
         Sect(const vector<path> _counts_files, const path _seq_file);
         
+        Sect(const vector<vector<path>>& _counts_files, const path _seq_file);
+        
         virtual ~Sect() {
         }
         
@@ -120,11 +309,13 @@ namespace kat {
         }
         
         bool isCanonical() const {
-            return input.canonical;
+            return input[0].canonical;
         }
 
         void setCanonical(bool canonical) {
-            this->input.canonical = canonical;
+            for(auto& i : input) {
+                i.canonical = canonical;
+            }
         }
 
         uint16_t getCvgBins() const {
@@ -159,6 +350,38 @@ namespace kat {
             this->noCountStats = no_count_stats;
         }
 
+        bool isBinaryCounts() const {
+            return binaryCounts;
+        }
+
+        void setBinaryCounts(bool binaryCounts) {
+            this->binaryCounts = binaryCounts;
+        }
+
+        uint32_t getWindow() const {
+            return window;
+        }
+
+        void setWindow(uint32_t window) {
+            this->window = window;
+        }
+
+        uint32_t getSample() const {
+            return sample;
+        }
+
+        void setSample(uint32_t sample) {
+            this->sample = sample;
+        }
+
+        path getRegionsFile() const {
+            return regionsFile;
+        }
+
+        void setRegionsFile(path regionsFile) {
+            this->regionsFile = regionsFile;
+        }
+
         path getSeqFile() const {
             return seqFile;
         }
@@ -176,11 +399,13 @@ namespace kat {
         }
         
         uint64_t getHashSize() const {
-            return input.hashSize;
+            return input[0].hashSize;
         }
 
         void setHashSize(uint64_t hashSize) {
-            this->input.hashSize = hashSize;
+            for(auto& i : input) {
+                i.hashSize = hashSize;
+            }
         }
 
         uint16_t getMerLen() const {
@@ -191,12 +416,34 @@ namespace kat {
             this->merLen = merLen;
         }
         
+        uint64_t getChunkSize() const {
+            return chunkSize;
+        }
+
+        void setChunkSize(uint64_t chunkSize) {
+            this->chunkSize = chunkSize;
+        }
+        
         bool isDumpHash() const {
-            return input.dumpHash;
+            return input[0].dumpHash;
         }
 
         void setDumpHash(bool dumpHash) {
-            this->input.dumpHash = dumpHash;
+            for(auto& i : input) {
+                i.dumpHash = dumpHash;
+            }
+        }
+        
+        size_t getNbInputs() const {
+            return input.size();
+        }
+
+        bool isPrefilter() const {
+            return prefilter;
+        }
+
+        void setPrefilter(bool prefilter) {
+            this->prefilter = prefilter;
         }
 
         bool isVerbose() const {
@@ -214,35 +461,48 @@ namespace kat {
 
 
     private:
+        
+        void init(const vector<vector<path>>& _counts_files, const path& _seq_file);
 
+        void loadRegions();
+        
         void processSeqFile();
         
-        void analyseBatch();
+        void readBatches();
+        
+        size_t readRegions(std::istream& in, SectBatch& batch, size_t nextRegion);
         
-        void analyseBatchSlice(int th_id);
+        void analyseBatches(uint16_t th_id);
+        
+        void writeBatches(const vector<std::ostream*>& countsOut, const vector<CoverageWriter*>& binaryCountsOut, std::ostream* windowsOut, std::ostream& statsOut);
         
         void merge();
         
-        void destroyBatchVars();
-
-        void createBatchVars(uint16_t batchSize);
-
-        void printCounts(std::ostream &out);
+        void printCounts(std::ostream &out, const SectBatch& batch, const uint16_t h);
+        
+        void printCounts(CoverageWriter &out, const SectBatch& batch, const uint16_t h);
 
-        void printStatTable(std::ostream &out);
+        void printWindows(std::ostream &out, const SectBatch& batch);
+        
+        void printStatTable(std::ostream &out, const SectBatch& batch);
 
         // Print K-mer comparison matrix
 
-        void printContaminationMatrix(std::ostream &out, const path seqFile);
+        void printContaminationMatrix(std::ostream &out, const path seqFile, const uint16_t h);
 
-        // This method won't be optimal in most cases... Fasta files are normally sorted by length (largest first)
-        // So first thread will be asked to do more work than the rest
-        void processInBlocks(uint16_t th_id);
+        void processChunk(SectBatch& batch, const size_t index, const uint16_t th_id);
         
-        // This method is probably makes more efficient use of multiple cores on a length sorted fasta file
-        void processInterlaced(uint16_t th_id);
-
-        void processSeq(const size_t index, const uint16_t th_id);
+        void finaliseSeq(SectBatch& batch, const size_t index, const uint16_t th_id, vector<CountHistogram>& hists);
+        
+        // Suffix distinguishing the output files of each input.  Empty if there is only one input.
+        string getFileSuffix(const uint16_t h) const {
+            return input.size() > 1 ? "-hash" + lexical_cast<string>(input[h].index) : "";
+        }
+        
+        // Suffix distinguishing the output columns of each input.  Empty if there is only one input.
+        string getColumnSuffix(const uint16_t h) const {
+            return input.size() > 1 ? "_" + lexical_cast<string>(input[h].index) : "";
+        }
         
         static string helpMessage() {            
         
@@ -253,6 +513,12 @@ namespace kat {
                             "provided counts input file, which can be either one jellyfish hash, or one or more FastA / " \
                             "FastQ files.  In addition, a space separated table file containing the mean coverage score and GC " \
                             "of each sequence is produced.  The row order is identical to the original sequence file.\n\n" \
+                            "Coverage from several independent inputs, such as different read libraries, can be calculated " \
+                            "in a single pass over the sequence file using \"--multi_input\".\n\n" \
+                            "For a quick estimate of coverage, such as when screening for contamination, only every Nth " \
+                            "K-mer can be looked up using \"--sample\".\n\n" \
+                            "To check coverage for a few sequences in a large FastA file use \"--regions\", which seeks " \
+                            "straight to the requested sequences using a FastA index, rather than reading the whole file.\n\n" \
                             "NOTE: K-mers containing any Ns derived from sequences in the sequence file not be included.\n\n" \
                             "Options";
 
@@ -29,6 +29,9 @@ using std::thread;
 using kat::Comp;
 using kat::ThreadedCompCounters;
 using kat::CompCounters;
+using kat::CountRegion;
+using kat::HashLoader;
+using kat::JellyfishException;
 
 BOOST_AUTO_TEST_SUITE( KAT_COMP )
 
@@ -88,4 +91,359 @@ BOOST_AUTO_TEST_CASE( THREADED_COUNTERS )
     
 }
 
+BOOST_AUTO_TEST_CASE( THREADED_SLOTS )
+{
+    ThreadedCompCounters tcc("path1", "path2", "path3", 5);
+    
+    // Threads update their own slots directly
+    thread t[5];
+    for(uint16_t i = 0; i < 5; i++) {
+        t[i] = thread([&tcc, i]() {
+            for(uint16_t j = 0; j <= i; j++) {
+                tcc.getThreadedMatrixAt(i).updateHash1Counters(10, 0);
+            }
+        });
+    }
+    for(uint16_t i = 0; i < 5; i++) {
+        t[i].join();
+    }
+    
+    tcc.merge();
+    
+    BOOST_CHECK_EQUAL( tcc.size(), 5 );
+    BOOST_CHECK( tcc.getThreadedMatrixAt(4).hash1_path == path("path1"));
+    BOOST_CHECK_EQUAL( tcc.getFinalMatrix().hash1_distinct, 15 );
+    BOOST_CHECK_EQUAL( tcc.getFinalMatrix().hash1_only_total, 150 );
+    BOOST_CHECK_EQUAL( tcc.getThreadedMatrixAt(2).hash1_distinct, 3 );
+}
+
+BOOST_AUTO_TEST_CASE( DENSE_MATRIX )
+{
+    ThreadedSparseMatrix tsm(3, 4, 3);
+    
+    // Thread 1 never increments, so its matrix is never allocated
+    tsm.incTM(0, 0, 0, 2);
+    tsm.incTM(0, 2, 3, 5);
+    tsm.incTM(2, 2, 3, 1);
+    tsm.incTM(2, 1, 2, 7);
+    
+    // Outside the matrix, so dropped
+    tsm.incTM(2, 3, 0, 100);
+    
+    const SM64& mx = tsm.mergeThreadedMatricies();
+    
+    BOOST_CHECK_EQUAL( mx.width(), 3 );
+    BOOST_CHECK_EQUAL( mx.height(), 4 );
+    BOOST_CHECK_EQUAL( mx.get(0, 0), 2 );
+    BOOST_CHECK_EQUAL( mx.get(2, 3), 6 );
+    BOOST_CHECK_EQUAL( mx.get(1, 2), 7 );
+    BOOST_CHECK_EQUAL( mx.get(1, 1), 0 );
+    BOOST_CHECK_EQUAL( mx.getMaxVal(), 7 );
+    BOOST_CHECK_EQUAL( mx.sumColumn(1), 7 );
+    BOOST_CHECK_EQUAL( mx.sumRow(3), 6 );
+    BOOST_CHECK_THROW( mx.get(3, 0), SM64::DenseMatrixException );
+    
+    std::ostringstream out;
+    mx.printMatrix(out);
+    BOOST_CHECK_EQUAL( out.str(), "2 0 0 0\n0 0 7 0\n0 0 0 6\n" );
+}
+
+BOOST_AUTO_TEST_CASE( MERGE_ROW_BLOCKS )
+{
+    // Odd sizes so that neither row blocks nor SIMD lanes divide evenly
+    const uint16_t threads = 7;
+    ThreadedSparseMatrix tsm(101, 37, threads);
+    SM64 expected(101, 37);
+    
+    uint64_t x = 12345;
+    for(uint16_t t = 0; t < threads; t++) {
+        if (t == 3) continue;   // Leave one thread matrix untouched
+        for(uint32_t k = 0; k < 5000; k++) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            const uint32_t i = (x >> 33) % 101;
+            const uint32_t j = (x >> 13) % 37;
+            tsm.incTM(t, i, j, t + 1);
+            expected.inc(i, j, t + 1);
+        }
+    }
+    
+    const SM64& mx = tsm.mergeThreadedMatricies();
+    
+    BOOST_CHECK( !tsm.getThreadMatrix(3).isAllocated() );
+    
+    uint64_t nbWrong = 0;
+    for(uint32_t i = 0; i < 101; i++) {
+        for(uint32_t j = 0; j < 37; j++) {
+            if (mx.get(i, j) != expected.get(i, j)) nbWrong++;
+        }
+    }
+    
+    BOOST_CHECK_EQUAL( nbWrong, 0 );
+    BOOST_CHECK_EQUAL( mx.getMaxVal(), expected.getMaxVal() );
+    
+    // Thread matrices are left as they were
+    BOOST_CHECK_EQUAL( tsm.getThreadMatrix(6).getMaxVal() % 7, 0 );
+}
+
+BOOST_AUTO_TEST_CASE( THREAD_CELL_SPILL )
+{
+    const uint64_t max32 = std::numeric_limits<uint32_t>::max();
+    ThreadedSparseMatrix tsm(2, 2, 2);
+    
+    // Counts that no longer fit in a thread's 32 bit cell are kept aside and
+    // added to the final matrix in full
+    tsm.incTM(0, 1, 1, max32);
+    tsm.incTM(0, 1, 1, 1);
+    tsm.incTM(0, 1, 1, 5);
+    tsm.incTM(1, 1, 1, max32 * 3);
+    tsm.incTM(1, 0, 1, 9);
+    
+    BOOST_CHECK_EQUAL( tsm.getThreadMatrix(0).get(1, 1), 5 );
+    
+    const SM64& mx = tsm.mergeThreadedMatricies();
+    
+    BOOST_CHECK_EQUAL( mx.get(1, 1), max32 * 4 + 6 );
+    BOOST_CHECK_EQUAL( mx.get(0, 1), 9 );
+    BOOST_CHECK_EQUAL( mx.get(0, 0), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( NWAY )
+{
+    vector<vector<path>> inputs(3, vector<path>(1, path("data/ecoli.header.jf27")));
+    
+    Comp comp(inputs);
+    comp.setNWay(true);
+    comp.setOutputPrefix("temp/comp_nway");
+    
+    comp.execute();
+    
+    CompCounters& cc = comp.getNWayCounters(0, 2);
+    
+    BOOST_CHECK_EQUAL( cc.hash1_distinct, 1889 );
+    BOOST_CHECK_EQUAL( cc.hash2_distinct, 1889 );
+    BOOST_CHECK_EQUAL( cc.shared_distinct, 1889 );
+    BOOST_CHECK_EQUAL( cc.hash1_only_distinct, 0 );
+    BOOST_CHECK_EQUAL( cc.hash1_total, cc.shared_hash1_total );
+    
+    const SM64& spectra = comp.getSpectraMatrix();
+    
+    uint64_t distinct1 = 0;
+    uint64_t distinct2 = 0;
+    for(uint32_t j = 0; j < spectra.height(); j++) {
+        distinct1 += spectra.get(1, j);
+        distinct2 += spectra.get(2, j);
+    }
+    
+    BOOST_CHECK_EQUAL( distinct1, 1889 );
+    BOOST_CHECK_EQUAL( distinct2, 1889 );
+}
+
+BOOST_AUTO_TEST_CASE( NWAY_DIFFERENT_INPUTS )
+{
+    // Input 1 shares nothing with the others, while most K-mers in input 3 were
+    // already seen in input 2, so they are skipped when walking input 3
+    vector<vector<path>> inputs;
+    inputs.push_back(vector<path>(1, path("data/ecoli.header.jf27")));
+    inputs.push_back(vector<path>(1, path("data/sect_test.fa")));
+    inputs.push_back(vector<path>(1, path("data/sect_length_test.fa")));
+    
+    Comp comp(inputs);
+    comp.setNWay(true);
+    comp.setHashSize(1, 100000);
+    comp.setHashSize(2, 100000);
+    comp.setOutputPrefix("temp/comp_nway_diff");
+    
+    comp.execute();
+    
+    // Every pair should agree with a plain comparison of the same two inputs
+    for(uint16_t i = 0; i < 3; i++) {
+        for(uint16_t j = i + 1; j < 3; j++) {
+            
+            Comp pair(inputs[i][0], inputs[j][0]);
+            pair.setHashSize(0, 100000);
+            pair.setHashSize(1, 100000);
+            pair.setOutputPrefix("temp/comp_nway_pair");
+            pair.execute();
+            
+            const CompCounters& expected = pair.getCompCounters();
+            const CompCounters& cc = comp.getNWayCounters(i, j);
+            
+            BOOST_CHECK_EQUAL( cc.hash1_distinct, expected.hash1_distinct );
+            BOOST_CHECK_EQUAL( cc.hash2_distinct, expected.hash2_distinct );
+            BOOST_CHECK_EQUAL( cc.shared_distinct, expected.shared_distinct );
+            BOOST_CHECK_EQUAL( cc.hash1_only_distinct, expected.hash1_only_distinct );
+            BOOST_CHECK_EQUAL( cc.hash2_only_distinct, expected.hash2_only_distinct );
+            BOOST_CHECK_EQUAL( cc.hash1_total, expected.hash1_total );
+            BOOST_CHECK_EQUAL( cc.hash2_total, expected.hash2_total );
+            BOOST_CHECK_EQUAL( cc.shared_hash1_total, expected.shared_hash1_total );
+            BOOST_CHECK_EQUAL( cc.shared_hash2_total, expected.shared_hash2_total );
+        }
+    }
+    
+    const CompCounters& cc23 = comp.getNWayCounters(1, 2);
+    
+    BOOST_CHECK( cc23.shared_distinct > 0 );
+    BOOST_CHECK( cc23.hash1_only_distinct > 0 );
+    BOOST_CHECK( cc23.hash2_only_distinct > 0 );
+    
+    const CompCounters& cc13 = comp.getNWayCounters(0, 2);
+    
+    BOOST_CHECK_EQUAL( cc13.shared_distinct, 0 );
+    BOOST_CHECK_EQUAL( cc13.hash1_only_distinct, 1889 );
+    BOOST_CHECK_EQUAL( cc13.hash2_only_distinct, 34 );
+}
+
+BOOST_AUTO_TEST_CASE( EXPORT_REGION )
+{
+    CountRegion all("*");
+    CountRegion single("1,1-1");
+    
+    BOOST_CHECK( all.contains(0, 100, 1000) );
+    BOOST_CHECK( single.contains(1, 1, 0) );
+    BOOST_CHECK( !single.contains(2, 1, 0) );
+    BOOST_CHECK_EQUAL( single.toString(), "1-1,1-1,*" );
+    
+    Comp comp("data/ecoli.header.jf27", "data/ecoli.header.jf27");
+    comp.setOutputPrefix("temp/comp_export");
+    comp.addExportRegion(single);
+    comp.addExportRegion(CountRegion("0,*"));
+    
+    comp.execute();
+    
+    // Every exported K-mer should have count 1 in the original hash
+    HashLoader hl;
+    LargeHashArrayPtr exported = hl.loadHash(comp.getExportPath(0), false);
+    
+    HashLoader orig;
+    LargeHashArrayPtr hash = orig.loadHash("data/ecoli.header.jf27", false);
+    
+    uint64_t nbSingle = 0;
+    LargeHashArray::region_iterator it = hash->region_slice(0, 1);
+    while (it.next()) {
+        if (it.val() == 1) nbSingle++;
+    }
+    
+    uint64_t nbExported = 0;
+    uint64_t nbWrong = 0;
+    LargeHashArray::region_iterator eit = exported->region_slice(0, 1);
+    while (eit.next()) {
+        nbExported++;
+        if (eit.val() != 1 || JellyfishHelper::getCount(hash, eit.key(), false) != 1) nbWrong++;
+    }
+    
+    BOOST_CHECK( nbSingle > 0 );
+    BOOST_CHECK_EQUAL( nbExported, nbSingle );
+    BOOST_CHECK_EQUAL( comp.getNbExported(0), nbSingle );
+    BOOST_CHECK_EQUAL( nbWrong, 0 );
+    
+    // Nothing is absent from hash 1 when comparing a hash against itself
+    BOOST_CHECK_EQUAL( comp.getNbExported(1), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( ONE_VS_MANY )
+{
+    vector<vector<path>> inputs(3, vector<path>(1, path("data/ecoli.header.jf27")));
+    
+    Comp comp(inputs);
+    comp.setOneVsMany(true);
+    comp.setOutputPrefix("temp/comp_1vm");
+    
+    comp.execute();
+    
+    BOOST_CHECK( boost::filesystem::exists("temp/comp_1vm-1v2-main.mx") );
+    BOOST_CHECK( boost::filesystem::exists("temp/comp_1vm-1v2.stats") );
+    BOOST_CHECK( boost::filesystem::exists("temp/comp_1vm-1v3-main.mx") );
+    BOOST_CHECK( boost::filesystem::exists("temp/comp_1vm-1v3.stats") );
+    
+    // Results from the last comparison are still available
+    CompCounters& cc = comp.getCompCounters();
+    
+    BOOST_CHECK_EQUAL( cc.hash1_distinct, 1889 );
+    BOOST_CHECK_EQUAL( cc.hash2_distinct, 1889 );
+    BOOST_CHECK_EQUAL( cc.shared_distinct, 1889 );
+}
+
+BOOST_AUTO_TEST_CASE( ONE_VS_MANY_BAD_TARGET )
+{
+    // Make a hash with a different K-mer length to the others
+    Comp k21("data/sect_length_test.fa", "data/sect_length_test.fa");
+    k21.setOutputPrefix("temp/comp_k21");
+    k21.setMerLen(21);
+    k21.setHashSize(0, 100000);
+    k21.setHashSize(1, 100000);
+    k21.setDumpHashes(true);
+    k21.execute();
+    
+    vector<vector<path>> inputs(2, vector<path>(1, path("data/ecoli.header.jf27")));
+    inputs.push_back(vector<path>(1, path("temp/comp_k21-hash1.jf21")));
+    
+    Comp comp(inputs);
+    comp.setOneVsMany(true);
+    comp.setOutputPrefix("temp/comp_1vm_bad");
+    
+    // The last target is rejected before the first comparison is run
+    BOOST_CHECK_THROW( comp.execute(), JellyfishException );
+    BOOST_CHECK( !boost::filesystem::exists("temp/comp_1vm_bad-1v2-main.mx") );
+    
+    remove("temp/comp_k21-hash1.jf21");
+    remove("temp/comp_k21-hash2.jf21");
+}
+
+BOOST_AUTO_TEST_CASE( SAMPLE )
+{
+    BOOST_CHECK_EQUAL( JellyfishHelper::sampleThreshold(1.0), std::numeric_limits<uint64_t>::max() );
+    BOOST_CHECK_EQUAL( JellyfishHelper::sampleThreshold(0.5), (uint64_t)1 << 63 );
+    
+    // Count the whole sequence file, keeping the hash so it can be loaded next
+    Comp full("data/sect_length_test.fa", "data/sect_length_test.fa");
+    full.setOutputPrefix("temp/comp_full");
+    full.setHashSize(0, 100000);
+    full.setHashSize(1, 100000);
+    full.setDumpHashes(true);
+    full.execute();
+    
+    const CompCounters& fc = full.getCompCounters();
+    const uint64_t fullDistinct = fc.hash1_distinct;
+    const uint64_t fullTotal = fc.hash1_total;
+    uint64_t fullCells = 0;
+    for(uint32_t i = 0; i < full.getMainMatrix().width(); i++) {
+        fullCells += full.getMainMatrix().sumColumn(i);
+    }
+    
+    // Compare a loaded hash against a counted one.  Both should be sampled down to
+    // the same K-mers, so nothing is found in only one of them.
+    const double fraction = 0.25;
+    Comp sampled("temp/comp_full-hash1.jf27", "data/sect_length_test.fa");
+    sampled.setOutputPrefix("temp/comp_sample");
+    sampled.setHashSize(1, 100000);
+    sampled.setSampleFraction(fraction);
+    sampled.execute();
+    
+    const CompCounters& sc = sampled.getCompCounters();
+    
+    BOOST_CHECK( sc.hash1_distinct > 0 );
+    BOOST_CHECK( sc.hash1_distinct < fullDistinct );
+    BOOST_CHECK_EQUAL( sc.hash1_distinct, sc.hash2_distinct );
+    BOOST_CHECK_EQUAL( sc.shared_distinct, sc.hash1_distinct );
+    BOOST_CHECK_EQUAL( sc.hash1_only_distinct, 0 );
+    BOOST_CHECK_EQUAL( sc.hash2_only_distinct, 0 );
+    BOOST_CHECK_EQUAL( sc.hash1_total, sc.hash2_total );
+    
+    // Scaled estimates should be within a few of the standard errors reported for
+    // them of the values found when using every K-mer
+    const double se = sqrt((double)fullDistinct * (1.0 - fraction) / fraction);
+    BOOST_CHECK( std::abs((double)sc.hash1_distinct - (double)fullDistinct) <= 4.0 * se );
+    BOOST_CHECK( std::abs((double)sc.hash1_total - (double)fullTotal) <= 4.0 * se * (double)fullTotal / (double)fullDistinct );
+    
+    uint64_t sampledCells = 0;
+    for(uint32_t i = 0; i < sampled.getMainMatrix().width(); i++) {
+        sampledCells += sampled.getMainMatrix().sumColumn(i);
+    }
+    BOOST_CHECK( fullCells > 0 );
+    BOOST_CHECK( std::abs((double)sampledCells - (double)fullCells) <= 4.0 * se );
+    
+    remove("temp/comp_full-hash1.jf27");
+    remove("temp/comp_full-hash2.jf27");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
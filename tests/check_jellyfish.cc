@@ -24,7 +24,11 @@
 #include <boost/filesystem.hpp>
 using boost::filesystem::remove;
 
+#include <algorithm>
 #include <chrono>
+#include <fstream>
+#include <iterator>
+#include <map>
 using std::chrono::system_clock;
 using std::chrono::duration;
 using std::chrono::duration_cast;
@@ -34,6 +38,15 @@ inline double as_seconds(DtnType dtn) { return duration_cast<duration<double>>(d
 #include <../src/jellyfish_helper.hpp>
 using kat::JellyfishHelper;
 using kat::HashLoader;
+using kat::HashDump;
+using kat::JellyfishException;
+using kat::SpectrumTable;
+
+#include <../src/inc/rolling_mer.hpp>
+using kat::RollingMer;
+
+#include <../src/inc/mer_len_counter.hpp>
+using kat::MerLenCounter;
 
 BOOST_AUTO_TEST_SUITE(KAT_JELLYFISH)
 
@@ -130,6 +143,140 @@ BOOST_AUTO_TEST_CASE(TEST_SLICE) {
     BOOST_CHECK_EQUAL( nb_records, 1889 );
 }
 
+BOOST_AUTO_TEST_CASE(TEST_PREFILTER) {
+
+    HashLoader hl;
+    LargeHashArrayPtr hash = hl.loadHash("data/ecoli.header.jf27", false);
+
+    shared_ptr<BlockedBloomFilter> filter = JellyfishHelper::buildFilter(hash, 2);
+
+    // No false negatives
+    uint32_t nbMissing = 0;
+    LargeHashArray::region_iterator it = hash->region_slice(0, 1);
+    while (it.next()) {
+        if (JellyfishHelper::getCount(hash, filter.get(), it.key(), false) != it.val())
+            nbMissing++;
+    }
+
+    BOOST_CHECK_EQUAL( nbMissing, 0 );
+
+    // Few false positives for random K-mers
+    uint32_t nbFalsePositives = 0;
+    mer_dna m;
+    for(uint32_t i = 0; i < 10000; i++) {
+        m.randomize();
+        if (filter->contains(JellyfishHelper::mixKey(m)) && JellyfishHelper::getCount(hash, m, false) == 0)
+            nbFalsePositives++;
+    }
+
+    BOOST_CHECK( nbFalsePositives < 500 );
+}
+
+BOOST_AUTO_TEST_CASE(TEST_ROLLING_MER) {
+    
+    mer_dna::k(5);
+    
+    const string seq = "ACGTTGCANGGATCCAtGCATGCAAAAACCCCC";
+    
+    RollingMer rm;
+    uint32_t nbValid = 0;
+    uint32_t nbWrong = 0;
+    
+    for(uint32_t i = 0; i < seq.size(); i++) {
+        
+        bool valid = rm.push(seq[i]);
+        
+        if (i + 1 < 5) {
+            if (valid) nbWrong++;
+            continue;
+        }
+        
+        string merstr = seq.substr(i + 1 - 5, 5);
+        bool expected = merstr.find_first_not_of("ACGT") == string::npos;
+        
+        if (valid != expected) {
+            nbWrong++;
+        }
+        else if (valid) {
+            nbValid++;
+            mer_dna m(merstr);
+            if (rm.forward() != m || rm.reverseComplement() != m.get_reverse_complement() || rm.canonical() != m.get_canonical())
+                nbWrong++;
+        }
+    }
+    
+    BOOST_CHECK_EQUAL( nbWrong, 0 );
+    BOOST_CHECK_EQUAL( nbValid, 19 );
+}
+
+BOOST_AUTO_TEST_CASE(TEST_GC_COUNT) {
+    
+    const string bases = "ACGT";
+    uint32_t nbWrong = 0;
+    
+    // Cover K-mers that fill whole words as well as partial ones
+    for(uint16_t k = 1; k <= 70; k += 3) {
+        
+        mer_dna::k(k);
+        
+        for(uint32_t j = 0; j < 20; j++) {
+            
+            string merstr;
+            uint16_t expected = 0;
+            for(uint16_t i = 0; i < k; i++) {
+                char c = bases[(i * 7 + j * 13 + i / 5) % 4];
+                merstr += c;
+                if (c == 'G' || c == 'C') expected++;
+            }
+            
+            mer_dna m(merstr);
+            if (JellyfishHelper::gcCount(m) != expected) nbWrong++;
+        }
+    }
+    
+    mer_dna::k(32);
+    mer_dna g;
+    g.polyG();
+    BOOST_CHECK_EQUAL( JellyfishHelper::gcCount(g), 32 );
+    g.polyT();
+    BOOST_CHECK_EQUAL( JellyfishHelper::gcCount(g), 0 );
+    
+    BOOST_CHECK_EQUAL( nbWrong, 0 );
+}
+
+BOOST_AUTO_TEST_CASE(TEST_IN_SAMPLE) {
+    
+    const string bases = "ACGT";
+    const uint64_t threshold = JellyfishHelper::sampleThreshold(0.5);
+    uint32_t nbWrong = 0;
+    uint32_t nbKept = 0;
+    uint32_t nbTested = 0;
+    
+    // Lengths either side of each word boundary, where the reverse complement is shifted
+    for(uint16_t k = 1; k <= 97; k++) {
+        
+        mer_dna::k(k);
+        
+        for(uint32_t j = 0; j < 20; j++) {
+            
+            string merstr;
+            for(uint16_t i = 0; i < k; i++) {
+                merstr += bases[(i * 7 + j * 13 + i / 5 + k) % 4];
+            }
+            
+            mer_dna m(merstr);
+            const bool expected = JellyfishHelper::mixKey(m.get_canonical()) <= threshold;
+            if (JellyfishHelper::inSample(m, threshold) != expected) nbWrong++;
+            if (JellyfishHelper::inSample(m.get_reverse_complement(), threshold) != expected) nbWrong++;
+            if (expected) nbKept++;
+            nbTested++;
+        }
+    }
+    
+    BOOST_CHECK_EQUAL( nbWrong, 0 );
+    BOOST_CHECK( nbKept > 0 && nbKept < nbTested );
+}
+
 BOOST_AUTO_TEST_CASE(TEST_COUNT) {
     
     cout << "Start" << endl;
@@ -194,4 +341,215 @@ BOOST_AUTO_TEST_CASE(TEST_DUMP) {
     remove("temp_dump.jf");
 }
 
+BOOST_AUTO_TEST_CASE(TEST_HASH_DUMP) {
+    
+    HashLoader hl;
+    LargeHashArrayPtr hash = hl.loadHash("data/ecoli.header.jf27", false);
+    
+    HashDump hd("data/ecoli.header.jf27");
+    
+    BOOST_CHECK_EQUAL( hd.getNbRecords(), 1889 );
+    
+    // Every record streamed from the file, over several slices, must match the hash
+    uint64_t nbRecords = 0;
+    uint64_t nbWrong = 0;
+    for(uint16_t i = 0; i < 3; i++) {
+        HashDump::slice_iterator it = hd.slice(i, 3);
+        while (it.next()) {
+            nbRecords++;
+            if (JellyfishHelper::getCount(hash, it.key(), false) != it.val()) {
+                nbWrong++;
+            }
+        }
+    }
+    
+    BOOST_CHECK_EQUAL( nbRecords, 1889 );
+    BOOST_CHECK_EQUAL( nbWrong, 0 );
+}
+
+BOOST_AUTO_TEST_CASE(TEST_HASH_DUMP_BAD_HEADER) {
+    
+    std::ifstream in("data/ecoli.header.jf27", std::ios::binary);
+    const string good((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    
+    // Each edit keeps the header the same length, so only the field under test changes
+    vector<std::pair<string, string>> edits = {
+        { "\"counter_len\":4", "\"counter_len\":9" },
+        { "\"key_len\":54,\"matrix1\"", "\"key_len\":129,\"matrix1\"" }
+    };
+    
+    for(const auto& e : edits) {
+        string bad = good;
+        size_t pos = bad.find(e.first);
+        BOOST_REQUIRE( pos != string::npos );
+        bad.replace(pos, e.first.size(), e.second);
+        if (e.second.size() > e.first.size()) {
+            // Take the extra character out of the hostname
+            bad.erase(bad.find("E6530") + 4, 1);
+        }
+        BOOST_REQUIRE_EQUAL( bad.size(), good.size() );
+        
+        std::ofstream out("temp_bad_header.jf", std::ios::binary);
+        out << bad;
+        out.close();
+        
+        BOOST_CHECK_THROW( HashDump hd("temp_bad_header.jf"), JellyfishException );
+    }
+    
+    remove("temp_bad_header.jf");
+}
+
+BOOST_AUTO_TEST_CASE(TEST_SKETCH_SEQ_FILES) {
+    
+    vector<uint16_t> merLens = JellyfishHelper::parseMerLens("11,27,41");
+    
+    BOOST_CHECK_EQUAL( merLens.size(), 3 );
+    BOOST_CHECK_EQUAL( merLens[2], 41 );
+    
+    vector<path> seqFiles;
+    seqFiles.push_back("data/sect_length_test.fa");
+    
+    vector<shared_ptr<SpectrumSketch>> sketches = JellyfishHelper::sketchSeqFiles(seqFiles, merLens, true, true, 1000000, 3);
+    
+    BOOST_CHECK_EQUAL( sketches.size(), 3 );
+    
+    // Read the sequences back in and count canonical K-mers of each length directly
+    vector<string> seqs;
+    std::ifstream in("data/sect_length_test.fa");
+    string line;
+    while (std::getline(in, line)) {
+        if (line[0] == '>') 
+            seqs.push_back("");
+        else
+            seqs.back() += line;
+    }
+    
+    for(size_t i = 0; i < merLens.size(); i++) {
+        
+        const uint16_t k = merLens[i];
+        std::map<string, uint32_t> counts;
+        for(const string& seq : seqs) {
+            for(size_t j = 0; j + k <= seq.size(); j++) {
+                string fwd = seq.substr(j, k);
+                if (fwd.find_first_not_of("ACGT") != string::npos)
+                    continue;
+                string rev(fwd.rbegin(), fwd.rend());
+                for(char& c : rev) {
+                    c = c == 'A' ? 'T' : c == 'C' ? 'G' : c == 'G' ? 'C' : 'A';
+                }
+                counts[std::min(fwd, rev)]++;
+            }
+        }
+        
+        vector<uint64_t> expected(100, 0);
+        uint64_t expectedGC = 0;
+        for(const auto& c : counts) {
+            expected[std::min<uint32_t>(c.second, 99)]++;
+            expectedGC += std::count_if(c.first.begin(), c.first.end(), [](char b) { return b == 'C' || b == 'G'; });
+        }
+        
+        // Small enough to count everything exactly
+        BOOST_CHECK_EQUAL( sketches[i]->getFraction(), 1.0 );
+        BOOST_CHECK_EQUAL( sketches[i]->getNbSampled(), counts.size() );
+        
+        vector<uint64_t> spectrum(100, 0);
+        sketches[i]->estimateSpectrum(spectrum);
+        BOOST_CHECK( spectrum == expected );
+        
+        uint64_t gc = 0;
+        sketches[i]->forEach([&gc](uint32_t count, uint16_t tag, double weight) { gc += tag; });
+        BOOST_CHECK_EQUAL( gc, expectedGC );
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TEST_COUNT_SEQ_FILES) {
+    
+    BOOST_CHECK_THROW( JellyfishHelper::parseMerLens("21,31,21"), JellyfishException );
+    BOOST_CHECK_THROW( JellyfishHelper::parseMerLens("11,13,15,17,19,21,23,25,27"), JellyfishException );
+    
+    vector<uint16_t> merLens = JellyfishHelper::parseMerLens("11,27,41");
+    
+    vector<path> seqFiles;
+    seqFiles.push_back("data/sect_length_test.fa");
+    
+    // A tiny starting hash forces each counter to double its hash while counting
+    vector<shared_ptr<SpectrumTable>> tables = JellyfishHelper::countSeqFiles(seqFiles, merLens, true, 1000, 4);
+    
+    BOOST_CHECK_EQUAL( tables.size(), 3 );
+    
+    vector<string> seqs;
+    std::ifstream in("data/sect_length_test.fa");
+    string line;
+    while (std::getline(in, line)) {
+        if (line[0] == '>') 
+            seqs.push_back("");
+        else
+            seqs.back() += line;
+    }
+    
+    for(size_t i = 0; i < merLens.size(); i++) {
+        
+        const uint16_t k = merLens[i];
+        std::map<string, uint32_t> counts;
+        for(const string& seq : seqs) {
+            for(size_t j = 0; j + k <= seq.size(); j++) {
+                string fwd = seq.substr(j, k);
+                if (fwd.find_first_not_of("ACGT") != string::npos)
+                    continue;
+                string rev(fwd.rbegin(), fwd.rend());
+                for(char& c : rev) {
+                    c = c == 'A' ? 'T' : c == 'C' ? 'G' : c == 'G' ? 'C' : 'A';
+                }
+                counts[std::min(fwd, rev)]++;
+            }
+        }
+        
+        std::map<uint32_t, uint64_t> expected;
+        uint64_t expectedGC = 0;
+        for(const auto& c : counts) {
+            expected[c.second]++;
+            expectedGC += std::count_if(c.first.begin(), c.first.end(), [](char b) { return b == 'C' || b == 'G'; });
+        }
+        
+        BOOST_CHECK( !tables[i]->isEstimated() );
+        BOOST_CHECK_EQUAL( tables[i]->getNbDistinct(), counts.size() );
+        
+        std::map<uint32_t, uint64_t> spectrum;
+        uint64_t gc = 0;
+        tables[i]->forEach([&spectrum, &gc](uint64_t count, uint16_t tag, double distinct) {
+            spectrum[count] += (uint64_t)distinct;
+            gc += tag * (uint64_t)distinct;
+        });
+        BOOST_CHECK( spectrum == expected );
+        BOOST_CHECK_EQUAL( gc, expectedGC );
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TEST_MER_LEN_COUNTER_ERROR) {
+    
+    // Whole reads, batched as the read parser would
+    shared_ptr<jellyfish::sequence_list> reads = make_shared<jellyfish::sequence_list>();
+    std::ifstream in("data/sect_length_test.fa");
+    string line;
+    while (std::getline(in, line)) {
+        if (line[0] == '>') 
+            reads->data.push_back(jellyfish::header_sequence_qual());
+        else
+            reads->data.back().seq += line;
+    }
+    reads->nb_filled = reads->data.size();
+    
+    // A hash far too small for the reads, which is not allowed to grow, fails in every
+    // thread.  The error must be passed on rather than leaving threads waiting on each
+    // other to finish with the hash.
+    unique_ptr<MerLenCounter> counter = MerLenCounter::create(0, 21, true, 64, true, 3);
+    counter->start();
+    for(int i = 0; i < 10; i++) {
+        counter->add(reads);
+    }
+    
+    BOOST_CHECK_THROW( counter->finish(), std::runtime_error );
+    BOOST_CHECK( counter->failed() );
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
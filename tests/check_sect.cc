@@ -24,8 +24,23 @@
 
 
 
+#include <fstream>
+#include <sstream>
+
 #include "../src/sect.hpp"
+#include "../src/cvg.hpp"
 using kat::Sect;
+using kat::Cvg;
+using kat::CoverageReader;
+using kat::CountHistogram;
+using kat::BaseMasks;
+
+string readFile(const path& p) {
+    std::ifstream in(p.c_str());
+    stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
 
 BOOST_AUTO_TEST_SUITE( KAT_SECT )
 
@@ -67,4 +82,373 @@ BOOST_AUTO_TEST_CASE( length_check )
     remove("temp/sect_length_stats.csv");
 }
 
+BOOST_AUTO_TEST_CASE( chunked )
+{
+    // Count K-mers from the sequence file itself so that coverage is non-zero
+    vector<path> inputs;
+    inputs.push_back("data/sect_length_test.fa");
+    
+    Sect whole(inputs, "data/sect_length_test.fa");
+    whole.setOutputPrefix("temp/sect_whole");
+    whole.setHashSize(100000);
+    whole.execute();
+    
+    // Split the sequence into many small chunks, shared between several threads
+    Sect chunked(inputs, "data/sect_length_test.fa");
+    chunked.setOutputPrefix("temp/sect_chunked");
+    chunked.setHashSize(100000);
+    chunked.setChunkSize(1000);
+    chunked.setThreads(4);
+    chunked.execute();
+    
+    BOOST_CHECK_EQUAL( readFile("temp/sect_whole-stats.csv"), readFile("temp/sect_chunked-stats.csv") );
+    BOOST_CHECK_EQUAL( readFile("temp/sect_whole-counts.cvg"), readFile("temp/sect_chunked-counts.cvg") );
+    
+    remove("temp/sect_whole-counts.cvg");
+    remove("temp/sect_whole-stats.csv");
+    remove("temp/sect_chunked-counts.cvg");
+    remove("temp/sect_chunked-stats.csv");
+}
+
+BOOST_AUTO_TEST_CASE( median_histogram )
+{
+    // Use a small limit so some medians come from the overflowed counts
+    uint32_t nbWrong = 0;
+    
+    for(uint32_t n = 1; n < 200; n++) {
+        
+        CountHistogram first(50);
+        CountHistogram second(50);
+        vector<uint64_t> all;
+        
+        for(uint32_t i = 0; i < n; i++) {
+            uint64_t count = (i * 7919 + n * 31) % (n + 40);
+            all.push_back(count);
+            if (i % 3 == 0) first.add(count); else second.add(count);
+        }
+        
+        first.merge(second);
+        
+        std::sort(all.begin(), all.end());
+        if (first.median() != all[all.size() / 2]) nbWrong++;
+    }
+    
+    BOOST_CHECK_EQUAL( nbWrong, 0 );
+    
+    CountHistogram empty;
+    BOOST_CHECK_EQUAL( empty.median(), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( binary_counts )
+{
+    vector<path> inputs;
+    inputs.push_back("data/sect_length_test.fa");
+    
+    Sect text(inputs, "data/sect_length_test.fa");
+    text.setOutputPrefix("temp/sect_text");
+    text.setHashSize(100000);
+    text.execute();
+    
+    Sect binary(inputs, "data/sect_length_test.fa");
+    binary.setOutputPrefix("temp/sect_binary");
+    binary.setHashSize(100000);
+    binary.setBinaryCounts(true);
+    binary.execute();
+    
+    BOOST_CHECK( !bfs::exists("temp/sect_binary-counts.cvg") );
+    
+    // Converting back to text should give the same file as sect's text output
+    Cvg cvg("temp/sect_binary-counts.cvgb");
+    cvg.execute();
+    
+    BOOST_CHECK_EQUAL( cvg.getNbWritten(), 1 );
+    BOOST_CHECK_EQUAL( readFile("temp/sect_text-counts.cvg"), readFile("temp/sect_binary-counts.cvg") );
+    
+    // Random access to a range that spans a block boundary
+    CoverageReader reader("temp/sect_binary-counts.cvgb");
+    vector<uint64_t> all;
+    vector<uint64_t> range;
+    reader.read(0, all);
+    reader.read(reader.find("seq1"), 65530, 65540, range);
+    
+    BOOST_CHECK( all.size() > 65540 );
+    BOOST_CHECK( range == vector<uint64_t>(all.begin() + 65530, all.begin() + 65540) );
+    BOOST_CHECK_EQUAL( reader.find("missing"), reader.size() );
+    
+    remove("temp/sect_text-counts.cvg");
+    remove("temp/sect_text-stats.csv");
+    remove("temp/sect_binary-counts.cvgb");
+    remove("temp/sect_binary-counts.cvg");
+    remove("temp/sect_binary-stats.csv");
+}
+
+BOOST_AUTO_TEST_CASE( windows )
+{
+    vector<path> inputs;
+    inputs.push_back("data/sect_length_test.fa");
+    
+    // Chunk size is not a multiple of the window, so chunks must be realigned
+    Sect sect(inputs, "data/sect_length_test.fa");
+    sect.setOutputPrefix("temp/sect_window");
+    sect.setHashSize(100000);
+    sect.setWindow(1000);
+    sect.setChunkSize(1500);
+    sect.setThreads(2);
+    sect.execute();
+    
+    BOOST_CHECK( !bfs::exists("temp/sect_window-counts.cvg") );
+    
+    // Window tallies should add up to the tallies for the whole sequence
+    std::ifstream windows("temp/sect_window-windows.bed");
+    string line;
+    std::getline(windows, line);
+    
+    uint32_t nbWindows = 0;
+    uint64_t lastEnd = 0;
+    uint64_t invalid = 0;
+    uint64_t nonZero = 0;
+    while (std::getline(windows, line)) {
+        vector<string> parts;
+        boost::split(parts, line, boost::is_any_of("\t"));
+        BOOST_CHECK_EQUAL( lexical_cast<uint64_t>(parts[1]), lastEnd );
+        lastEnd = lexical_cast<uint64_t>(parts[2]);
+        invalid += lexical_cast<uint64_t>(parts[6]);
+        nonZero += lexical_cast<uint64_t>(parts[8]);
+        nbWindows++;
+    }
+    
+    std::ifstream stats("temp/sect_window-stats.csv");
+    std::getline(stats, line);
+    std::getline(stats, line);
+    vector<string> parts;
+    boost::split(parts, line, boost::is_any_of("\t"));
+    
+    BOOST_CHECK_EQUAL( nbWindows, 69 );
+    BOOST_CHECK_EQUAL( lastEnd, lexical_cast<uint64_t>(parts[4]) );
+    BOOST_CHECK_EQUAL( invalid, lexical_cast<uint64_t>(parts[5]) );
+    BOOST_CHECK_EQUAL( nonZero, lexical_cast<uint64_t>(parts[7]) );
+    
+    remove("temp/sect_window-windows.bed");
+    remove("temp/sect_window-stats.csv");
+}
+
+BOOST_AUTO_TEST_CASE( base_masks )
+{
+    const string alphabet = "ACGTacgtNnRX-";
+    string seq;
+    for(uint32_t i = 0; i < 1000; i++) {
+        seq += alphabet[(i * 7 + i / 13) % alphabet.size()];
+    }
+    
+    // Whatever the compiler targets, blocks must match the scalar version
+    for(uint32_t len = 0; len <= BaseMasks::BLOCK_SIZE; len++) {
+        uint64_t invalid, gc, n, sInvalid, sGC, sN;
+        BaseMasks::classifyBlock(seq.c_str() + len, len, invalid, gc, n);
+        BaseMasks::classifyBlockScalar(seq.c_str() + len, len, sInvalid, sGC, sN);
+        BOOST_CHECK_EQUAL( invalid, sInvalid );
+        BOOST_CHECK_EQUAL( gc, sGC );
+        BOOST_CHECK_EQUAL( n, sN );
+    }
+    
+    BaseMasks masks;
+    masks.classify(seq.c_str() + 3, 901);
+    BOOST_CHECK_EQUAL( masks.size(), 901 );
+    
+    uint64_t invalid = 0, gc = 0, n = 0;
+    uint64_t firstInvalid = 901;
+    for(uint32_t i = 100; i < 801; i++) {
+        const char c = seq[i + 3];
+        const bool bad = c != 'A' && c != 'C' && c != 'G' && c != 'T';
+        if (bad) invalid++;
+        if (bad && firstInvalid == 901 && i >= 150) firstInvalid = i;
+        if (c == 'G' || c == 'C' || c == 'g' || c == 'c') gc++;
+        if (c == 'N' || c == 'n') n++;
+        BOOST_CHECK_EQUAL( masks.isInvalid(i), bad );
+    }
+    
+    BOOST_CHECK_EQUAL( masks.countInvalid(100, 801), invalid );
+    BOOST_CHECK_EQUAL( masks.countGC(100, 801), gc );
+    BOOST_CHECK_EQUAL( masks.countN(100, 801), n );
+    BOOST_CHECK_EQUAL( masks.nextInvalid(150, 801), firstInvalid );
+    BOOST_CHECK_EQUAL( masks.nextInvalid(0, 0), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( multi_input )
+{
+    vector<path> inputs;
+    inputs.push_back("data/sect_length_test.fa");
+    
+    Sect single(inputs, "data/sect_length_test.fa");
+    single.setOutputPrefix("temp/sect_single");
+    single.setHashSize(100000);
+    single.execute();
+    
+    // The same input twice should give the same coverage from each
+    vector<vector<path>> multi_inputs;
+    multi_inputs.push_back(inputs);
+    multi_inputs.push_back(inputs);
+    
+    Sect multi(multi_inputs, "data/sect_length_test.fa");
+    multi.setOutputPrefix("temp/sect_multi");
+    multi.setHashSize(100000);
+    multi.setChunkSize(1000);
+    multi.setThreads(2);
+    multi.execute();
+    
+    BOOST_CHECK_EQUAL( multi.getNbInputs(), 2 );
+    BOOST_CHECK( !bfs::exists("temp/sect_multi-counts.cvg") );
+    
+    const string counts = readFile("temp/sect_single-counts.cvg");
+    BOOST_CHECK( counts == readFile("temp/sect_multi-counts-hash1.cvg") );
+    BOOST_CHECK( counts == readFile("temp/sect_multi-counts-hash2.cvg") );
+    
+    std::ifstream stats("temp/sect_multi-stats.csv");
+    string line;
+    std::getline(stats, line);
+    BOOST_CHECK_EQUAL( line, "seq_name\tmedian_1\tmean_1\tmedian_2\tmean_2\tgc%\tseq_length\tinvalid_bases\t%_invalid\t"
+            "non_zero_bases_1\t%_non_zero_1\t%_non_zero_corrected_1\tnon_zero_bases_2\t%_non_zero_2\t%_non_zero_corrected_2" );
+    
+    std::getline(stats, line);
+    vector<string> parts;
+    boost::split(parts, line, boost::is_any_of("\t"));
+    BOOST_CHECK_EQUAL( parts.size(), 15 );
+    BOOST_CHECK_EQUAL( parts[1], parts[3] );
+    BOOST_CHECK_EQUAL( parts[2], parts[4] );
+    BOOST_CHECK_EQUAL( parts[9], parts[12] );
+    BOOST_CHECK_EQUAL( parts[11], parts[14] );
+    
+    remove("temp/sect_single-counts.cvg");
+    remove("temp/sect_single-stats.csv");
+    remove("temp/sect_multi-counts-hash1.cvg");
+    remove("temp/sect_multi-counts-hash2.cvg");
+    remove("temp/sect_multi-stats.csv");
+}
+
+BOOST_AUTO_TEST_CASE( sample )
+{
+    vector<path> inputs;
+    inputs.push_back("data/sect_length_test.fa");
+    
+    Sect sect(inputs, "data/sect_length_test.fa");
+    sect.setOutputPrefix("temp/sect_sample");
+    sect.setHashSize(100000);
+    sect.setSample(10);
+    sect.setChunkSize(1000);
+    sect.setThreads(2);
+    sect.execute();
+    
+    BOOST_CHECK( !bfs::exists("temp/sect_sample-counts.cvg") );
+    
+    std::ifstream stats("temp/sect_sample-stats.csv");
+    string line;
+    std::getline(stats, line);
+    std::getline(stats, line);
+    vector<string> parts;
+    boost::split(parts, line, boost::is_any_of("\t"));
+    
+    BOOST_CHECK_EQUAL( parts.size(), 17 );
+    
+    // Every 10th K-mer is sampled, and the bounds should contain the values found
+    // when looking up every K-mer
+    BOOST_CHECK_EQUAL( lexical_cast<uint64_t>(parts[10]), (68985 - 27) / 10 + 1 );
+    BOOST_CHECK_EQUAL( lexical_cast<uint32_t>(parts[5]), 31747 );
+    BOOST_CHECK( lexical_cast<uint32_t>(parts[11]) <= 1094 && lexical_cast<uint32_t>(parts[12]) >= 1094 );
+    BOOST_CHECK( lexical_cast<double>(parts[13]) <= 590.60381 && lexical_cast<double>(parts[14]) >= 590.60381 );
+    BOOST_CHECK( lexical_cast<double>(parts[15]) <= 53.96250 && lexical_cast<double>(parts[16]) >= 53.96250 );
+    
+    remove("temp/sect_sample-stats.csv");
+}
+
+BOOST_AUTO_TEST_CASE( regions )
+{
+    vector<path> inputs;
+    inputs.push_back("data/sect_length_test.fa");
+    
+    Sect whole(inputs, "data/sect_length_test.fa");
+    whole.setOutputPrefix("temp/sect_noregion");
+    whole.setHashSize(100000);
+    whole.execute();
+    
+    // The whole sequence, and a range of it in both supported formats
+    {
+        std::ofstream regions("temp/sect_regions.txt");
+        regions << "seq1" << endl
+                << "seq1:1,001-5,000" << endl
+                << "seq1\t1000\t5000\r" << endl;
+    }
+    
+    remove("data/sect_length_test.fa.fai");
+    
+    Sect sect(inputs, "data/sect_length_test.fa");
+    sect.setOutputPrefix("temp/sect_region");
+    sect.setHashSize(100000);
+    sect.setRegionsFile("temp/sect_regions.txt");
+    sect.execute();
+    
+    BOOST_CHECK( bfs::exists("data/sect_length_test.fa.fai") );
+    
+    std::ifstream wholeStats("temp/sect_noregion-stats.csv");
+    string header, wholeLine;
+    std::getline(wholeStats, header);
+    std::getline(wholeStats, wholeLine);
+    
+    std::ifstream stats("temp/sect_region-stats.csv");
+    string line, range1, range2;
+    std::getline(stats, line);
+    std::getline(stats, line);
+    std::getline(stats, range1);
+    std::getline(stats, range2);
+    
+    BOOST_CHECK_EQUAL( line, wholeLine );
+    BOOST_CHECK_EQUAL( range1, range2 );
+    BOOST_CHECK_EQUAL( range1.substr(0, 15), "seq1:1001-5000\t" );
+    
+    // Counts for the range are a slice of those for the whole sequence
+    std::ifstream wholeCounts("temp/sect_noregion-counts.cvg");
+    std::getline(wholeCounts, line);
+    std::getline(wholeCounts, line);
+    vector<string> all;
+    boost::split(all, line, boost::is_any_of(" "));
+    
+    std::ifstream counts("temp/sect_region-counts.cvg");
+    std::getline(counts, line);
+    std::getline(counts, line);
+    std::getline(counts, line);
+    BOOST_CHECK_EQUAL( line, ">seq1:1001-5000" );
+    std::getline(counts, line);
+    vector<string> part;
+    boost::split(part, line, boost::is_any_of(" "));
+    
+    BOOST_CHECK_EQUAL( part.size(), 4000 - 27 + 1 );
+    BOOST_CHECK( std::equal(part.begin(), part.end(), all.begin() + 1000) );
+    
+    remove("data/sect_length_test.fa.fai");
+    remove("temp/sect_regions.txt");
+    remove("temp/sect_noregion-counts.cvg");
+    remove("temp/sect_noregion-stats.csv");
+    remove("temp/sect_region-counts.cvg");
+    remove("temp/sect_region-stats.csv");
+}
+
+BOOST_AUTO_TEST_CASE( regions_malformed )
+{
+    vector<path> inputs;
+    inputs.push_back("data/sect_length_test.fa");
+    
+    {
+        std::ofstream regions("temp/sect_bad_regions.txt");
+        regions << "seq1\t1000\tend" << endl;
+    }
+    
+    Sect sect(inputs, "data/sect_length_test.fa");
+    sect.setOutputPrefix("temp/sect_bad_region");
+    sect.setHashSize(100000);
+    sect.setRegionsFile("temp/sect_bad_regions.txt");
+    
+    BOOST_CHECK_THROW( sect.execute(), SectException );
+    
+    remove("data/sect_length_test.fa.fai");
+    remove("temp/sect_bad_regions.txt");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
@@ -32,6 +32,14 @@ using boost::filesystem::remove;
 #include <../src/inc/spectra_helper.hpp>
 using kat::SpectraHelper;
 
+#include <../src/inc/spectrum_sketch.hpp>
+using kat::SpectrumSketch;
+
+#include <../src/inc/kmer_spectra.hpp>
+using kat::KmerSpectra;
+using kat::KmerPeak;
+using kat::SpectraEstimate;
+
 BOOST_AUTO_TEST_SUITE(KAT_SPECTRA_HELPER)
 
 BOOST_AUTO_TEST_CASE(TEST_LOAD_HIST) {
@@ -62,4 +70,98 @@ BOOST_AUTO_TEST_CASE(TEST_PEAK) {
     BOOST_CHECK_EQUAL( 9762, p.second );
 }
 
+BOOST_AUTO_TEST_CASE(TEST_SPECTRA_FIT) {
+    
+    vector<Pos> hist;
+    SpectraHelper::loadHist("data/kat.hist", hist);
+    
+    // Leave out the last bin, which holds everything beyond it
+    vector<uint64_t> spectrum(hist.size(), 0);
+    for(size_t i = 0; i + 1 < hist.size(); i++) {
+        spectrum[hist[i].first] = hist[i].second;
+    }
+    
+    KmerSpectra ks(spectrum);
+    
+    BOOST_CHECK( ks.fit() );
+    BOOST_CHECK_EQUAL( ks.getFirstMin(), 26 );
+    BOOST_CHECK_EQUAL( ks.getGlobalMax(), 229 );
+    
+    // A haploid bacterial genome of around 1.6 Mbp
+    SpectraEstimate est = ks.estimate(27);
+    
+    BOOST_CHECK( est.homCoverage > 220.0 && est.homCoverage < 245.0 );
+    BOOST_CHECK( est.genomeSize > 1400000 && est.genomeSize < 1700000 );
+    BOOST_CHECK_EQUAL( est.hetCoverage, 0.0 );
+}
+
+BOOST_AUTO_TEST_CASE(TEST_SPECTRA_FIT_DIPLOID) {
+    
+    // Errors, plus a heterozygous peak at 25x and a homozygous peak at 50x
+    KmerPeak het(25.0, 5.0, 2000000.0);
+    KmerPeak hom(50.0, 7.0, 4000000.0);
+    
+    vector<uint64_t> spectrum(200, 0);
+    for(uint32_t x = 1; x < spectrum.size(); x++) {
+        spectrum[x] = (uint64_t)(2e7 * pow(x, -3.5) + het.point(x) + hom.point(x));
+    }
+    
+    KmerSpectra ks(spectrum);
+    
+    BOOST_CHECK( ks.fit() );
+    BOOST_CHECK_EQUAL( ks.getPeaks().size(), 2 );
+    
+    SpectraEstimate est = ks.estimate(27);
+    
+    BOOST_CHECK_CLOSE( est.homCoverage, 50.0, 1.0 );
+    BOOST_CHECK_CLOSE( est.hetCoverage, 25.0, 1.0 );
+    BOOST_CHECK_CLOSE( (double)est.genomeSize, 5000000.0, 2.0 );
+    
+    // A fifth of the K-mers in each haplotype are heterozygous
+    BOOST_CHECK_CLOSE( est.heterozygosity, 1.0 - pow(0.8, 1.0 / 27.0), 5.0 );
+}
+
+uint64_t splitMix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+BOOST_AUTO_TEST_CASE(TEST_SPECTRUM_SKETCH) {
+    
+    // 200000 distinct keys seen once, 100000 seen 5 times and 50000 seen 20 times
+    vector<uint64_t> expected(30, 0);
+    expected[1] = 200000;
+    expected[5] = 100000;
+    expected[20] = 50000;
+    
+    // Small enough to force several rounds of subsampling
+    SpectrumSketch sketch(20000);
+    
+    {
+        SpectrumSketch::Buffer buffer(sketch);
+        uint64_t key = 0;
+        for(uint32_t c = 1; c < expected.size(); c++) {
+            for(uint64_t i = 0; i < expected[c]; i++, key++) {
+                for(uint32_t j = 0; j < c; j++) {
+                    buffer.add(splitMix(key));
+                }
+            }
+        }
+    }
+    
+    BOOST_CHECK( sketch.getNbSampled() <= 20000 );
+    BOOST_CHECK( sketch.getFraction() < 0.1 );
+    BOOST_CHECK_CLOSE( (double)sketch.estimateDistinct(), 350000.0, 5.0 );
+    
+    vector<uint64_t> spectrum(30, 0);
+    sketch.estimateSpectrum(spectrum);
+    
+    BOOST_CHECK_CLOSE( (double)spectrum[1], 200000.0, 7.0 );
+    BOOST_CHECK_CLOSE( (double)spectrum[5], 100000.0, 10.0 );
+    BOOST_CHECK_CLOSE( (double)spectrum[20], 50000.0, 15.0 );
+    BOOST_CHECK_EQUAL( spectrum[2] + spectrum[10] + spectrum[29], 0 );
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file